@@ -0,0 +1,326 @@
+//===-- goparse-cache.cpp - compilation cache for llvm-goparse ------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Methods for CompileCache class.
+//
+//===----------------------------------------------------------------------===//
+
+#include "goparse-cache.h"
+
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/Support/Chrono.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <algorithm>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "go-c.h"
+#include "go-sha1.h"
+
+using namespace llvm;
+
+// Helper for computing SHA1 hashes of sequences of strings. Each
+// string is preceded by its length, so that (for example) the
+// sequences "ab","c" and "a","bc" produce different hashes.
+
+namespace {
+class Hasher {
+ public:
+  Hasher() : sha1_(go_create_sha1_helper()) { }
+
+  void add(StringRef s) {
+    uint64_t len = s.size();
+    sha1_->process_bytes(&len, sizeof(len));
+    sha1_->process_bytes(s.data(), s.size());
+  }
+
+  std::string hex() { return toHex(sha1_->finish()); }
+
+ private:
+  std::unique_ptr<Go_sha1_helper> sha1_;
+};
+}
+
+static void touch(const std::string &path)
+{
+  int fd;
+  if (sys::fs::openFileForWrite(path, fd, sys::fs::F_Append))
+    return;
+  sys::fs::setLastModificationAndAccessTime(fd,
+                                            sys::toTimePoint(time(nullptr)));
+  ::close(fd);
+}
+
+CompileCache::CompileCache(const std::string &dir,
+                           uint64_t maxSize,
+                           const std::string &suffix)
+    : dir_(dir), maxSize_(maxSize), suffix_(suffix)
+{
+  sys::fs::create_directories(dir_);
+}
+
+std::string CompileCache::path(const std::string &name) const
+{
+  SmallString<256> p(dir_);
+  sys::path::append(p, name);
+  return p.str();
+}
+
+bool CompileCache::computePrimaryKey(ArrayRef<std::string> keyItems,
+                                     ArrayRef<std::string> inputFiles)
+{
+  Hasher h;
+  for (auto &item : keyItems)
+    h.add(item);
+  for (auto &fn : inputFiles) {
+    ErrorOr<std::unique_ptr<MemoryBuffer>> BufOrErr = MemoryBuffer::getFile(fn);
+    if (!BufOrErr)
+      return false;
+    h.add(fn);
+    h.add((*BufOrErr)->getBuffer());
+  }
+  primaryKey_ = h.hex();
+  return true;
+}
+
+std::string CompileCache::secondaryKey(const std::vector<Import> &imports) const
+{
+  Hasher h;
+  h.add(primaryKey_);
+  for (auto &imp : imports) {
+    h.add(imp.path);
+    h.add(std::to_string(imp.offset));
+    h.add(imp.hash);
+  }
+  return h.hex();
+}
+
+// Manifest format: one line per import, "<offset> <path>".
+
+bool CompileCache::readManifest(std::vector<Import> &imports) const
+{
+  ErrorOr<std::unique_ptr<MemoryBuffer>> BufOrErr =
+      MemoryBuffer::getFile(path(primaryKey_ + ".manifest"));
+  if (!BufOrErr)
+    return false;
+  touch(path(primaryKey_ + ".manifest"));
+  StringRef rest = (*BufOrErr)->getBuffer();
+  while (!rest.empty()) {
+    StringRef line;
+    std::tie(line, rest) = rest.split('\n');
+    if (line.empty())
+      continue;
+    StringRef offs, fn;
+    std::tie(offs, fn) = line.split(' ');
+    unsigned long long offset;
+    if (fn.empty() || getAsUnsignedInteger(offs, 10, offset))
+      return false;
+    Import imp;
+    imp.path = fn.str();
+    imp.offset = static_cast<off_t>(offset);
+    imports.push_back(imp);
+  }
+  return true;
+}
+
+void CompileCache::writeManifest() const
+{
+  int fd;
+  SmallString<128> tmp;
+  if (sys::fs::createUniqueFile(path("tmp-%%%%%%%%"), fd, tmp))
+    return;
+  {
+    raw_fd_ostream os(fd, true);
+    for (auto &imp : imports_)
+      os << imp.offset << " " << imp.path << "\n";
+  }
+  if (sys::fs::rename(tmp, path(primaryKey_ + ".manifest")))
+    sys::fs::remove(tmp);
+}
+
+bool CompileCache::hashImport(const std::string &fn, off_t offset,
+                              std::string &hash) const
+{
+  int fd = ::open(fn.c_str(), O_RDONLY);
+  if (fd < 0)
+    return false;
+  char *buf = nullptr;
+  size_t len = 0;
+  int err = 0;
+  const char *msg = go_read_export_data(fd, offset, &buf, &len, &err);
+  ::close(fd);
+  if (msg || !buf)
+    return false;
+  Hasher h;
+  h.add(StringRef(buf, len));
+  hash = h.hex();
+  delete [] buf;
+  return true;
+}
+
+void CompileCache::recordImport(int fd, off_t offset,
+                                const char *data, size_t len)
+{
+  SmallString<256> fn;
+  if (sys::fs::getPathFromOpenFD(fd, fn))
+    return;
+  if (!seen_.insert(std::make_pair(fn.str().str(), offset)).second)
+    return;
+  Hasher h;
+  h.add(StringRef(data, len));
+  Import imp;
+  imp.path = fn.str();
+  imp.offset = offset;
+  imp.hash = h.hex();
+  imports_.push_back(imp);
+}
+
+std::unique_ptr<MemoryBuffer> CompileCache::lookup()
+{
+  std::unique_ptr<MemoryBuffer> rval;
+  std::vector<Import> imports;
+  if (!primaryKey_.empty() && readManifest(imports)) {
+    bool ok = true;
+    for (auto &imp : imports) {
+      if (!hashImport(imp.path, imp.offset, imp.hash)) {
+        ok = false;
+        break;
+      }
+    }
+    if (ok) {
+      std::string outPath = path(secondaryKey(imports) + "." + suffix_);
+      ErrorOr<std::unique_ptr<MemoryBuffer>> BufOrErr =
+          MemoryBuffer::getFile(outPath);
+      if (BufOrErr) {
+        rval = std::move(*BufOrErr);
+        touch(outPath);
+      }
+    }
+  }
+  updateStats(rval != nullptr);
+  return rval;
+}
+
+void CompileCache::store(StringRef outputPath)
+{
+  if (primaryKey_.empty())
+    return;
+  writeManifest();
+
+  int fd;
+  SmallString<128> tmp;
+  if (sys::fs::createUniqueFile(path("tmp-%%%%%%%%"), fd, tmp))
+    return;
+  ::close(fd);
+  std::string outPath = path(secondaryKey(imports_) + "." + suffix_);
+  if (sys::fs::copy_file(outputPath, tmp) || sys::fs::rename(tmp, outPath)) {
+    sys::fs::remove(tmp);
+    return;
+  }
+  trim();
+}
+
+// Stats file format: "<hits> <misses>".
+
+void CompileCache::readStats(uint64_t *hits, uint64_t *misses) const
+{
+  *hits = *misses = 0;
+  ErrorOr<std::unique_ptr<MemoryBuffer>> BufOrErr =
+      MemoryBuffer::getFile(path("stats"));
+  if (!BufOrErr)
+    return;
+  StringRef h, m;
+  std::tie(h, m) = (*BufOrErr)->getBuffer().trim().split(' ');
+  unsigned long long v;
+  if (!getAsUnsignedInteger(h, 10, v))
+    *hits = v;
+  if (!getAsUnsignedInteger(m, 10, v))
+    *misses = v;
+}
+
+// Note: updates from concurrent compilations may race with one
+// another; the stats are meant to be informative, not exact.
+
+void CompileCache::updateStats(bool hit) const
+{
+  uint64_t hits, misses;
+  readStats(&hits, &misses);
+  if (hit)
+    hits += 1;
+  else
+    misses += 1;
+  int fd;
+  SmallString<128> tmp;
+  if (sys::fs::createUniqueFile(path("tmp-%%%%%%%%"), fd, tmp))
+    return;
+  {
+    raw_fd_ostream os(fd, true);
+    os << hits << " " << misses << "\n";
+  }
+  if (sys::fs::rename(tmp, path("stats")))
+    sys::fs::remove(tmp);
+}
+
+// Collect the cached files (outputs and manifests) into 'entries'.
+// Returns their total size.
+
+uint64_t CompileCache::listEntries(std::vector<Entry> &entries) const
+{
+  uint64_t total = 0;
+  std::error_code EC;
+  for (sys::fs::directory_iterator it(dir_, EC), end;
+       it != end && !EC; it.increment(EC)) {
+    StringRef name = sys::path::filename(it->path());
+    if (name == "stats" || name.startswith("tmp-"))
+      continue;
+    sys::fs::file_status st;
+    if (it->status(st))
+      continue;
+    Entry e = { st.getLastModificationTime(), st.getSize(), it->path() };
+    entries.push_back(e);
+    total += e.size;
+  }
+  return total;
+}
+
+// Evict least recently used entries until the cache is within its
+// size limit.
+
+void CompileCache::trim() const
+{
+  std::vector<Entry> entries;
+  uint64_t total = listEntries(entries);
+  if (total <= maxSize_)
+    return;
+
+  std::sort(entries.begin(), entries.end(),
+            [](const Entry &a, const Entry &b) { return a.mtime < b.mtime; });
+  for (auto &e : entries) {
+    if (total <= maxSize_)
+      break;
+    if (!sys::fs::remove(e.path))
+      total -= e.size;
+  }
+}
+
+void CompileCache::report(raw_ostream &os) const
+{
+  uint64_t hits, misses;
+  readStats(&hits, &misses);
+  std::vector<Entry> entries;
+  uint64_t size = listEntries(entries);
+  os << "compile cache " << dir_ << ": hits=" << hits
+     << " misses=" << misses << " size=" << size
+     << " limit=" << maxSize_ << "\n";
+}
@@ -0,0 +1,110 @@
+//===-- goparse-cache.h - compilation cache for llvm-goparse --------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Defines CompileCache class, a content-addressed on-disk cache of
+// compiled outputs used by llvm-goparse.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef GOPARSE_CACHE_H
+#define GOPARSE_CACHE_H
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/Chrono.h"
+#include "llvm/Support/MemoryBuffer.h"
+
+#include <memory>
+#include <set>
+#include <string>
+#include <sys/types.h>
+#include <vector>
+
+namespace llvm {
+class raw_ostream;
+}
+
+// The cache works in two steps, since the set of packages imported by
+// a compilation is known only after the sources have been parsed.
+//
+// The primary key is a hash of the compiler identity, the command
+// line (minus the output file name) and the contents of the source
+// files. For each primary key, the cache holds a manifest listing the
+// import files (and archive offsets) whose export data was read when
+// the package was last compiled. The secondary key, which names the
+// cached output itself, combines the primary key with a hash of the
+// current export data for each import in the manifest; any change to
+// an imported package thus results in a miss.
+//
+// Hit/miss counts are maintained in a "stats" file within the cache
+// directory. Once the total size of the cache exceeds the specified
+// limit, the least recently used entries are evicted.
+
+class CompileCache {
+ public:
+  CompileCache(const std::string &dir,
+               uint64_t maxSize,
+               const std::string &suffix);
+
+  // Compute the primary key from the strings in 'keyItems' (compiler
+  // identity, options, etc) plus the contents of 'inputFiles'. Returns
+  // false if one of the input files can't be read.
+  bool computePrimaryKey(llvm::ArrayRef<std::string> keyItems,
+                         llvm::ArrayRef<std::string> inputFiles);
+
+  // Look up the cached output for the current primary key. Returns
+  // the contents of the cached output on a hit, or null on a miss.
+  std::unique_ptr<llvm::MemoryBuffer> lookup();
+
+  // Record the fact that the compilation read export data 'data'
+  // from file descriptor 'fd' at the specified offset.
+  void recordImport(int fd, off_t offset, const char *data, size_t len);
+
+  // Install the output file 'outputPath' of a successful compilation
+  // into the cache (along with a manifest), then trim the cache if it
+  // is over its size limit.
+  void store(llvm::StringRef outputPath);
+
+  // Print hit/miss counts and size info to 'os'. Doesn't modify the
+  // cache.
+  void report(llvm::raw_ostream &os) const;
+
+ private:
+  struct Import {
+    std::string path;
+    off_t offset;
+    std::string hash;
+  };
+
+  struct Entry {
+    llvm::sys::TimePoint<> mtime;
+    uint64_t size;
+    std::string path;
+  };
+
+  std::string dir_;
+  uint64_t maxSize_;
+  std::string suffix_;
+  std::string primaryKey_;
+  std::vector<Import> imports_;
+  std::set<std::pair<std::string, off_t> > seen_;
+
+  std::string path(const std::string &name) const;
+  std::string secondaryKey(const std::vector<Import> &imports) const;
+  bool readManifest(std::vector<Import> &imports) const;
+  void writeManifest() const;
+  bool hashImport(const std::string &path, off_t offset,
+                  std::string &hash) const;
+  void readStats(uint64_t *hits, uint64_t *misses) const;
+  void updateStats(bool hit) const;
+  uint64_t listEntries(std::vector<Entry> &entries) const;
+  void trim() const;
+};
+
+#endif // GOPARSE_CACHE_H
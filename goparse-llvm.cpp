@@ -13,38 +13,69 @@
 
 
 #include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/ScopeExit.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/StringExtras.h"
 #include "llvm/ADT/Triple.h"
 #include "llvm/Analysis/TargetLibraryInfo.h"
+#include "llvm/Analysis/TargetTransformInfo.h"
+#include "llvm/Bitcode/BitcodeReader.h"
+#include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/Bitcode/BitcodeWriterPass.h"
 #include "llvm/CodeGen/CommandFlags.h"
 #include "llvm/IR/DiagnosticInfo.h"
 #include "llvm/IR/DiagnosticPrinter.h"
 #include "llvm/IR/LLVMContext.h"
 #include "llvm/IR/LegacyPassManager.h"
+#include "llvm/IR/Module.h"
 #include "llvm/Support/CommandLine.h"
 #include "llvm/Support/Debug.h"
 #include "llvm/Support/Format.h"
 #include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MD5.h"
 #include "llvm/Support/ManagedStatic.h"
 #include "llvm/Support/MemoryBuffer.h"
 #include "llvm/Support/Path.h"
 #include "llvm/Support/PrettyStackTrace.h"
+#include "llvm/Support/Process.h"
+#include "llvm/Support/Program.h"
 #include "llvm/Support/Signals.h"
 #include "llvm/Support/TargetRegistry.h"
 #include "llvm/Support/TargetSelect.h"
+#include "llvm/Support/Timer.h"
 #include "llvm/Support/ToolOutputFile.h"
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/Target/TargetMachine.h"
+#include "llvm/Transforms/IPO.h"
+#include "llvm/Transforms/IPO/AlwaysInliner.h"
+#include "llvm/Transforms/IPO/PassManagerBuilder.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+#include "llvm/Transforms/Utils/SplitModule.h"
 
 #include <algorithm>
+#include <chrono>
 #include <cstring>
+#include <functional>
+#include <map>
+#include <set>
 #include <string>
 #include <system_error>
+#include <thread>
+#include <signal.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
 #include <unistd.h>
 
 #include "go-c.h"
+#include "goparse-cache.h"
 #include "go-llvm-linemap.h"
+#include "go-llvm-backend.h"
+#include "go-llvm-chunker.h"
 #include "go-llvm-diagnostics.h"
 #include "go-llvm.h"
 
@@ -58,7 +89,7 @@ TargetTriple("mtriple", cl::desc("Override target triple for module"));
 static cl::list<std::string>
 InputFilenames(cl::Positional,
                cl::desc("<input go source files>"),
-               cl::OneOrMore);
+               cl::ZeroOrMore);
 
 static cl::opt<std::string>
 IncludeDirs("I", cl::desc("<include dirs>"));
@@ -120,6 +151,22 @@ DumpIR("dump-ir",
         cl::desc("Dump LLVM IR for module at end of run."),
         cl::init(false));
 
+static cl::opt<bool>
+DiscardValueNames("fdiscard-value-names",
+                  cl::desc("Discard names of LLVM values, blocks and types "
+                           "(ignored with -dump-ir or -tracelevel)."),
+#ifdef NDEBUG
+                  cl::init(true));
+#else
+                  cl::init(false));
+#endif
+
+static cl::opt<bool>
+SimplifyNodes("fsimplify-bnodes",
+              cl::desc("Simplify backend node trees prior to "
+                       "IR generation."),
+              cl::init(false));
+
 static cl::opt<bool>
 OptimizeAllocs("fgo-optimize-allocs",
                cl::desc("Enable escape analysis in the go frontend."),
@@ -152,10 +199,240 @@ TraceLevel("tracelevel",
            cl::desc("Set debug trace level (def: 0, no trace output)."),
            cl::init(0));
 
+static cl::opt<unsigned>
+ParallelCodegen("fparallel-codegen",
+                cl::desc("Split module into N partitions and run code "
+                         "generation for each on a separate thread "
+                         "(def: 1, no splitting). Requires object file "
+                         "output; the partitions are combined with a "
+                         "relocatable link (see -fpartition-linker)."),
+                cl::init(1));
+
+static cl::opt<std::string>
+PartitionLinker("fpartition-linker",
+                cl::desc("Linker used to combine the object files produced "
+                         "by -fparallel-codegen/-fstreaming-codegen (def: "
+                         "'ld' for the host target, '<triple>-ld' when "
+                         "cross compiling)."),
+                cl::init(""));
+
+static cl::opt<std::string>
+ServerSocket("server",
+             cl::desc("Run as a compile server, accepting jobs on "
+                      "the specified Unix domain socket."),
+             cl::init(""));
+
+static cl::opt<std::string>
+BatchManifest("batch",
+              cl::desc("Compile the packages listed in the specified "
+                       "manifest file (in dependency order) within a "
+                       "single process."),
+              cl::init(""));
+
+static cl::opt<bool>
+PrintStartupTime("fstartup-time",
+                 cl::desc("Report the time elapsed between process startup "
+                          "and the start of parsing."),
+                 cl::Hidden,
+                 cl::init(false));
+
+static cl::opt<bool>
+StreamCodegen("fstreaming-codegen",
+              cl::desc("Compile functions to machine code as their bodies "
+                       "are completed, then discard their IR. Requires "
+                       "object file output and a linker (see "
+                       "-fpartition-linker); not compatible with -g."),
+              cl::init(false));
+
+static cl::opt<unsigned>
+StreamBatchSize("fstreaming-codegen-batch",
+                cl::desc("Number of completed functions to accumulate "
+                         "before compiling them with -fstreaming-codegen "
+                         "(def: 64)."),
+                cl::init(64));
+
+static cl::opt<std::string>
+CompileCacheDir("fcompile-cache-dir",
+                cl::desc("Cache compiled outputs in the specified "
+                         "directory, keyed on sources, imports and "
+                         "options."),
+                cl::init(""));
+
+static cl::opt<unsigned>
+CompileCacheMaxSize("fcompile-cache-max-size",
+                    cl::desc("Maximum size of the compilation cache in "
+                             "megabytes (def: 1024)."),
+                    cl::init(1024));
+
+static cl::opt<bool>
+CompileCacheStats("fcompile-cache-stats",
+                  cl::desc("Report compilation cache statistics."),
+                  cl::init(false));
+
+static cl::opt<bool>
+TimeReport("ftime-report",
+           cl::desc("Report time spent in each phase of the compilation."),
+           cl::init(false));
+
+static cl::opt<std::string>
+TimeReportFile("ftime-report-file",
+               cl::desc("Write the -ftime-report output to the specified "
+                        "file instead of stderr."),
+               cl::init(""));
+
+static cl::opt<bool>
+MemReport("fmem-report",
+          cl::desc("Report memory usage after each phase of the "
+                   "compilation."),
+          cl::init(false));
+
+static cl::opt<bool>
+EmitLLVM("emit-llvm",
+         cl::desc("Emit LLVM bitcode instead of assembly or object code."),
+         cl::init(false));
+
+static cl::opt<std::string>
+LTOMode("flto",
+        cl::desc("Emit bitcode for link time optimization; with "
+                 "-flto=thin, a ThinLTO module summary is written along "
+                 "with the IR (def: full)."),
+        cl::ValueOptional,
+        cl::init(""));
+
+// Returns true if we're emitting bitcode (-emit-llvm or -flto) as
+// opposed to assembly or object code.
+static bool EmitBitcode() {
+  return EmitLLVM || LTOMode.getNumOccurrences() != 0;
+}
+
+static bool EmitThinLTO() {
+  return LTOMode.getNumOccurrences() != 0 && LTOMode == "thin";
+}
+
+// Returns the suffix for output files of the requested type.
+static const char *OutputSuffix() {
+  if (EmitBitcode())
+    return "bc";
+  return (FileType == TargetMachine::CGFT_AssemblyFile ? "s" : "o");
+}
+
+// Time at which main() was entered (for -fstartup-time).
+static std::chrono::steady_clock::time_point StartupTime;
+
+// Initialize the target(s) needed for the compilation. In the common
+// case (no -mtriple or -march, or a triple naming the host
+// architecture) only the native target is initialized, which is
+// considerably cheaper than initializing every target that LLVM was
+// built with. Target infos (which are cheap) are registered up front
+// in main, so that lookupTarget can report the available targets.
+static void InitializeTargets(const Triple &TheTriple)
+{
+  static bool nativeInitialized = false;
+  static bool allInitialized = false;
+  if (allInitialized)
+    return;
+
+  Triple host(sys::getProcessTriple());
+  if (MArch.empty() && TheTriple.getArch() == host.getArch()) {
+    if (!nativeInitialized) {
+      InitializeNativeTarget();
+      InitializeNativeTargetAsmPrinter();
+      InitializeNativeTargetAsmParser();
+      nativeInitialized = true;
+    }
+    return;
+  }
+
+  InitializeAllTargets();
+  InitializeAllTargetMCs();
+  InitializeAllAsmPrinters();
+  InitializeAllAsmParsers();
+  allInitialized = true;
+}
+
+// Register passes with the pass registry. Registration is needed only
+// for looking up passes by name (e.g. -print-after, -stop-after); the
+// pipelines themselves create their passes directly. The code
+// generator passes are always registered; the IR optimization passes
+// only when the IR optimization pipeline is going to run.
+static void InitializePassRegistry(bool IROpt)
+{
+  static bool codegenInitialized = false;
+  static bool irOptInitialized = false;
+  PassRegistry *Registry = PassRegistry::getPassRegistry();
+  if (!codegenInitialized) {
+    initializeCore(*Registry);
+    initializeCodeGen(*Registry);
+    initializeLoopStrengthReducePass(*Registry);
+    initializeLowerIntrinsicsPass(*Registry);
+    initializeCountingFunctionInserterPass(*Registry);
+    initializeUnreachableBlockElimLegacyPassPass(*Registry);
+    initializeConstantHoistingLegacyPassPass(*Registry);
+    codegenInitialized = true;
+  }
+  if (IROpt && !irOptInitialized) {
+    initializeScalarOpts(*Registry);
+    initializeVectorization(*Registry);
+    initializeIPO(*Registry);
+    initializeAnalysis(*Registry);
+    initializeTransformUtils(*Registry);
+    initializeInstCombine(*Registry);
+    irOptInitialized = true;
+  }
+}
+
+// Returns the IR optimization level (0-3) corresponding to the
+// -O setting; no -O option is treated as -O2, matching the code
+// generator default.
+static unsigned GetIROptLevel() {
+  switch (OptLevel) {
+  case '0': return 0;
+  case '1': return 1;
+  case '3': return 3;
+  default: return 2;
+  }
+}
+
+// Populate the function and module pass managers with the mid-level
+// IR optimization pipeline for the specified optimization level. This
+// is modeled on what "opt" and clang do: the PassManagerBuilder
+// supplies the standard per-level pipeline (SROA/mem2reg, inlining,
+// GVN, LICM, loop and SLP vectorization, etc), and the target machine
+// gets a chance to add its own passes.
+static void AddOptimizationPasses(legacy::PassManagerBase &MPM,
+                                  legacy::FunctionPassManager &FPM,
+                                  TargetMachine *TM,
+                                  const TargetLibraryInfoImpl &TLII,
+                                  unsigned OptLevel) {
+  PassManagerBuilder Builder;
+  Builder.OptLevel = OptLevel;
+  Builder.SizeLevel = 0;
+
+  // Note that the builder takes ownership of the inliner and TLI.
+  if (OptLevel > 1)
+    Builder.Inliner = createFunctionInliningPass(OptLevel, 0);
+  else
+    Builder.Inliner = createAlwaysInlinerLegacyPass();
+  Builder.LibraryInfo = new TargetLibraryInfoImpl(TLII);
+  Builder.DisableUnrollLoops = (OptLevel == 0);
+  Builder.LoopVectorize = (OptLevel > 1);
+  Builder.SLPVectorize = (OptLevel > 1);
+
+  // When emitting bitcode for LTO, defer some of the work (e.g. the
+  // vectorizers) to link time.
+  Builder.PrepareForThinLTO = EmitThinLTO();
+  Builder.PrepareForLTO = EmitBitcode() && !EmitThinLTO();
+
+  TM->adjustPassManager(Builder);
+
+  Builder.populateFunctionPassManager(FPM);
+  Builder.populateModulePassManager(MPM);
+}
+
 static std::unique_ptr<tool_output_file>
 GetOutputStream() {
   // Decide if we need "binary" output.
-  bool Binary = false;
+  bool Binary = EmitBitcode();
   switch (FileType) {
   case TargetMachine::CGFT_AssemblyFile:
     break;
@@ -180,6 +457,403 @@ GetOutputStream() {
   return FDOut;
 }
 
+// Run code generation (optionally preceded by the IR optimization
+// pipeline) for the module 'M', writing the result to the file
+// 'OutPath'. Returns false on error, with details in 'Err'.
+
+static bool CompileModule(Module &M,
+                          TargetMachine *TM,
+                          bool Optimize,
+                          const std::string &OutPath,
+                          std::string &Err)
+{
+  std::error_code EC;
+  raw_fd_ostream OS(OutPath, EC, sys::fs::F_None);
+  if (EC) {
+    Err = EC.message();
+    return false;
+  }
+
+  legacy::PassManager PM;
+  TargetLibraryInfoImpl TLII(Triple(M.getTargetTriple()));
+  PM.add(new TargetLibraryInfoWrapperPass(TLII));
+  if (Optimize) {
+    PM.add(createTargetTransformInfoWrapperPass(TM->getTargetIRAnalysis()));
+    legacy::FunctionPassManager FPM(&M);
+    FPM.add(createTargetTransformInfoWrapperPass(TM->getTargetIRAnalysis()));
+    AddOptimizationPasses(PM, FPM, TM, TLII, GetIROptLevel());
+    FPM.doInitialization();
+    for (Function &F : M)
+      FPM.run(F);
+    FPM.doFinalization();
+  }
+  if (TM->addPassesToEmitFile(PM, OS, FileType)) {
+    Err = "target does not support generation of this file type";
+    return false;
+  }
+  PM.run(M);
+  return true;
+}
+
+// Code generation for a single module partition, used by the
+// -fparallel-codegen support below. The partition arrives in bitcode
+// form; since an LLVMContext can't be shared between threads, each
+// worker materializes its partition in a private context. Output is
+// written to the file 'OutPath'. Returns false on error, with details
+// in 'Err'.
+
+static bool CodegenPartition(StringRef Bitcode,
+                             TargetMachine *TM,
+                             const std::string &OutPath,
+                             std::string &Err)
+{
+  LLVMContext Ctx;
+  Expected<std::unique_ptr<Module>> MOrErr =
+      parseBitcodeFile(MemoryBufferRef(Bitcode, "<partition>"), Ctx);
+  if (!MOrErr) {
+    Err = toString(MOrErr.takeError());
+    return false;
+  }
+  std::unique_ptr<Module> MPart = std::move(*MOrErr);
+  return CompileModule(*MPart, TM, false, OutPath, Err);
+}
+
+// Locate the linker used to combine partition object files for
+// target 'T' (see CombinePartitions). An explicit -fpartition-linker
+// wins; otherwise the host's 'ld' is used when compiling for the host,
+// and the conventional cross linker names ("<triple>-ld", then the
+// same without the vendor) are tried when cross compiling. Returns
+// false, with details in 'Err', if no suitable linker can be found.
+
+static bool FindPartitionLinker(const Triple &T, std::string &LD,
+                                std::string &Err)
+{
+  std::vector<std::string> Candidates;
+  if (!PartitionLinker.empty()) {
+    Candidates.push_back(PartitionLinker);
+  } else {
+    Triple Host(sys::getProcessTriple());
+    if (T.getArch() == Host.getArch() && T.getOS() == Host.getOS() &&
+        T.getObjectFormat() == Host.getObjectFormat()) {
+      Candidates.push_back("ld");
+    } else {
+      Candidates.push_back(T.str() + "-ld");
+      if (T.getVendor() != Triple::UnknownVendor) {
+        std::string Name = T.getArchName().str() + "-" +
+            T.getOSName().str();
+        if (!T.getEnvironmentName().empty())
+          Name += "-" + T.getEnvironmentName().str();
+        Candidates.push_back(Name + "-ld");
+      }
+    }
+  }
+
+  for (auto &C : Candidates) {
+    if (sys::path::has_parent_path(C)) {
+      if (sys::fs::can_execute(C)) {
+        LD = C;
+        return true;
+      }
+      continue;
+    }
+    if (ErrorOr<std::string> Path = sys::findProgramByName(C)) {
+      LD = *Path;
+      return true;
+    }
+  }
+  Err = "unable to locate linker '" + Candidates.front() + "' for target " +
+        T.str() + " (needed to combine object files for "
+        "-fparallel-codegen/-fstreaming-codegen; see -fpartition-linker)";
+  return false;
+}
+
+// Combine the per-partition object files into a single object with a
+// relocatable link ("ld -r"), writing the result to 'OS'. Assembly
+// output is not supported, since the partitions' local labels and
+// .file directives would collide if the files were simply pasted
+// together.
+
+static bool CombinePartitions(const Triple &T,
+                              const std::vector<SmallString<128>> &Parts,
+                              raw_pwrite_stream &OS,
+                              std::vector<SmallString<128>> &TmpFiles,
+                              std::string &Err)
+{
+  assert(FileType == TargetMachine::CGFT_ObjectFile);
+  std::string LD;
+  if (!FindPartitionLinker(T, LD, Err))
+    return false;
+  SmallString<128> Combined;
+  std::error_code EC =
+      sys::fs::createTemporaryFile("llvm-goparse", "o", Combined);
+  if (EC) {
+    Err = EC.message();
+    return false;
+  }
+  TmpFiles.push_back(Combined);
+  std::vector<const char *> Args;
+  Args.push_back(LD.c_str());
+  Args.push_back("-r");
+  Args.push_back("-o");
+  Args.push_back(Combined.c_str());
+  for (auto &P : Parts)
+    Args.push_back(P.c_str());
+  Args.push_back(nullptr);
+  std::string ErrMsg;
+  int rc = sys::ExecuteAndWait(LD, Args.data(), nullptr, nullptr,
+                               0, 0, &ErrMsg);
+  if (rc != 0) {
+    Err = "relocatable link of partitions with " + LD + " failed";
+    if (!ErrMsg.empty())
+      Err += ": " + ErrMsg;
+    return false;
+  }
+
+  ErrorOr<std::unique_ptr<MemoryBuffer>> BufOrErr =
+      MemoryBuffer::getFile(Combined);
+  if (!BufOrErr) {
+    Err = BufOrErr.getError().message();
+    return false;
+  }
+  OS << (*BufOrErr)->getBuffer();
+  return true;
+}
+
+// Streaming a module out in chunks (-fstreaming-codegen) requires that
+// module-local symbols referenced across chunks be promoted to hidden
+// external symbols. Since the chunks are then combined into a single
+// relocatable object, which may in turn be linked with the objects for
+// other packages, names are qualified with a per-package prefix. In
+// the absence of -fgo-pkgpath, the prefix is derived from a hash of
+// the full set of input files.
+
+static std::string ExternalizePrefix()
+{
+  if (!PackagePath.empty())
+    return "go.split." + PackagePath + ".";
+  MD5 Hash;
+  for (auto &fn : InputFilenames) {
+    SmallString<128> Path(fn);
+    sys::fs::make_absolute(Path);
+    Hash.update(Path);
+    Hash.update(StringRef("", 1));
+  }
+  MD5::MD5Result Result;
+  Hash.final(Result);
+  SmallString<32> Digest;
+  MD5::stringifyResult(Result, Digest);
+  return "go.split." + Digest.str().str() + ".";
+}
+
+// Support for -fparallel-codegen. Splits a copy of the optimized
+// module into 'NumParts' partitions, runs code generation for each
+// partition on its own thread (each with its own TargetMachine
+// created via 'TMFactory'), then combines the results into the
+// output stream 'OS'. A copy is split (as opposed to the original)
+// since the backend still holds references into the original module.
+// Module-local symbols are kept local (and placed in the same
+// partition as their users), so that private/unnamed_addr constants
+// can still be merged by the linker.
+
+static bool SplitCodegen(Module *M,
+                         unsigned NumParts,
+                         const std::function<std::unique_ptr<TargetMachine>()>
+                             &TMFactory,
+                         raw_pwrite_stream &OS,
+                         std::string &Err)
+{
+  Triple T(M->getTargetTriple());
+  std::unique_ptr<Module> Clone = CloneModule(M);
+
+  std::vector<SmallString<0>> Bitcodes;
+  Bitcodes.reserve(NumParts);
+  SplitModule(std::move(Clone), NumParts,
+              [&](std::unique_ptr<Module> MPart) {
+                // Note that module inline asm (which declares the
+                // export data section) is cloned into each partition;
+                // this is harmless, since it holds no data.
+                Bitcodes.emplace_back();
+                raw_svector_ostream BCOS(Bitcodes.back());
+                WriteBitcodeToFile(MPart.get(), BCOS);
+              },
+              /*PreserveLocals=*/true);
+
+  const char *Suffix = OutputSuffix();
+  std::vector<SmallString<128>> Parts(Bitcodes.size());
+  for (unsigned i = 0; i < Bitcodes.size(); ++i) {
+    std::error_code EC =
+        sys::fs::createTemporaryFile("llvm-goparse-part", Suffix, Parts[i]);
+    if (EC) {
+      Err = EC.message();
+      return false;
+    }
+  }
+
+  std::vector<std::string> Errs(Bitcodes.size());
+  std::vector<std::thread> Workers;
+  for (unsigned i = 0; i < Bitcodes.size(); ++i) {
+    Workers.emplace_back([&, i]() {
+        std::unique_ptr<TargetMachine> TM = TMFactory();
+        if (!TM) {
+          Errs[i] = "unable to create target machine";
+          return;
+        }
+        CodegenPartition(Bitcodes[i], TM.get(), Parts[i].str(), Errs[i]);
+      });
+  }
+  for (auto &W : Workers)
+    W.join();
+
+  bool ok = true;
+  for (auto &E : Errs) {
+    if (!E.empty()) {
+      Err = E;
+      ok = false;
+      break;
+    }
+  }
+
+  std::vector<SmallString<128>> TmpFiles(Parts);
+  if (ok && FileType != TargetMachine::CGFT_Null)
+    ok = CombinePartitions(T, Parts, OS, TmpFiles, Err);
+  for (auto &T : TmpFiles)
+    sys::fs::remove(T);
+  return ok;
+}
+
+// Helper class for -fstreaming-codegen. The backend hands us each
+// function once its body is complete. Completed functions are queued
+// up; once a batch has accumulated, the batch is extracted into a
+// separate module (see FunctionChunker), optimized and compiled to a
+// temporary output file, after which the IR bodies in the main module
+// are dropped (leaving only declarations). Note that this limits
+// cross-function optimization (e.g. inlining) to functions within the
+// same batch. Once IR generation is complete (see completeModule), the
+// module-local symbols referenced from the chunks are promoted in the
+// main module, before it is optimized. At the end of the compilation,
+// the chunk files are combined with the output for the remainder of
+// the module (globals, export data, etc).
+
+class FunctionStreamer {
+ public:
+  FunctionStreamer(Module *M, TargetMachine *TM, unsigned batchSize)
+      : module_(M), tm_(TM), batchSize_(batchSize),
+        chunker_(M, ExternalizePrefix()) { }
+  ~FunctionStreamer();
+
+  // Invoked by the backend when the body of 'F' is complete.
+  void functionCompleted(Function *F);
+
+  // Compile any pending functions. Returns false on error.
+  bool flush();
+
+  // Invoked once IR generation is complete: compile any pending
+  // functions, then promote the symbols referenced from the chunks in
+  // the main module. Returns false on error.
+  bool completeModule();
+
+  // Compile the (already optimized) remainder of the module and
+  // combine the results with the previously compiled chunks, writing
+  // everything to 'OS'.
+  bool finish(raw_pwrite_stream &OS);
+
+  unsigned numChunks() const { return chunks_.size(); }
+  const std::string &error() const { return err_; }
+
+ private:
+  Module *module_;
+  TargetMachine *tm_;
+  unsigned batchSize_;
+  FunctionChunker chunker_;
+  std::vector<Function *> pending_;
+  std::vector<SmallString<128>> chunks_;
+  std::string err_;
+
+  bool newTempFile(const char *tag, SmallString<128> &path);
+};
+
+FunctionStreamer::~FunctionStreamer()
+{
+  for (auto &c : chunks_)
+    sys::fs::remove(c);
+}
+
+bool FunctionStreamer::newTempFile(const char *tag, SmallString<128> &path)
+{
+  std::error_code EC = sys::fs::createTemporaryFile(tag, OutputSuffix(),
+                                                    path);
+  if (EC) {
+    err_ = EC.message();
+    return false;
+  }
+  return true;
+}
+
+void FunctionStreamer::functionCompleted(Function *F)
+{
+  if (!err_.empty())
+    return;
+  pending_.push_back(F);
+  if (pending_.size() >= batchSize_)
+    flush();
+}
+
+bool FunctionStreamer::flush()
+{
+  if (!err_.empty())
+    return false;
+  if (pending_.empty())
+    return true;
+
+  std::unique_ptr<Module> chunk = chunker_.extract(pending_);
+  setFunctionAttributes(getCPUStr(), getFeaturesStr(), *chunk);
+
+  SmallString<128> path;
+  if (!newTempFile("llvm-goparse-chunk", path))
+    return false;
+  chunks_.push_back(path);
+  if (!CompileModule(*chunk, tm_, true, path.str(), err_))
+    return false;
+
+  // Drop the IR bodies, leaving declarations.
+  for (Function *F : pending_)
+    F->deleteBody();
+  pending_.clear();
+  return true;
+}
+
+bool FunctionStreamer::completeModule()
+{
+  if (!flush())
+    return false;
+  chunker_.promoteLocals();
+  return true;
+}
+
+bool FunctionStreamer::finish(raw_pwrite_stream &OS)
+{
+  assert(pending_.empty());
+  if (!err_.empty())
+    return false;
+
+  SmallString<128> rest;
+  if (!newTempFile("llvm-goparse-rest", rest))
+    return false;
+  std::vector<SmallString<128>> parts;
+  parts.push_back(rest);
+  parts.insert(parts.end(), chunks_.begin(), chunks_.end());
+  std::vector<SmallString<128>> tmpFiles;
+  tmpFiles.push_back(rest);
+
+  bool ok = CompileModule(*module_, tm_, false, rest.str(), err_);
+  if (ok && FileType != TargetMachine::CGFT_Null)
+    ok = CombinePartitions(Triple(module_->getTargetTriple()), parts, OS,
+                           tmpFiles, err_);
+  for (auto &t : tmpFiles)
+    sys::fs::remove(t);
+  return ok;
+}
+
 static void DiagnosticHandler(const DiagnosticInfo &DI, void *Context) {
   bool *HasError = static_cast<bool *>(Context);
   if (DI.getSeverity() == DS_Error)
@@ -225,39 +899,175 @@ static Llvm_backend *init_gogo(TargetMachine *Target,
   return backend;
 }
 
-int main(int argc, char **argv)
+// Add a directory to the front end's import search path. Directories
+// are added at most once (the same directory is often passed in via
+// both -I and -L). Note that the search path is process-wide state;
+// in server and batch mode each job runs in its own child process.
+
+static void AddSearchPath(const std::string &dir)
 {
-  Triple TheTriple;
+  static std::set<std::string> added;
+  struct stat st;
+  if (added.count(dir) || stat(dir.c_str(), &st) != 0 || !S_ISDIR(st.st_mode))
+    return;
+  added.insert(dir);
+  go_add_search_path(dir.c_str());
+}
 
-  InitializeAllTargets();
-  InitializeAllTargetMCs();
-  InitializeAllAsmPrinters();
-  InitializeAllAsmParsers();
+// Timers for the phases of a compilation (-ftime-report). A timer
+// accessor returns null if timing is not enabled, which turns the
+// corresponding llvm::TimeRegion into a no-op. The report includes
+// all active timer groups: the driver phases, the backend's IR
+// generation timers, and (via -time-passes) individual passes.
+
+namespace {
+class PhaseTimers {
+ public:
+  PhaseTimers()
+      : enabled_(TimeReport || !TimeReportFile.empty()),
+        group_("goparse", "llvm-goparse phases"),
+        parse_("parse", "Parse and IR generation", group_),
+        writeGlobals_("write_globals", "Write globals", group_),
+        verify_("verify", "Verify module", group_),
+        dump_("dump", "Dump IR", group_),
+        optimize_("optimize", "IR function passes", group_),
+        codegen_("codegen", "Module passes and code generation", group_) { }
+
+  bool enabled() const { return enabled_; }
+  Timer *parse() { return get(parse_); }
+  Timer *writeGlobals() { return get(writeGlobals_); }
+  Timer *verify() { return get(verify_); }
+  Timer *dump() { return get(dump_); }
+  Timer *optimize() { return get(optimize_); }
+  Timer *codegen() { return get(codegen_); }
+
+  // Print all timer groups (ours, the backend's and the pass timers),
+  // then clear them; otherwise LLVM prints each group again as its
+  // timers are destroyed.
+  void report() {
+    if (!enabled_)
+      return;
+    if (TimeReportFile.empty()) {
+      TimerGroup::printAll(errs());
+    } else {
+      std::error_code EC;
+      raw_fd_ostream OS(TimeReportFile, EC, sys::fs::F_Text);
+      if (EC)
+        errs() << "unable to open " << TimeReportFile << ": "
+               << EC.message() << "\n";
+      else
+        TimerGroup::printAll(OS);
+    }
+    TimerGroup::clearAll();
+  }
 
-  cl::ParseCommandLineOptions(argc, argv, "llvm go parser driver\n");
+ private:
+  Timer *get(Timer &t) { return enabled_ ? &t : nullptr; }
 
-  // Initialize codegen and IR passes
-  PassRegistry *Registry = PassRegistry::getPassRegistry();
-  initializeCore(*Registry);
-  initializeCodeGen(*Registry);
-  initializeLoopStrengthReducePass(*Registry);
-  initializeLowerIntrinsicsPass(*Registry);
-  initializeCountingFunctionInserterPass(*Registry);
-  initializeUnreachableBlockElimLegacyPassPass(*Registry);
-  initializeConstantHoistingLegacyPassPass(*Registry);
-  initializeScalarOpts(*Registry);
-  initializeVectorization(*Registry);
+  bool enabled_;
+  TimerGroup group_;
+  Timer parse_, writeGlobals_, verify_, dump_, optimize_, codegen_;
+};
+}
+
+// Support for -fmem-report: report peak RSS and the number of bytes
+// currently allocated via malloc, followed by the sizes (object counts
+// and bytes) of the major backend data structures (Bnode arenas and
+// archives, type arena and tables, value caches, linemap).
+
+static void ReportMemoryUsage(const char *phase,
+                              Llvm_backend *backend,
+                              Llvm_linemap *linemap)
+{
+  struct rusage ru;
+  memset(&ru, 0, sizeof(ru));
+  ::getrusage(RUSAGE_SELF, &ru);
+  std::cerr << "mem report after " << phase << ": peak-rss="
+            << ru.ru_maxrss << "K malloc="
+            << sys::Process::GetMallocUsage() << "\n"
+            << backend->statistics() << "\n"
+            << "linemap: " << linemap->statistics()
+            << " bytes=" << linemap->memoryBytes() << "\n";
+}
+
+// Returns true if the output of the current compilation can be
+// served from (and stored into) the compilation cache.
+
+static bool UseCompileCache()
+{
+  return (!CompileCacheDir.empty() && !NoBackend && !DumpIR && !DumpAst &&
+          (EmitBitcode() || FileType != TargetMachine::CGFT_Null) &&
+          !OutputFileName.empty() && OutputFileName != "-");
+}
+
+// Collect the non-file inputs to the compilation for use in the cache
+// key: the identity of the compiler binary, the target triple, and
+// the command line arguments (minus the output file and cache options,
+// which don't affect the generated code). With -g, the working
+// directory is included as well, since it is recorded in the debug
+// meta-data.
+
+static std::vector<std::string>
+CompileCacheKeyItems(const char *progname,
+                     ArrayRef<const char *> args,
+                     const Triple &triple)
+{
+  std::vector<std::string> items;
+  std::string exe =
+      sys::fs::getMainExecutable(progname, (void *)(intptr_t)&UseCompileCache);
+  sys::fs::file_status st;
+  items.push_back(exe);
+  if (!sys::fs::status(exe, st)) {
+    items.push_back(std::to_string(st.getSize()));
+    items.push_back(std::to_string(
+        st.getLastModificationTime().time_since_epoch().count()));
+  }
+  items.push_back(triple.getTriple());
+  if (MinusGOption) {
+    SmallString<128> cwd;
+    if (!sys::fs::current_path(cwd))
+      items.push_back(cwd.str());
+  }
+  for (unsigned i = 1; i < args.size(); ++i) {
+    StringRef arg(args[i]);
+    if (arg == "-o") {
+      ++i;
+      continue;
+    }
+    if (arg.startswith("-o=") || arg.startswith("-fcompile-cache-") ||
+        arg.startswith("--fcompile-cache-"))
+      continue;
+    items.push_back(arg);
+  }
+  return items;
+}
+
+// Compile the Go package specified by the command line options
+// (already parsed) to an output file. All per-compilation state
+// (LLVM context, linemap, module, backend) is created here. The
+// 'args' vector holds the command line arguments themselves (used for
+// the compilation cache key).
+
+static int CompileGo(const char *progname, ArrayRef<const char *> args)
+{
+  Triple TheTriple;
+
+  if (InputFilenames.empty()) {
+    errs() << progname << ": no input files\n";
+    return 1;
+  }
 
   TheTriple = Triple(Triple::normalize(TargetTriple));
   if (TheTriple.getTriple().empty())
     TheTriple.setTriple(sys::getDefaultTargetTriple());
 
   // Get the target specific parser.
+  InitializeTargets(TheTriple);
   std::string Error;
   const Target *TheTarget = TargetRegistry::lookupTarget(MArch, TheTriple,
                                                          Error);
   if (!TheTarget) {
-    errs() << argv[0] << ": " << Error;
+    errs() << progname << ": " << Error;
     return 1;
   }
 
@@ -268,7 +1078,7 @@ int main(int argc, char **argv)
   CodeGenOpt::Level OLvl = CodeGenOpt::Default;
   switch (OptLevel) {
   default:
-    errs() << argv[0] << ": invalid optimization level.\n";
+    errs() << progname << ": invalid optimization level.\n";
     return 1;
   case ' ': break;
   case '0': OLvl = CodeGenOpt::None; break;
@@ -276,21 +1086,95 @@ int main(int argc, char **argv)
   case '2': OLvl = CodeGenOpt::Default; break;
   case '3': OLvl = CodeGenOpt::Aggressive; break;
   }
+  InitializePassRegistry(GetIROptLevel() > 0);
+
+  if (ParallelCodegen == 0) {
+    errs() << progname << ": invalid -fparallel-codegen value.\n";
+    return 1;
+  }
+  if (StreamCodegen && ParallelCodegen > 1) {
+    errs() << progname << ": -fstreaming-codegen can't be combined "
+           << "with -fparallel-codegen.\n";
+    return 1;
+  }
+  if (LTOMode != "" && LTOMode != "full" && LTOMode != "thin") {
+    errs() << progname << ": invalid -flto mode '" << LTOMode << "'.\n";
+    return 1;
+  }
+  if (EmitBitcode() && (StreamCodegen || ParallelCodegen > 1)) {
+    errs() << progname << ": -emit-llvm/-flto can't be combined "
+           << "with -fstreaming-codegen or -fparallel-codegen.\n";
+    return 1;
+  }
+  if (StreamCodegen && MinusGOption) {
+    errs() << progname << ": -fstreaming-codegen does not support "
+           << "debug info (-g).\n";
+    return 1;
+  }
+  if (StreamCodegen || ParallelCodegen > 1) {
+    if (FileType == TargetMachine::CGFT_AssemblyFile) {
+      errs() << progname << ": "
+             << (StreamCodegen ? "-fstreaming-codegen" : "-fparallel-codegen")
+             << " requires -filetype=obj.\n";
+      return 1;
+    }
+    std::string LD, Err;
+    if (FileType == TargetMachine::CGFT_ObjectFile &&
+        !FindPartitionLinker(TheTriple, LD, Err)) {
+      errs() << progname << ": " << Err << "\n";
+      return 1;
+    }
+  }
 
   TargetOptions Options = InitTargetOptionsFromCodeGenFlags();
-  Options.DisableIntegratedAS = true;
-  std::unique_ptr<TargetMachine> Target(
-      TheTarget->createTargetMachine(TheTriple.getTriple(), CPUStr, FeaturesStr,
-                                     Options, getRelocModel(), CMModel, OLvl));
+  auto TMFactory = [&]() {
+    return std::unique_ptr<TargetMachine>(
+        TheTarget->createTargetMachine(TheTriple.getTriple(), CPUStr,
+                                       FeaturesStr, Options, getRelocModel(),
+                                       CMModel, OLvl));
+  };
+  std::unique_ptr<TargetMachine> Target(TMFactory());
   assert(Target && "Could not allocate target machine!");
 
-  // Print a stack trace if we signal out.
+  // Compilation cache: on a hit, copy out the cached result and skip
+  // parsing and code generation entirely. On a miss, record the export
+  // data read for each import as the compilation proceeds, so as to be
+  // able to validate the cached result on subsequent lookups.
+  std::unique_ptr<CompileCache> cache;
+  if (UseCompileCache()) {
+    cache.reset(new CompileCache(CompileCacheDir,
+                                 uint64_t(CompileCacheMaxSize) << 20,
+                                 OutputSuffix()));
+    std::vector<std::string> inputs(InputFilenames.begin(),
+                                    InputFilenames.end());
+    if (!cache->computePrimaryKey(CompileCacheKeyItems(progname, args,
+                                                       TheTriple),
+                                  inputs)) {
+      cache.reset();
+    } else if (std::unique_ptr<MemoryBuffer> buf = cache->lookup()) {
+      std::unique_ptr<tool_output_file> Out = GetOutputStream();
+      if (!Out) return 1;
+      Out->os() << buf->getBuffer();
+      Out->keep();
+      if (CompileCacheStats || TraceLevel)
+        cache->report(errs());
+      return 0;
+    }
+  }
+  struct ObserverReset {
+    ~ObserverReset() { go_set_export_data_observer(nullptr); }
+  } observerReset;
+  if (cache) {
+    CompileCache *cc = cache.get();
+    go_set_export_data_observer([cc](int fd, off_t offset,
+                                     const char *data, size_t len) {
+        cc->recordImport(fd, offset, data, len);
+      });
+  }
+
   llvm::LLVMContext Context;
   bool hasError = false;
   Context.setDiagnosticHandler(DiagnosticHandler, &hasError);
-  sys::PrintStackTraceOnErrorSignal(argv[0]);
-  PrettyStackTraceProgram X(argc, argv);
-  llvm_shutdown_obj Y;  // Call llvm_shutdown() on exit.
 
   // Construct linemap and module
   std::unique_ptr<Llvm_linemap> linemap(new Llvm_linemap());
@@ -305,6 +1189,43 @@ int main(int argc, char **argv)
                                                   module.get(), linemap.get()));
   backend->setTraceLevel(TraceLevel);
 
+  // Value names are useful only if someone is going to look at the IR.
+  if (DiscardValueNames && !DumpIR && !TraceLevel)
+    backend->setDiscardValueNames(true);
+
+  backend->setSimplifyNodes(SimplifyNodes);
+
+  // Support -ftime-report. The report is printed on the way out of
+  // this function, before the backend (which owns some of the timers)
+  // is destroyed. Pass timers are not thread-safe, so per-pass timing
+  // is not collected with -fparallel-codegen.
+  PhaseTimers timers;
+  if (timers.enabled()) {
+    backend->enableTimers();
+    if (ParallelCodegen == 1)
+      TimePassesIsEnabled = true;
+  }
+  auto reportTimes = make_scope_exit([&]() { timers.report(); });
+
+  if (MemReport)
+    ReportMemoryUsage("init", backend.get(), linemap.get());
+
+  // Streaming code generation: compile function bodies as they are
+  // completed. Debug meta-data is not yet supported in this mode, since
+  // it is finalized only once the entire module is available (-g is
+  // rejected above; this just makes sure none is created).
+  std::unique_ptr<FunctionStreamer> streamer;
+  if (StreamCodegen) {
+    backend->disableDebugMetaDataGeneration();
+    unsigned batchSize = std::max(1u, StreamBatchSize.getValue());
+    streamer.reset(new FunctionStreamer(module.get(), Target.get(),
+                                        batchSize));
+    FunctionStreamer *fs = streamer.get();
+    backend->setFunctionCompletionHook([fs](llvm::Function *F) {
+        fs->functionCompleted(F);
+      });
+  }
+
   // Support -fgo-dump-ast
   if (DumpAst)
     go_enable_dump("ast");
@@ -313,11 +1234,8 @@ int main(int argc, char **argv)
   if (! IncludeDirs.empty()) {
     std::stringstream ss(IncludeDirs);
     std::string dir;
-    while(std::getline(ss, dir, ':')) {
-      struct stat st;
-      if (stat (dir.c_str(), &st) == 0 && S_ISDIR (st.st_mode))
-        go_add_search_path(dir.c_str());
-    }
+    while(std::getline(ss, dir, ':'))
+      AddSearchPath(dir);
   }
 
   // Library dirs
@@ -325,11 +1243,8 @@ int main(int argc, char **argv)
   if (! LibDirs.empty()) {
     std::stringstream ss(LibDirs);
     std::string dir;
-    while(std::getline(ss, dir, ':')) {
-      struct stat st;
-      if (stat (dir.c_str(), &st) == 0 && S_ISDIR (st.st_mode))
-        go_add_search_path(dir.c_str());
-    }
+    while(std::getline(ss, dir, ':'))
+      AddSearchPath(dir);
   }
 
 
@@ -348,13 +1263,41 @@ int main(int argc, char **argv)
   unsigned idx = 0;
   for (auto &fn : InputFilenames)
     fns[idx++] = fn.c_str();
-  go_parse_input_files(fns, nfiles, false, true);
-  if (! NoBackend)
+  if (PrintStartupTime) {
+    auto elapsed = std::chrono::steady_clock::now() - StartupTime;
+    std::cerr << "startup time: "
+              << std::chrono::duration_cast<std::chrono::microseconds>(
+                     elapsed).count()
+              << " us\n";
+  }
+  {
+    TimeRegion tr(timers.parse());
+    go_parse_input_files(fns, nfiles, false, true);
+  }
+  if (MemReport)
+    ReportMemoryUsage("parse", backend.get(), linemap.get());
+  if (! NoBackend) {
+    TimeRegion tr(timers.writeGlobals());
     go_write_globals();
-  if (! NoVerify && !go_be_saw_errors())
+  }
+  if (MemReport && ! NoBackend)
+    ReportMemoryUsage("write_globals", backend.get(), linemap.get());
+  // Compile the last batch of streamed functions, and promote the
+  // symbols they reference before anything else touches the module
+  // (the optimizer would otherwise be free to discard them).
+  if (streamer && !streamer->completeModule()) {
+    errs() << progname << ": streaming code generation failed: "
+           << streamer->error() << "\n";
+    return 1;
+  }
+  if (! NoVerify && !go_be_saw_errors()) {
+    TimeRegion tr(timers.verify());
     backend->verifyModule();
-  if (DumpIR)
+  }
+  if (DumpIR) {
+    TimeRegion tr(timers.dump());
     backend->dumpModule();
+  }
   if (TraceLevel)
     std::cerr << "linemap stats:" << linemap->statistics() << "\n";
 
@@ -373,32 +1316,574 @@ int main(int argc, char **argv)
   TargetLibraryInfoImpl TLII(TheTriple);
   PM.add(new TargetLibraryInfoWrapperPass(TLII));
 
+  // Add target-specific cost model info for use by the IR optimizers.
+  PM.add(createTargetTransformInfoWrapperPass(Target->getTargetIRAnalysis()));
+
   // Override function attributes based on CPUStr, FeaturesStr, and command line
   // flags.
   setFunctionAttributes(CPUStr, FeaturesStr, *M);
 
+  // Set up the IR optimization pipeline for the requested -O level. The
+  // function passes are run up front over each function in the module;
+  // the module passes are added to the same pass manager as the
+  // code generation passes (below).
+  unsigned IROptLevel = GetIROptLevel();
+  legacy::FunctionPassManager FPM(M);
+  FPM.add(createTargetTransformInfoWrapperPass(Target->getTargetIRAnalysis()));
+  AddOptimizationPasses(PM, FPM, Target.get(), TLII, IROptLevel);
+  {
+    TimeRegion tr(timers.optimize());
+    FPM.doInitialization();
+    for (Function &F : *M)
+      FPM.run(F);
+    FPM.doFinalization();
+  }
+
+  if (MemReport)
+    ReportMemoryUsage("optimize", backend.get(), linemap.get());
+
+  // Time the remainder of the compilation as code generation.
+  TimeRegion codegenRegion(timers.codegen());
+
   raw_pwrite_stream *OS = &Out->os();
 
-  // Ask the target to add backend passes as necessary.
-  if (Target->addPassesToEmitFile(PM, *OS, FileType)) {
-    errs() << argv[0] << ": target does not support generation of this"
-           << " file type!\n";
-    return 1;
-  }
+  if (ParallelCodegen > 1) {
+    // Run IR optimization passes on the whole module, then hand off
+    // to the partitioned code generator.
+    cl::PrintOptionValues();
+    PM.run(*M);
+    std::string Err;
+    if (!SplitCodegen(M, ParallelCodegen, TMFactory, *OS, Err)) {
+      errs() << progname << ": parallel code generation failed: "
+             << Err << "\n";
+      return 1;
+    }
+  } else if (streamer && streamer->numChunks() != 0) {
+    // Optimize what remains of the module, then compile it and combine
+    // the result with the previously compiled function chunks.
+    cl::PrintOptionValues();
+    PM.run(*M);
+    if (!streamer->finish(*OS)) {
+      errs() << progname << ": streaming code generation failed: "
+             << streamer->error() << "\n";
+      return 1;
+    }
+  } else if (EmitBitcode()) {
+    // Write the (optimized) IR as bitcode. For ThinLTO, the module
+    // summary is computed and written along with the IR. Export data
+    // is carried in the ".go_export" global, where go_read_export_data
+    // can find it when the package is imported.
+    if (EmitThinLTO())
+      PM.add(createWriteThinLTOBitcodePass(*OS));
+    else
+      PM.add(createBitcodeWriterPass(*OS));
+    cl::PrintOptionValues();
+    PM.run(*M);
+  } else {
+    // Ask the target to add backend passes as necessary.
+    if (Target->addPassesToEmitFile(PM, *OS, FileType)) {
+      errs() << progname << ": target does not support generation of this"
+             << " file type!\n";
+      return 1;
+    }
 
-  // Before executing passes, print the final values of the LLVM options.
-  cl::PrintOptionValues();
+    // Before executing passes, print the final values of the LLVM options.
+    cl::PrintOptionValues();
 
-  // Run pass manager
-  PM.run(*M);
+    // Run pass manager (IR optimization followed by code generation)
+    PM.run(*M);
+  }
 
   // Check for errors
   auto HasError = *static_cast<bool *>(Context.getDiagnosticContext());
   if (HasError)
     return 1;
 
+  if (MemReport)
+    ReportMemoryUsage("codegen", backend.get(), linemap.get());
+
   // Declare success.
   Out->keep();
 
+  if (cache) {
+    go_set_export_data_observer(nullptr);
+    Out->os().close();
+    cache->store(OutputFileName);
+    if (CompileCacheStats || TraceLevel)
+      cache->report(errs());
+  }
+
   return 0;
 }
+
+// Support for --server mode. The server listens on a Unix domain
+// socket; each connection carries a single compile job, sent as a
+// sequence of NUL-terminated strings (the client's working directory,
+// followed by the command line arguments for the job), after which
+// the client shuts down its side of the connection. The reply
+// consists of the job's exit status (as a decimal number on a line by
+// itself) followed by any diagnostic output produced by the job. A
+// job whose sole argument is "--server-shutdown" causes the server to
+// exit.
+//
+// The front end keeps global state (the gogo object, type caches that
+// refer to the backend's types, the import search path) that can't be
+// reset, so each job is compiled in a child process forked from the
+// server; see ForkJob. The server process itself has targets and
+// passes initialized, and collects the export data read by the jobs
+// from imported packages, which subsequent jobs then inherit.
+
+// Compile a single job (for server or batch mode) with the specified
+// command line arguments. Options are reset to their defaults prior to
+// parsing the arguments for the job. Invoked in a child process.
+
+static int CompileJob(const char *progname,
+                      const std::vector<std::string> &jobArgs)
+{
+  std::vector<const char *> args;
+  args.push_back(progname);
+  for (auto &arg : jobArgs)
+    args.push_back(arg.c_str());
+
+  cl::ResetAllOptionOccurrences();
+  go_be_reset_errors();
+  if (!cl::ParseCommandLineOptions(args.size(), args.data(),
+                                   "llvm go parser driver\n", &errs()))
+    return 1;
+  if (! ServerSocket.empty() || ! BatchManifest.empty()) {
+    errs() << progname << ": -server/-batch not permitted for compile job\n";
+    return 1;
+  }
+  return CompileGo(progname, args);
+}
+
+static bool ReadAll(int fd, std::string &buf)
+{
+  char chunk[4096];
+  for (;;) {
+    ssize_t n = ::read(fd, chunk, sizeof(chunk));
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0)
+      return false;
+    if (n == 0)
+      return true;
+    buf.append(chunk, n);
+  }
+}
+
+static void WriteAll(int fd, const std::string &data)
+{
+  size_t pos = 0;
+  while (pos < data.size()) {
+    ssize_t n = ::write(fd, data.data() + pos, data.size() - pos);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return;
+    pos += n;
+  }
+}
+
+// Run a compile job in a child process, returning its exit status.
+// The child sends back the export data it read (see
+// go_export_data_cache_take_updates) before exiting, which is merged
+// into this process's cache.
+
+static int ForkJob(const char *progname,
+                   const std::vector<std::string> &jobArgs)
+{
+  int fds[2];
+  if (::pipe(fds) != 0) {
+    errs() << progname << ": pipe: " << strerror(errno) << "\n";
+    return 1;
+  }
+  std::cerr.flush();
+  outs().flush();
+  errs().flush();
+  pid_t pid = ::fork();
+  if (pid < 0) {
+    errs() << progname << ": fork: " << strerror(errno) << "\n";
+    ::close(fds[0]);
+    ::close(fds[1]);
+    return 1;
+  }
+  if (pid == 0) {
+    ::close(fds[0]);
+    int rc = CompileJob(progname, jobArgs);
+    std::string updates;
+    go_export_data_cache_take_updates(updates);
+    WriteAll(fds[1], updates);
+    ::close(fds[1]);
+    std::cerr.flush();
+    outs().flush();
+    errs().flush();
+    ::_exit(rc);
+  }
+
+  ::close(fds[1]);
+  std::string updates;
+  bool readOk = ReadAll(fds[0], updates);
+  ::close(fds[0]);
+  int status;
+  while (::waitpid(pid, &status, 0) < 0) {
+    if (errno != EINTR) {
+      errs() << progname << ": waitpid: " << strerror(errno) << "\n";
+      return 1;
+    }
+  }
+  if (!WIFEXITED(status)) {
+    errs() << progname << ": compile job terminated by signal "
+           << (WIFSIGNALED(status) ? WTERMSIG(status) : 0) << "\n";
+    return 1;
+  }
+  if (readOk && !go_export_data_cache_merge_updates(updates))
+    errs() << progname << ": ignoring malformed export data from job\n";
+  return WEXITSTATUS(status);
+}
+
+// Initialize targets and passes up front in server and batch mode, so
+// that forked jobs don't each have to do so.
+
+static void PrepareForJobs()
+{
+  InitializeTargets(Triple(sys::getProcessTriple()));
+  InitializePassRegistry(true);
+}
+
+static bool ReadJob(int fd, std::vector<std::string> &strs)
+{
+  std::string buf;
+  if (!ReadAll(fd, buf))
+    return false;
+  size_t pos = 0;
+  while (pos < buf.size()) {
+    size_t end = buf.find('\0', pos);
+    if (end == std::string::npos)
+      return false;
+    strs.push_back(buf.substr(pos, end - pos));
+    pos = end + 1;
+  }
+  return !strs.empty();
+}
+
+static int RunJob(const char *progname,
+                  const std::vector<std::string> &strs,
+                  std::string &output)
+{
+  if (::chdir(strs[0].c_str()) != 0) {
+    output = std::string(progname) + ": unable to chdir to " + strs[0] + "\n";
+    return 1;
+  }
+
+  // Capture diagnostic output for the job in a temporary file.
+  int errFD;
+  SmallString<128> errPath;
+  if (sys::fs::createTemporaryFile("llvm-goparse-job", "err",
+                                   errFD, errPath)) {
+    output = std::string(progname) + ": unable to create temp file\n";
+    return 1;
+  }
+  std::cerr.flush();
+  errs().flush();
+  int savedFD = ::dup(2);
+  ::dup2(errFD, 2);
+
+  std::vector<std::string> jobArgs(strs.begin() + 1, strs.end());
+  int rc = ForkJob(progname, jobArgs);
+
+  std::cerr.flush();
+  errs().flush();
+  ::dup2(savedFD, 2);
+  ::close(savedFD);
+  ::close(errFD);
+
+  ErrorOr<std::unique_ptr<MemoryBuffer>> BufOrErr =
+      MemoryBuffer::getFile(errPath);
+  if (BufOrErr)
+    output = (*BufOrErr)->getBuffer().str();
+  sys::fs::remove(errPath);
+  return rc;
+}
+
+static int RunServer(const char *progname)
+{
+  // Options are reset for each job, so make a copy of the socket path.
+  std::string path(ServerSocket);
+  unsigned traceLevel = TraceLevel;
+
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (path.size() >= sizeof(addr.sun_path)) {
+    errs() << progname << ": server socket path too long\n";
+    return 1;
+  }
+  strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+
+  int lfd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+  if (lfd < 0) {
+    errs() << progname << ": socket: " << strerror(errno) << "\n";
+    return 1;
+  }
+  ::unlink(path.c_str());
+  if (::bind(lfd, reinterpret_cast<struct sockaddr *>(&addr),
+             sizeof(addr)) != 0 || ::listen(lfd, 16) != 0) {
+    errs() << progname << ": unable to listen on " << path << ": "
+           << strerror(errno) << "\n";
+    ::close(lfd);
+    return 1;
+  }
+
+  // Clients may go away before reading their replies.
+  ::signal(SIGPIPE, SIG_IGN);
+
+  // Export data for imported packages is immutable over the course
+  // of a build, so it can be cached across jobs.
+  go_enable_export_data_cache(true);
+  PrepareForJobs();
+
+  SmallString<256> startDir;
+  sys::fs::current_path(startDir);
+  unsigned njobs = 0;
+  bool done = false;
+  while (!done) {
+    int cfd = ::accept(lfd, nullptr, nullptr);
+    if (cfd < 0 && errno == EINTR)
+      continue;
+    if (cfd < 0)
+      break;
+
+    std::vector<std::string> strs;
+    std::string output;
+    int rc = 1;
+    if (!ReadJob(cfd, strs)) {
+      output = std::string(progname) + ": malformed compile job\n";
+    } else if (strs.size() == 2 && strs[1] == "--server-shutdown") {
+      rc = 0;
+      done = true;
+    } else {
+      rc = RunJob(progname, strs, output);
+      njobs += 1;
+      ::chdir(startDir.c_str());
+    }
+    WriteAll(cfd, std::to_string(rc) + "\n" + output);
+    ::close(cfd);
+  }
+  ::close(lfd);
+  ::unlink(path.c_str());
+
+  if (traceLevel) {
+    unsigned hits, misses;
+    go_export_data_cache_stats(&hits, &misses);
+    std::cerr << "server stats: jobs=" << njobs
+              << " export data cache hits=" << hits
+              << " misses=" << misses << "\n";
+  }
+  return 0;
+}
+
+// Support for -batch mode, in which a series of packages is compiled
+// within a single process. Each non-blank line of the manifest file
+// (other than comments starting with '#') describes one job:
+//
+//    <package path> <output file> <dependencies> <args...>
+//
+// where <dependencies> is a comma-separated list of the package paths
+// of other jobs that have to be compiled first (or "-" if none), and
+// <args...> holds the source files and any additional options for the
+// job. Fields are separated by white space. Options given on the
+// llvm-goparse command line (other than -batch itself) apply to each
+// job. As with server mode, each job is compiled in a child process
+// (see ForkJob), whereas export data read from imported packages is
+// cached across jobs.
+
+namespace {
+struct BatchJob {
+  std::string pkgpath;
+  std::string output;
+  std::vector<std::string> deps;
+  std::vector<std::string> args;
+};
+}
+
+static bool ReadBatchManifest(const char *progname,
+                              const std::string &path,
+                              std::vector<BatchJob> &jobs)
+{
+  ErrorOr<std::unique_ptr<MemoryBuffer>> BufOrErr =
+      MemoryBuffer::getFile(path);
+  if (!BufOrErr) {
+    errs() << progname << ": unable to read batch manifest " << path
+           << ": " << BufOrErr.getError().message() << "\n";
+    return false;
+  }
+  StringRef rest = (*BufOrErr)->getBuffer();
+  unsigned lineno = 0;
+  while (!rest.empty()) {
+    StringRef line;
+    std::tie(line, rest) = rest.split('\n');
+    lineno += 1;
+    line = line.trim();
+    if (line.empty() || line.startswith("#"))
+      continue;
+    SmallVector<StringRef, 16> fields;
+    SplitString(line, fields);
+    if (fields.size() < 4) {
+      errs() << path << ":" << lineno << ": malformed batch job\n";
+      return false;
+    }
+    BatchJob job;
+    job.pkgpath = fields[0];
+    job.output = fields[1];
+    if (fields[2] != "-") {
+      SmallVector<StringRef, 8> deps;
+      fields[2].split(deps, ',', -1, false);
+      for (auto &d : deps)
+        job.deps.push_back(d);
+    }
+    for (unsigned i = 3; i < fields.size(); ++i)
+      job.args.push_back(fields[i]);
+    jobs.push_back(job);
+  }
+  return true;
+}
+
+// Order the batch jobs such that each job follows the jobs for its
+// dependencies. Dependencies on packages not in the manifest are
+// assumed to be satisfied already. Returns false if there is a cycle.
+
+static bool OrderBatchJobs(const char *progname,
+                           const std::vector<BatchJob> &jobs,
+                           std::vector<unsigned> &order)
+{
+  std::map<std::string, unsigned> jobIndex;
+  for (unsigned idx = 0; idx < jobs.size(); ++idx)
+    jobIndex[jobs[idx].pkgpath] = idx;
+
+  // 0: not visited, 1: in progress, 2: done
+  std::vector<unsigned> state(jobs.size(), 0);
+  std::function<bool(unsigned)> visit = [&](unsigned idx) {
+    if (state[idx] == 2)
+      return true;
+    if (state[idx] == 1) {
+      errs() << progname << ": dependency cycle in batch manifest "
+             << "involving package " << jobs[idx].pkgpath << "\n";
+      return false;
+    }
+    state[idx] = 1;
+    for (auto &dep : jobs[idx].deps) {
+      auto it = jobIndex.find(dep);
+      if (it != jobIndex.end() && !visit(it->second))
+        return false;
+    }
+    state[idx] = 2;
+    order.push_back(idx);
+    return true;
+  };
+  for (unsigned idx = 0; idx < jobs.size(); ++idx)
+    if (!visit(idx))
+      return false;
+  return true;
+}
+
+static int RunBatch(const char *progname, int argc, char **argv)
+{
+  // The output file, package path and inputs come from the manifest,
+  // one set per job; they can't also be given on the command line.
+  if (!InputFilenames.empty() || OutputFileName.getNumOccurrences() ||
+      PackagePath.getNumOccurrences()) {
+    errs() << progname << ": -batch can't be combined with -o, "
+           << "-fgo-pkgpath or input files (these are specified per "
+           << "package in the manifest).\n";
+    return 1;
+  }
+
+  // Options are reset for each job, so make copies of those needed.
+  std::string manifest(BatchManifest);
+  unsigned traceLevel = TraceLevel;
+
+  // Collect the options common to all jobs.
+  std::vector<std::string> common;
+  for (int i = 1; i < argc; ++i) {
+    StringRef arg(argv[i]);
+    if (arg == "-batch" || arg == "--batch") {
+      ++i;
+      continue;
+    }
+    if (arg.startswith("-batch=") || arg.startswith("--batch="))
+      continue;
+    common.push_back(arg);
+  }
+
+  std::vector<BatchJob> jobs;
+  std::vector<unsigned> order;
+  if (!ReadBatchManifest(progname, manifest, jobs) ||
+      !OrderBatchJobs(progname, jobs, order))
+    return 1;
+
+  go_enable_export_data_cache(true);
+  PrepareForJobs();
+
+  std::set<std::string> failed;
+  for (unsigned idx : order) {
+    const BatchJob &job = jobs[idx];
+    bool depFailed = false;
+    for (auto &dep : job.deps)
+      if (failed.count(dep))
+        depFailed = true;
+    if (depFailed) {
+      errs() << progname << ": skipping " << job.pkgpath
+             << " (dependency failed)\n";
+      failed.insert(job.pkgpath);
+      continue;
+    }
+
+    std::vector<std::string> args(common);
+    args.push_back("-fgo-pkgpath=" + job.pkgpath);
+    args.push_back("-o");
+    args.push_back(job.output);
+    args.insert(args.end(), job.args.begin(), job.args.end());
+    if (traceLevel)
+      std::cerr << "batch job: " << job.pkgpath << "\n";
+    if (ForkJob(progname, args) != 0)
+      failed.insert(job.pkgpath);
+  }
+
+  if (traceLevel) {
+    unsigned hits, misses;
+    go_export_data_cache_stats(&hits, &misses);
+    std::cerr << "batch stats: jobs=" << jobs.size()
+              << " failed=" << failed.size()
+              << " export data cache hits=" << hits
+              << " misses=" << misses << "\n";
+  }
+  return failed.empty() ? 0 : 1;
+}
+
+int main(int argc, char **argv)
+{
+  StartupTime = std::chrono::steady_clock::now();
+
+  // Print a stack trace if we signal out.
+  sys::PrintStackTraceOnErrorSignal(argv[0]);
+  PrettyStackTraceProgram X(argc, argv);
+  llvm_shutdown_obj Y;  // Call llvm_shutdown() on exit.
+
+  // Targets proper (and passes) are initialized lazily, once we know
+  // which ones are needed; see InitializeTargets.
+  InitializeAllTargetInfos();
+
+  cl::ParseCommandLineOptions(argc, argv, "llvm go parser driver\n");
+
+  // Server mode: compile jobs arrive via a socket.
+  if (! ServerSocket.empty())
+    return RunServer(argv[0]);
+
+  // Batch mode: compile jobs are listed in a manifest file.
+  if (! BatchManifest.empty())
+    return RunBatch(argv[0], argc, argv);
+
+  return CompileGo(argv[0], ArrayRef<const char *>(
+      const_cast<const char **>(argv), argc));
+}
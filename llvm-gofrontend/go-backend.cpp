@@ -14,10 +14,19 @@
 #include "llvm-includes.h"
 #include <ctype.h>
 #include <iostream>
+#include <map>
+#include <tuple>
+#include <vector>
 
 #include "go-llvm-diagnostics.h"
+#include "go-llvm-backend.h"
 #include "go-c.h"
 
+#include "llvm/Bitcode/BitcodeReader.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/FileSystem.h"
 #include "llvm/Support/MemoryBuffer.h"
 #include "llvm/Object/Archive.h"
 #include "llvm/Object/Binary.h"
@@ -36,6 +45,13 @@
 #define GO_EXPORT_SECTION_NAME ".go_export"
 #endif
 
+/* The section name used for export data on Mach-O (within segment
+   GO_EXPORT_SEGMENT_NAME).  */
+
+#ifndef GO_EXPORT_MACHO_SECTION_NAME
+#define GO_EXPORT_MACHO_SECTION_NAME "__go_export"
+#endif
+
 /* Return whether or not we've reported any errors.  */
 
 bool
@@ -70,7 +86,8 @@ readExportDataFromObject(llvm::object::ObjectFile *obj,
     std::error_code error = sref.getName(sname);
     if (error)
       break;
-    if (sname == GO_EXPORT_SECTION_NAME) {
+    if (sname == GO_EXPORT_SECTION_NAME ||
+        (obj->isMachO() && sname == GO_EXPORT_MACHO_SECTION_NAME)) {
       // Extract section of interest
       llvm::StringRef bytes;
       if (sref.getContents(bytes)) {
@@ -91,6 +108,54 @@ readExportDataFromObject(llvm::object::ObjectFile *obj,
   return nullptr;
 }
 
+// Export data in a bitcode file (produced by "llvm-goparse -emit-llvm"
+// or -flto) is held in the initializer of a global variable assigned
+// to the export data section. Function bodies are loaded lazily, so
+// they are never materialized here.
+
+static bool isBitcode(llvm::MemoryBufferRef mb)
+{
+  const unsigned char *start =
+      reinterpret_cast<const unsigned char *>(mb.getBufferStart());
+  const unsigned char *end =
+      reinterpret_cast<const unsigned char *>(mb.getBufferEnd());
+  return llvm::isBitcode(start, end);
+}
+
+static const char *
+readExportDataFromBitcode(llvm::MemoryBufferRef mb,
+                          int *perr,
+                          char **pbuf,
+                          size_t *plen)
+{
+  llvm::LLVMContext context;
+  llvm::Expected<std::unique_ptr<llvm::Module>> modOrErr =
+      llvm::getLazyBitcodeModule(mb, context);
+  if (!modOrErr) {
+    llvm::consumeError(modOrErr.takeError());
+    *perr = 0;
+    return "unable to read bitcode file";
+  }
+  for (llvm::GlobalVariable &gv : (*modOrErr)->globals()) {
+    llvm::StringRef section = gv.getSection();
+    if ((section != GO_EXPORT_SECTION_NAME &&
+         section != GO_EXPORT_SEGMENT_NAME "," GO_EXPORT_MACHO_SECTION_NAME) ||
+        !gv.hasInitializer())
+      continue;
+    llvm::ConstantDataSequential *cds =
+        llvm::dyn_cast<llvm::ConstantDataSequential>(gv.getInitializer());
+    if (!cds)
+      continue;
+    llvm::StringRef bytes = cds->getRawDataValues();
+    char *buf = new char[bytes.size()];
+    memcpy(buf, bytes.data(), bytes.size());
+    *pbuf = buf;
+    *plen = bytes.size();
+    return nullptr;
+  }
+  return nullptr;
+}
+
 static const char *
 readExportDataFromArchive(llvm::object::Archive *archive,
                           off_t offset,
@@ -113,6 +178,12 @@ readExportDataFromArchive(llvm::object::Archive *archive,
     if (child.getChildOffset() != uoffset)
       continue;
     // found.
+    llvm::Expected<llvm::MemoryBufferRef> mbOrErr =
+        child.getMemoryBufferRef();
+    if (mbOrErr && isBitcode(*mbOrErr))
+      return readExportDataFromBitcode(*mbOrErr, perr, pbuf, plen);
+    if (!mbOrErr)
+      llvm::consumeError(mbOrErr.takeError());
     llvm::Expected<std::unique_ptr<llvm::object::Binary>> childOrErr =
         child.getAsBinary();
     if (!childOrErr)
@@ -129,30 +200,146 @@ readExportDataFromArchive(llvm::object::Archive *archive,
     return nullptr;
 }
 
-/* The go_read_export_data function is called by the Go frontend
-   proper to read Go export data from an object file.  FD is a file
-   descriptor open for reading.  OFFSET is the offset within the file
-   where the object file starts; this will be 0 except when reading an
-   archive.  On success this returns NULL and sets *PBUF to a buffer
-   allocated using malloc, of size *PLEN, holding the export data.  If
-   the data is not found, this returns NULL and sets *PBUF to NULL and
-   *PLEN to 0.  If some error occurs, this returns an error message
-   and sets *PERR to an errno value or 0 if there is no relevant
-   errno.  */
+// Cache of export data read by go_read_export_data, keyed by file
+// identity and offset within the file. File size and modification
+// time are recorded in each entry so as to detect files that have
+// been rewritten since they were cached.
 
-const char *
-go_read_export_data (int fd, off_t offset, char **pbuf, size_t *plen,
-                     int *perr)
+namespace {
+struct CachedExportData {
+  uint64_t size;
+  llvm::sys::TimePoint<> mtime;
+  std::string data;
+};
+}
+
+typedef std::tuple<uint64_t, uint64_t, off_t> ExportDataKey;
+static std::map<ExportDataKey, CachedExportData> exportDataCache;
+static bool exportDataCacheEnabled = false;
+static unsigned exportDataCacheHits = 0;
+static unsigned exportDataCacheMisses = 0;
+
+// Entries added (and hits/misses counted) since the last call to
+// go_export_data_cache_take_updates.
+static std::vector<ExportDataKey> exportDataCacheAdded;
+static unsigned exportDataCacheHitsTaken = 0;
+static unsigned exportDataCacheMissesTaken = 0;
+
+void go_enable_export_data_cache(bool enable)
 {
-  *pbuf = NULL;
-  *plen = 0;
+  exportDataCacheEnabled = enable;
+  if (!enable) {
+    exportDataCache.clear();
+    exportDataCacheAdded.clear();
+  }
+}
+
+void go_export_data_cache_stats(unsigned *hits, unsigned *misses)
+{
+  *hits = exportDataCacheHits;
+  *misses = exportDataCacheMisses;
+}
 
+// Helpers for serializing cache updates. Updates are only exchanged
+// between processes running the same executable (see the header), so
+// values are written in native byte order.
+
+template<typename T>
+static void putUpdateField(std::string &out, T val)
+{
+  out.append(reinterpret_cast<const char *>(&val), sizeof(T));
+}
+
+template<typename T>
+static bool getUpdateField(llvm::StringRef &in, T &val)
+{
+  if (in.size() < sizeof(T))
+    return false;
+  memcpy(&val, in.data(), sizeof(T));
+  in = in.drop_front(sizeof(T));
+  return true;
+}
+
+void go_export_data_cache_take_updates(std::string &out)
+{
+  putUpdateField<uint32_t>(out, exportDataCacheHits - exportDataCacheHitsTaken);
+  putUpdateField<uint32_t>(out,
+                           exportDataCacheMisses - exportDataCacheMissesTaken);
+  exportDataCacheHitsTaken = exportDataCacheHits;
+  exportDataCacheMissesTaken = exportDataCacheMisses;
+  for (auto &key : exportDataCacheAdded) {
+    auto it = exportDataCache.find(key);
+    if (it == exportDataCache.end())
+      continue;
+    const CachedExportData &entry = it->second;
+    putUpdateField<uint64_t>(out, std::get<0>(key));
+    putUpdateField<uint64_t>(out, std::get<1>(key));
+    putUpdateField<int64_t>(out, std::get<2>(key));
+    putUpdateField<uint64_t>(out, entry.size);
+    putUpdateField<int64_t>(out, entry.mtime.time_since_epoch().count());
+    putUpdateField<uint64_t>(out, entry.data.size());
+    out.append(entry.data);
+  }
+  exportDataCacheAdded.clear();
+}
+
+bool go_export_data_cache_merge_updates(llvm::StringRef in)
+{
+  uint32_t hits, misses;
+  if (!getUpdateField(in, hits) || !getUpdateField(in, misses))
+    return false;
+  exportDataCacheHits += hits;
+  exportDataCacheMisses += misses;
+  exportDataCacheHitsTaken += hits;
+  exportDataCacheMissesTaken += misses;
+  while (!in.empty()) {
+    uint64_t dev, file, size, len;
+    int64_t offset, mtime;
+    if (!getUpdateField(in, dev) || !getUpdateField(in, file) ||
+        !getUpdateField(in, offset) || !getUpdateField(in, size) ||
+        !getUpdateField(in, mtime) || !getUpdateField(in, len) ||
+        in.size() < len)
+      return false;
+    if (!exportDataCacheEnabled) {
+      in = in.drop_front(len);
+      continue;
+    }
+    ExportDataKey key = std::make_tuple(dev, file, off_t(offset));
+    CachedExportData &entry = exportDataCache[key];
+    entry.size = size;
+    entry.mtime = llvm::sys::TimePoint<>(
+        llvm::sys::TimePoint<>::duration(mtime));
+    entry.data = in.take_front(len).str();
+    in = in.drop_front(len);
+  }
+  return true;
+}
+
+// Invoked for each successful read of export data, if set.
+static ExportDataObserver exportDataObserver;
+
+void go_set_export_data_observer(ExportDataObserver observer)
+{
+  exportDataObserver = observer;
+}
+
+// Helper for go_read_export_data (below) that does the actual reading.
+
+static const char *
+readExportData(int fd, off_t offset, char **pbuf, size_t *plen, int *perr)
+{
   // Create memory buffer for this file descriptor
   auto BuffOrErr = llvm::MemoryBuffer::getOpenFile(fd, "", -1);
   if (! BuffOrErr)
     return nullptr; // ignore this error
   std::unique_ptr<llvm::MemoryBuffer> Buffer = std::move(BuffOrErr.get());
 
+  // Bitcode files (see above) are handled separately, since
+  // createBinary requires an LLVMContext to open them.
+  if (isBitcode(Buffer->getMemBufferRef()))
+    return readExportDataFromBitcode(Buffer->getMemBufferRef(),
+                                     perr, pbuf, plen);
+
   // Examine buffer as binary
   llvm::Expected<std::unique_ptr<llvm::object::Binary>> BinOrErr =
       llvm::object::createBinary(Buffer->getMemBufferRef());
@@ -174,6 +361,75 @@ go_read_export_data (int fd, off_t offset, char **pbuf, size_t *plen,
   return nullptr;
 }
 
+// Helper for go_read_export_data; consults the export data cache if
+// it is enabled.
+
+static const char *
+readExportDataCached(int fd, off_t offset, char **pbuf, size_t *plen,
+                     int *perr)
+{
+  if (! exportDataCacheEnabled)
+    return readExportData(fd, offset, pbuf, plen, perr);
+
+  llvm::sys::fs::file_status st;
+  if (llvm::sys::fs::status(fd, st))
+    return readExportData(fd, offset, pbuf, plen, perr);
+  llvm::sys::fs::UniqueID uid = st.getUniqueID();
+  ExportDataKey key = std::make_tuple(uid.getDevice(), uid.getFile(), offset);
+
+  // Consult cache
+  auto it = exportDataCache.find(key);
+  if (it != exportDataCache.end() &&
+      it->second.size == st.getSize() &&
+      it->second.mtime == st.getLastModificationTime()) {
+    exportDataCacheHits += 1;
+    const std::string &data = it->second.data;
+    if (! data.empty()) {
+      char *buf = new char[data.size()];
+      memcpy(buf, data.data(), data.size());
+      *pbuf = buf;
+      *plen = data.size();
+    }
+    return nullptr;
+  }
+  exportDataCacheMisses += 1;
+
+  // Read and install in cache (errors are not cached)
+  const char *rval = readExportData(fd, offset, pbuf, plen, perr);
+  if (rval)
+    return rval;
+  CachedExportData &entry = exportDataCache[key];
+  exportDataCacheAdded.push_back(key);
+  entry.size = st.getSize();
+  entry.mtime = st.getLastModificationTime();
+  entry.data.assign(*pbuf ? *pbuf : "", *plen);
+  return nullptr;
+}
+
+/* The go_read_export_data function is called by the Go frontend
+   proper to read Go export data from an object file.  FD is a file
+   descriptor open for reading.  OFFSET is the offset within the file
+   where the object file starts; this will be 0 except when reading an
+   archive.  On success this returns NULL and sets *PBUF to a buffer
+   allocated using malloc, of size *PLEN, holding the export data.  If
+   the data is not found, this returns NULL and sets *PBUF to NULL and
+   *PLEN to 0.  If some error occurs, this returns an error message
+   and sets *PERR to an errno value or 0 if there is no relevant
+   errno.  */
+
+const char *
+go_read_export_data (int fd, off_t offset, char **pbuf, size_t *plen,
+                     int *perr)
+{
+  *pbuf = NULL;
+  *plen = 0;
+
+  const char *rval = readExportDataCached(fd, offset, pbuf, plen, perr);
+  if (! rval && *pbuf && exportDataObserver)
+    exportDataObserver(fd, offset, *pbuf, *plen);
+  return rval;
+}
+
 const char *lbasename(const char *path)
 {
   // TODO: add windows support
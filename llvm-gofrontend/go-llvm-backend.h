@@ -22,4 +22,30 @@ class Backend;
 
 extern Backend *go_get_backend(llvm::LLVMContext &Context);
 
+// Enable or disable caching of the export data read by
+// go_read_export_data. This is intended for long-running processes
+// (e.g. llvm-goparse server mode) that compile many packages, where
+// the same imported packages are read over and over again.
+extern void go_enable_export_data_cache(bool enable);
+
+// Return hit/miss counts for the export data cache.
+extern void go_export_data_cache_stats(unsigned *hits, unsigned *misses);
+
+// Support for sharing the export data cache with child processes
+// (e.g. llvm-goparse server/batch mode, where each job is compiled in
+// a forked child). The child serializes the entries it added (along
+// with its hit/miss counts) into 'out'; the parent merges them into its
+// own cache, so that subsequent children inherit them. Returns false
+// if the updates are malformed.
+extern void go_export_data_cache_take_updates(std::string &out);
+extern bool go_export_data_cache_merge_updates(llvm::StringRef in);
+
+// Install a callback to be invoked each time export data is
+// successfully read by go_read_export_data (for example, to record
+// the set of packages imported by a compilation). Pass an empty
+// function to remove the callback.
+typedef std::function<void(int fd, off_t offset,
+                           const char *data, size_t len)> ExportDataObserver;
+extern void go_set_export_data_observer(ExportDataObserver observer);
+
 #endif // !defined(GO_LLVM_BACKEND_H)
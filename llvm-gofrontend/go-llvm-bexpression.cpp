@@ -32,11 +32,13 @@ bool Binstructions::isValidInst(llvm::Instruction *inst)
   return true;
 }
 
-Bexpression::Bexpression(NodeFlavor fl, const std::vector<Bnode *> &kids,
+Bexpression::Bexpression(NodeFlavor fl, llvm::MutableArrayRef<Bnode *> kids,
                          llvm::Value *val, Btype *typ, Location loc)
     : Bnode(fl, kids, loc)
     , value_(val)
     , btype_(typ)
+    , owner_(nullptr)
+    , tag_(nullptr)
 {
 }
 
@@ -45,6 +47,8 @@ Bexpression::Bexpression(const Bexpression &src)
     , Binstructions()
     , value_(src.value_)
     , btype_(src.btype_)
+    , owner_(nullptr)
+    , tag_(nullptr)
 {
 }
 
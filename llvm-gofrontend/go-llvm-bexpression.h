@@ -22,8 +22,12 @@
 
 #include "backend.h"
 
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/ADT/TinyPtrVector.h"
+#include "llvm/IR/Instruction.h"
+
 namespace llvm {
-class Instruction;
 class Value;
 class raw_ostream;
 }
@@ -31,22 +35,23 @@ class raw_ostream;
 class Bstatement;
 class BnodeBuilder;
 
-// Mixin class for a list of instructions
+// Mixin class for a list of instructions. Most expressions have
+// at most a single instruction, which TinyPtrVector stores inline.
 
 class Binstructions {
 public:
   Binstructions() {}
-  explicit Binstructions(const std::vector<llvm::Instruction *> &instructions)
+  explicit Binstructions(llvm::ArrayRef<llvm::Instruction *> instructions)
       : instructions_(instructions) {}
 
-  const std::vector<llvm::Instruction *> &instructions() const {
+  llvm::ArrayRef<llvm::Instruction *> instructions() const {
     return instructions_;
   }
   void appendInstruction(llvm::Instruction *inst) {
     assert(isValidInst(inst));
     instructions_.push_back(inst);
   }
-  void appendInstructions(const std::vector<llvm::Instruction *> &ilist) {
+  void appendInstructions(llvm::ArrayRef<llvm::Instruction *> ilist) {
     for (auto inst : ilist) {
       assert(isValidInst(inst));
       instructions_.push_back(inst);
@@ -56,7 +61,7 @@ public:
   void clear() { instructions_.clear(); }
 
 private:
-  std::vector<llvm::Instruction *> instructions_;
+  llvm::TinyPtrVector<llvm::Instruction *> instructions_;
 
   // Certain classes of instructions should not be hanging off a
   // Bexpression -- they should only appear in a function prolog.
@@ -168,8 +173,13 @@ class Bexpression : public Bnode, public Binstructions {
 
   llvm::Value *value() const { return value_; }
   Btype *btype() const { return btype_; }
-  const std::string &tag() const { return tag_; }
-  void setTag(const std::string &tag) { tag_ = tag; }
+  // Function whose arena holds this expression, or null if it lives
+  // in the module arena (see BnodeBuilder).
+  Bfunction *owner() const { return owner_; }
+  // Tags are set via BnodeBuilder::setTag (which interns them).
+  llvm::StringRef tag() const {
+    return tag_ ? llvm::StringRef(tag_) : llvm::StringRef();
+  }
 
   bool varExprPending() const;
   const VarContext &varContext() const;
@@ -195,14 +205,15 @@ class Bexpression : public Bnode, public Binstructions {
   friend class BnodeBuilder;
 
  private:
-  Bexpression(NodeFlavor fl, const std::vector<Bnode *> &kids,
+  Bexpression(NodeFlavor fl, llvm::MutableArrayRef<Bnode *> kids,
               llvm::Value *val, Btype *typ, Location loc);
   Bexpression(const Bexpression &src);
   void setValue(llvm::Value *val);
 
   llvm::Value *value_;
   Btype *btype_;
-  std::string tag_;
+  Bfunction *owner_;
+  const char *tag_;
   VarContext varContext_;
 };
 
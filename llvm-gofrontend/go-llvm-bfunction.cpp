@@ -35,7 +35,7 @@ Bfunction::Bfunction(llvm::Function *f,
                      TypeManager *tm)
 
     : fcnType_(fcnType), function_(f),
-      abiOracle_(new CABIOracle(fcnType, tm)),
+      abiOracle_(tm->abiOracle(fcnType, &ownedAbiOracle_)),
       rtnValueMem_(nullptr), chainVal_(nullptr),
       paramsRegistered_(0), name_(name), asmName_(asmName),
       location_(location), splitStack_(YesSplit),
@@ -23,6 +23,8 @@
 #include "namegen.h"
 #include "backend.h"
 
+#include "llvm/ADT/DenseMap.h"
+
 namespace llvm {
 class Argument;
 class BasicBlock;
@@ -143,8 +145,11 @@ public:
   // LLVM function for this Bfunction
   llvm::Function *function_;
 
-  // C ABI oracle for the function
-  std::unique_ptr<CABIOracle> abiOracle_;
+  // C ABI oracle for the function (owned by the type manager, unless
+  // the function type could not be memoized, in which case it is held
+  // in ownedAbiOracle_).
+  std::unique_ptr<CABIOracle> ownedAbiOracle_;
+  CABIOracle *abiOracle_;
 
   // This includes all alloca's created for the function, including
   // local variables, temp vars, and spill locations for formal params.
@@ -158,7 +163,7 @@ public:
 
   // Maps LLVM value for a variable (for example, an alloc) to the
   // Bvariable used to represent the var.
-  std::unordered_map<llvm::Value *, Bvariable *> valueVarMap_;
+  llvm::DenseMap<llvm::Value *, Bvariable *> valueVarMap_;
 
   // In the case where return value goes via memory,
   // rtnValueMem_ stores where we should store the value, otherwise
@@ -16,6 +16,7 @@
 #include "go-llvm-bvariable.h"
 #include "go-llvm-bexpression.h"
 #include "go-llvm-bstatement.h"
+#include "go-llvm-memstats.h"
 #include "go-llvm-tree-integrity.h"
 #include "go-system.h"
 
@@ -66,8 +67,11 @@ static BnodePropVals BnodeProperties[] = {
   /* N_SwitchStmt */  {  "switch", Variadic, IsStmt }
 };
 
-Bnode::Bnode(NodeFlavor flavor, const std::vector<Bnode *> &kids, Location loc)
-    : kids_(kids)
+Bnode::Bnode(NodeFlavor flavor, llvm::MutableArrayRef<Bnode *> kids,
+             Location loc)
+    : kids_(kids.data())
+    , numKids_(kids.size())
+    , kidCapacity_(kids.size())
     , location_(loc)
     , flavor_(flavor)
     , id_(0xfeedface)
@@ -79,7 +83,10 @@ Bnode::Bnode(NodeFlavor flavor, const std::vector<Bnode *> &kids, Location loc)
 }
 
 Bnode::Bnode(const Bnode &src)
-    : location_(src.location_)
+    : kids_(nullptr)
+    , numKids_(0)
+    , kidCapacity_(0)
+    , location_(src.location_)
     , flavor_(src.flavor_)
     , id_(0xfeedface)
     , flags_(0)
@@ -108,7 +115,7 @@ Bblock *Bnode::castToBblock() const {
 
 void Bnode::replaceChild(unsigned idx, Bnode *newchild)
 {
-  assert(idx < kids_.size());
+  assert(idx < numKids_);
   kids_[idx] = newchild;
 }
 
@@ -255,7 +262,7 @@ void Bnode::osdump(llvm::raw_ostream &os, unsigned ilevel,
     expr->dumpInstructions(os, ilevel, linemap, terse);
 
   // Now children
-  for (auto &kid : kids_)
+  for (auto &kid : children())
     kid->osdump(os, ilevel + 2, linemap, terse);
 }
 
@@ -270,10 +277,11 @@ void Bnode::destroy(Bnode *node, WhichDel which)
         delete inst;
     }
   }
-  for (auto &kid : node->kids_)
+  for (auto &kid : node->children())
     destroy(kid, which);
+  // Storage for the node itself is owned by the BnodeBuilder arenas.
   if (which != DelInstructions)
-    delete node;
+    node->~Bnode();
 }
 
 SwitchDescriptor *Bnode::getSwitchCases()
@@ -286,7 +294,7 @@ SwitchDescriptor *Bnode::getSwitchCases()
 // only for unit testing, not for general use.
 void Bnode::removeAllChildren()
 {
-  kids_.clear();
+  numKids_ = 0;
 }
 
 LabelId Bnode::label() const
@@ -298,7 +306,8 @@ LabelId Bnode::label() const
 //......................................................................
 
 BnodeBuilder::BnodeBuilder(Llvm_backend *be)
-    : integrityVisitor_(new IntegrityVisitor(be, TreeIntegCtl(DumpPointers, IgnoreVarExprs, DontRepairSharing)))
+    : curFcn_(nullptr)
+    , integrityVisitor_(new IntegrityVisitor(be, TreeIntegCtl(DumpPointers, IgnoreVarExprs, RepairSharing)))
 {
 }
 
@@ -307,51 +316,253 @@ BnodeBuilder::~BnodeBuilder()
   freeStmts();
   for (auto &expr : earchive_) {
     if (expr)
-      delete expr;
+      expr->~Bexpression();
   }
 }
 
+llvm::MutableArrayRef<Bnode *>
+BnodeBuilder::copyKids(llvm::BumpPtrAllocator &alloc,
+                       llvm::ArrayRef<Bnode *> kids)
+{
+  if (kids.empty())
+    return llvm::MutableArrayRef<Bnode *>();
+  Bnode **storage = alloc.Allocate<Bnode *>(kids.size());
+  std::copy(kids.begin(), kids.end(), storage);
+  return llvm::MutableArrayRef<Bnode *>(storage, kids.size());
+}
+
+Bfunction *BnodeBuilder::exprOwner(NodeFlavor fl,
+                                   llvm::Value *val,
+                                   llvm::ArrayRef<Bnode *> kids) const
+{
+  if (!curFcn_)
+    return nullptr;
+  // Var exprs are excluded even for globals (whose value is a
+  // constant), since their context is resolved per use.
+  if (fl == N_Var || !val || !llvm::isa<llvm::Constant>(val))
+    return curFcn_;
+  for (Bnode *kid : kids) {
+    Bexpression *ekid = kid->castToBexpression();
+    if (!ekid || ekid->owner())
+      return curFcn_;
+  }
+  return nullptr;
+}
+
+void *BnodeBuilder::allocExpr(Bfunction *owner)
+{
+  if (owner)
+    return fcnArena(owner).alloc.Allocate<Bexpression>();
+  if (!exprFreeList_.empty()) {
+    void *storage = exprFreeList_.back();
+    exprFreeList_.pop_back();
+    return storage;
+  }
+  return exprArena_.Allocate<Bexpression>();
+}
+
+Bexpression *BnodeBuilder::newExpr(NodeFlavor fl,
+                                   const std::vector<Bnode *> &kids,
+                                   llvm::Value *val,
+                                   Btype *typ,
+                                   Location loc)
+{
+  Bfunction *owner = exprOwner(fl, val, kids);
+  llvm::MutableArrayRef<Bnode *> k =
+      copyKids(owner ? fcnArena(owner).alloc : exprArena_, kids);
+  Bexpression *rval =
+      new (allocExpr(owner)) Bexpression(fl, k, val, typ, loc);
+  rval->owner_ = owner;
+  return rval;
+}
+
+Bexpression *BnodeBuilder::newExpr(const Bexpression &src,
+                                   const std::vector<Bnode *> &kids)
+{
+  Bfunction *owner = exprOwner(src.flavor(), src.value(), kids);
+  llvm::MutableArrayRef<Bnode *> k =
+      copyKids(owner ? fcnArena(owner).alloc : exprArena_, kids);
+  Bexpression *rval = new (allocExpr(owner)) Bexpression(src);
+  rval->kids_ = k.data();
+  rval->numKids_ = rval->kidCapacity_ = k.size();
+  rval->owner_ = owner;
+  return rval;
+}
+
+Bstatement *BnodeBuilder::newStmt(NodeFlavor fl,
+                                  Bfunction *func,
+                                  const std::vector<Bnode *> &kids,
+                                  Location loc)
+{
+  llvm::BumpPtrAllocator &alloc = fcnArena(func).alloc;
+  llvm::MutableArrayRef<Bnode *> k = copyKids(alloc, kids);
+  return new (alloc.Allocate<Bstatement>()) Bstatement(fl, func, k, loc);
+}
+
+Bblock *BnodeBuilder::newBlock(Bfunction *func,
+                               const std::vector<Bvariable *> &vars,
+                               Location loc)
+{
+  return new (fcnArena(func).alloc.Allocate<Bblock>())
+      Bblock(func, vars, loc);
+}
+
+BnodeBuilder::FcnArena &BnodeBuilder::fcnArena(Bfunction *func)
+{
+  std::unique_ptr<FcnArena> &arena = fcnArenas_[func];
+  if (!arena)
+    arena.reset(new FcnArena);
+  return *arena;
+}
+
 void BnodeBuilder::freeStmts()
 {
-  for (auto &stmt : sarchive_) {
-    if (stmt)
-      delete stmt;
+  while (!fcnArenas_.empty())
+    freeStmts(fcnArenas_.begin()->first);
+}
+
+void BnodeBuilder::freeStmts(Bfunction *func)
+{
+  auto ait = fcnArenas_.find(func);
+  if (ait == fcnArenas_.end())
+    return;
+  FcnArena &arena = *ait->second;
+
+  // Collect the function's expressions that are still live (an id may
+  // appear more than once if it was reused after a freeExpr).
+  std::vector<Bexpression *> exprs;
+  for (unsigned id : arena.eids) {
+    if (id >= earchive_.size())
+      continue;
+    Bexpression *expr = earchive_[id];
+    if (!expr || expr->owner() != func)
+      continue;
+    earchive_[id] = nullptr;
+    exprs.push_back(expr);
+  }
+  while (!earchive_.empty() && !earchive_.back())
+    earchive_.pop_back();
+
+  // Remove parent info for the nodes being deleted.
+  for (auto &stmt : arena.sarchive)
+    integrityVisitor_->forgetParent(stmt);
+  for (auto &expr : exprs)
+    integrityVisitor_->forgetParent(expr);
+
+  // Run destructors, then release the arena storage wholesale.
+  for (auto &stmt : arena.sarchive)
+    stmt->~Bstatement();
+  for (auto &expr : exprs)
+    expr->~Bexpression();
+  for (auto &c : arena.swcases)
+    c->~SwitchDescriptor();
+  fcnArenas_.erase(ait);
+}
+
+std::string BnodeBuilder::statistics() const
+{
+  unsigned liveExprs = 0;
+  for (auto &expr : earchive_)
+    if (expr)
+      liveExprs += 1;
+  unsigned stmts = 0, swcases = 0;
+  size_t arenaBytes = exprArena_.getTotalMemory();
+  size_t archiveBytes = vectorBytes(earchive_) + hashTableBytes(fcnArenas_);
+  for (auto &p : fcnArenas_) {
+    stmts += p.second->sarchive.size();
+    swcases += p.second->swcases.size();
+    arenaBytes += p.second->alloc.getTotalMemory();
+    archiveBytes += sizeof(FcnArena) + vectorBytes(p.second->sarchive) +
+        vectorBytes(p.second->swcases) + vectorBytes(p.second->eids);
   }
-  sarchive_.clear();
-  for (auto &c : swcases_)
-    delete c;
-  swcases_.clear();
+  size_t tagBytes = tags_.getNumBuckets() * sizeof(void *) +
+      tags_.getAllocator().getTotalMemory();
+  size_t parentBytes = integrityVisitor_->parentBytes();
+  std::stringstream ss;
+  ss << "exprs=" << liveExprs
+     << " exprslots=" << earchive_.size()
+     << " stmts=" << stmts
+     << " swcases=" << swcases
+     << " fcnarenas=" << fcnArenas_.size()
+     << " arenabytes=" << arenaBytes
+     << " archivebytes=" << archiveBytes
+     << " tags=" << tags_.size()
+     << " tagbytes=" << tagBytes
+     << " nparent=" << integrityVisitor_->parentEntries()
+     << " nparentbytes=" << parentBytes
+     << " bytes=" << (arenaBytes + archiveBytes + tagBytes + parentBytes);
+  return ss.str();
 }
 
 void BnodeBuilder::freeExpr(Bexpression *expr)
 {
   assert(expr);
+  integrityVisitor_->forgetParent(expr);
   earchive_[expr->id()] = nullptr;
   if (expr->id() == earchive_.size()-1)
     earchive_.pop_back();
-  delete expr;
+  Bfunction *owner = expr->owner();
+  expr->~Bexpression();
+  if (!owner)
+    exprFreeList_.push_back(expr);
+}
+
+void BnodeBuilder::noteChildReplacement(Bnode *parent,
+                                        Bnode *oldkid,
+                                        Bnode *newkid)
+{
+  for (unsigned idx = 0; idx < parent->numKids_; ++idx) {
+    if (parent->kids_[idx] == oldkid) {
+      integrityVisitor_->reparent(oldkid, newkid, parent, idx);
+      return;
+    }
+  }
+  assert(false && "replaced node is not a child of parent");
 }
 
 void BnodeBuilder::checkTreeInteg(Bnode *node)
 {
-  for (unsigned idx = 0; idx < node->kids_.size(); ++idx) {
+  for (unsigned idx = 0; idx < node->numKids_; ++idx) {
     Bnode *kid = node->kids_[idx];
     integrityVisitor_->setParent(kid, node, idx);
   }
 }
 
+bool BnodeBuilder::sharingPending() const
+{
+  return integrityVisitor_->sharingPending();
+}
+
+bool BnodeBuilder::stmtSharingPending() const
+{
+  return integrityVisitor_->stmtSharingPending();
+}
+
+bool BnodeBuilder::resolveSharing(std::string &msg,
+                                  std::vector<Bnode *> &roots)
+{
+  bool rval = integrityVisitor_->resolveSharing(roots);
+  if (!rval)
+    msg = integrityVisitor_->msg();
+  integrityVisitor_->clearMsg();
+  return rval;
+}
+
 Bexpression *BnodeBuilder::archive(Bexpression *expr)
 {
   expr->id_ = earchive_.size();
   earchive_.push_back(expr);
+  if (expr->owner())
+    fcnArena(expr->owner()).eids.push_back(expr->id_);
   checkTreeInteg(expr);
   return expr;
 }
 
 Bstatement *BnodeBuilder::archive(Bstatement *stmt)
 {
-  stmt->id_ = sarchive_.size();
-  sarchive_.push_back(stmt);
+  std::vector<Bstatement *> &sarchive = fcnArena(stmt->function()).sarchive;
+  stmt->id_ = sarchive.size();
+  sarchive.push_back(stmt);
   checkTreeInteg(stmt);
   return stmt;
 }
@@ -367,7 +578,7 @@ Bexpression *BnodeBuilder::mkError(Btype *errortype)
   std::vector<Bnode *> kids;
   Location loc;
   llvm::Value *noval = nullptr;
-  return archive(new Bexpression(N_Error, kids, noval, errortype, loc));
+  return archive(newExpr(N_Error, kids, noval, errortype, loc));
 }
 
 Bexpression *BnodeBuilder::mkConst(Btype *btype, llvm::Value *value)
@@ -376,7 +587,7 @@ Bexpression *BnodeBuilder::mkConst(Btype *btype, llvm::Value *value)
   assert(value);
   std::vector<Bnode *> kids;
   Location loc;
-  return archive(new Bexpression(N_Const, kids, value, btype, loc));
+  return archive(newExpr(N_Const, kids, value, btype, loc));
 }
 
 Bexpression *BnodeBuilder::mkVoidValue(Btype *btype)
@@ -384,7 +595,7 @@ Bexpression *BnodeBuilder::mkVoidValue(Btype *btype)
   assert(btype);
   std::vector<Bnode *> kids;
   Location loc;
-  return archive(new Bexpression(N_Const, kids, nullptr, btype, loc));
+  return archive(newExpr(N_Const, kids, nullptr, btype, loc));
 }
 
 Bexpression *BnodeBuilder::mkVar(Bvariable *var, Location loc)
@@ -393,7 +604,7 @@ Bexpression *BnodeBuilder::mkVar(Bvariable *var, Location loc)
   Btype *vt = var->btype();
   std::vector<Bnode *> kids;
   Bexpression *rval =
-      new Bexpression(N_Var, kids, var->value(), vt, loc);
+      newExpr(N_Var, kids, var->value(), vt, loc);
   rval->u.var = var;
   return archive(rval);
 }
@@ -413,7 +624,7 @@ void BnodeBuilder::appendInstIfNeeded(Bexpression *rval,
   if (!llvm::isa<llvm::Instruction>(val))
     return;
   llvm::Instruction *inst = llvm::cast<llvm::Instruction>(val);
-  for (auto &kid : rval->kids_) {
+  for (auto &kid : rval->children()) {
     Bexpression *expr = kid->castToBexpression();
     if (expr && expr->value() == inst)
       return;
@@ -429,7 +640,7 @@ Bexpression *BnodeBuilder::mkBinaryOp(Operator op, Btype *typ, llvm::Value *val,
   assert(right);
   std::vector<Bnode *> kids = { left, right };
   Bexpression *rval =
-      new Bexpression(N_BinaryOp, kids, val, typ, loc);
+      newExpr(N_BinaryOp, kids, val, typ, loc);
   if (val)
     appendInstIfNeeded(rval, val);
   rval->u.op = op;
@@ -444,7 +655,7 @@ Bexpression *BnodeBuilder::mkBinaryOp(Operator op, Btype *typ, llvm::Value *val,
   assert(right);
   std::vector<Bnode *> kids = { left, right };
   Bexpression *rval =
-      new Bexpression(N_BinaryOp, kids, val, typ, loc);
+      newExpr(N_BinaryOp, kids, val, typ, loc);
   for (auto &inst : instructions.instructions())
     rval->appendInstruction(inst);
   rval->u.op = op;
@@ -457,7 +668,7 @@ Bexpression *BnodeBuilder::mkUnaryOp(Operator op, Btype *typ, llvm::Value *val,
   assert(src);
   std::vector<Bnode *> kids = { src };
   Bexpression *rval =
-      new Bexpression(N_UnaryOp, kids, val, typ, loc);
+      newExpr(N_UnaryOp, kids, val, typ, loc);
   rval->u.op = op;
   appendInstIfNeeded(rval, val);
   if (src->varExprPending())
@@ -470,7 +681,7 @@ Bexpression *BnodeBuilder::mkConversion(Btype *typ, llvm::Value *val,
 {
   std::vector<Bnode *> kids = { src };
   Bexpression *rval =
-      new Bexpression(N_Conversion, kids, val, typ, loc);
+      newExpr(N_Conversion, kids, val, typ, loc);
   appendInstIfNeeded(rval, val);
   if (src->varExprPending())
     rval->setVarExprPending(src->varContext());
@@ -481,7 +692,7 @@ Bexpression *BnodeBuilder::mkAddress(Btype *typ, llvm::Value *val,
                                      Bexpression *src, Location loc)
 {
   std::vector<Bnode *> kids = { src };
-  Bexpression *rval = new Bexpression(N_Address, kids, val, typ, loc);
+  Bexpression *rval = newExpr(N_Address, kids, val, typ, loc);
   return archive(rval);
 }
 
@@ -489,7 +700,7 @@ Bexpression *BnodeBuilder::mkFcnAddress(Btype *typ, llvm::Value *val,
                                         Bfunction *func, Location loc)
 {
   std::vector<Bnode *> kids;
-  Bexpression *rval = new Bexpression(N_FcnAddress, kids, val, typ, loc);
+  Bexpression *rval = newExpr(N_FcnAddress, kids, val, typ, loc);
   rval->u.func = func;
   return archive(rval);
 }
@@ -498,7 +709,7 @@ Bexpression *BnodeBuilder::mkDeref(Btype *typ, llvm::Value *val,
                                    Bexpression *src, Location loc)
 {
   std::vector<Bnode *> kids = { src };
-  Bexpression *rval = new Bexpression(N_Deref, kids, val, typ, loc);
+  Bexpression *rval = newExpr(N_Deref, kids, val, typ, loc);
   return archive(rval);
 }
 
@@ -516,7 +727,7 @@ Bexpression *BnodeBuilder::mkComposite(Btype *btype,
   // case where we've delayed creation of a composite value
   // so as to see whether it might feed into a variable init.
   Bexpression *rval =
-      new Bexpression(N_Composite, kids, value, btype, loc);
+      newExpr(N_Composite, kids, value, btype, loc);
   for (auto &inst : instructions.instructions())
     rval->appendInstruction(inst);
   return archive(rval);
@@ -530,7 +741,7 @@ Bexpression *BnodeBuilder::mkStructField(Btype *typ,
 {
   std::vector<Bnode *> kids = { structval };
   Bexpression *rval =
-      new Bexpression(N_StructField, kids, val, typ, loc);
+      newExpr(N_StructField, kids, val, typ, loc);
   appendInstIfNeeded(rval, val);
   rval->u.fieldIndex = fieldIndex;
   if (structval->varExprPending())
@@ -546,7 +757,7 @@ Bexpression *BnodeBuilder::mkArrayIndex(Btype *typ,
 {
   std::vector<Bnode *> kids = { arval, index };
   Bexpression *rval =
-      new Bexpression(N_ArrayIndex, kids, val, typ, loc);
+      newExpr(N_ArrayIndex, kids, val, typ, loc);
   appendInstIfNeeded(rval, val);
   if (arval->varExprPending())
     rval->setVarExprPending(arval->varContext());
@@ -559,10 +770,10 @@ Bexpression *BnodeBuilder::mkCompound(Bstatement *st,
 {
   std::vector<Bnode *> kids = { st, expr };
   Bexpression *rval =
-      new Bexpression(N_Compound, kids, expr->value(), expr->btype(), loc);
+      newExpr(N_Compound, kids, expr->value(), expr->btype(), loc);
   if (expr->varExprPending())
     rval->setVarExprPending(expr->varContext());
-  rval->setTag(expr->tag());
+  rval->tag_ = expr->tag_;
   return archive(rval);
 }
 
@@ -577,7 +788,7 @@ Bexpression *BnodeBuilder::mkCall(Btype *btype,
     kids.push_back(a);
   assert(val);
   Bexpression *rval =
-      new Bexpression(N_Call, kids, val, btype, loc);
+      newExpr(N_Call, kids, val, btype, loc);
   bool found = false;
   for (auto &inst : instructions.instructions()) {
     if (inst == val)
@@ -594,8 +805,9 @@ Bexpression *BnodeBuilder::mkCall(Btype *btype,
 Bstatement *BnodeBuilder::mkErrorStmt()
 {
   assert(! errorStatement_.get());
-  std::vector<Bnode *> kids;
-  errorStatement_.reset(new Bstatement(N_Error, nullptr, kids, Location()));
+  errorStatement_.reset(new Bstatement(N_Error, nullptr,
+                                       llvm::MutableArrayRef<Bnode *>(),
+                                       Location()));
   return errorStatement_.get();
 }
 
@@ -604,7 +816,7 @@ Bstatement *BnodeBuilder::mkExprStmt(Bfunction *func,
                                      Location loc)
 {
   std::vector<Bnode *> kids = { expr };
-  Bstatement *rval = new Bstatement(N_ExprStmt, func, kids, loc);
+  Bstatement *rval = newStmt(N_ExprStmt, func, kids, loc);
   return archive(rval);
 }
 
@@ -613,7 +825,7 @@ Bstatement *BnodeBuilder::mkReturn(Bfunction *func,
                                    Location loc)
 {
   std::vector<Bnode *> kids = { returnVal };
-  Bstatement *rval = new Bstatement(N_ReturnStmt, func, kids, loc);
+  Bstatement *rval = newStmt(N_ReturnStmt, func, kids, loc);
   return archive(rval);
 }
 
@@ -622,7 +834,7 @@ Bstatement *BnodeBuilder::mkLabelDefStmt(Bfunction *func,
                                          Location loc)
 {
   std::vector<Bnode *> kids;
-  Bstatement *rval = new Bstatement(N_LabelStmt, func, kids, loc);
+  Bstatement *rval = newStmt(N_LabelStmt, func, kids, loc);
   rval->u.label = label->label();
   return archive(rval);
 }
@@ -632,7 +844,7 @@ Bstatement *BnodeBuilder::mkGotoStmt(Bfunction *func,
                                      Location loc)
 {
   std::vector<Bnode *> kids;
-  Bstatement *rval = new Bstatement(N_GotoStmt, func, kids, loc);
+  Bstatement *rval = newStmt(N_GotoStmt, func, kids, loc);
   rval->u.label = label->label();
   return archive(rval);
 }
@@ -642,9 +854,9 @@ Bstatement *BnodeBuilder::mkIfStmt(Bfunction *func,
                                    Bblock *falseBlock, Location loc)
 {
   if (falseBlock == nullptr)
-    falseBlock = new Bblock(func, std::vector<Bvariable *>(), loc);
+    falseBlock = newBlock(func, std::vector<Bvariable *>(), loc);
   std::vector<Bnode *> kids = { cond, trueBlock, falseBlock };
-  Bstatement *rval = new Bstatement(N_IfStmt, func, kids, loc);
+  Bstatement *rval = newStmt(N_IfStmt, func, kids, loc);
   return archive(rval);
 }
 
@@ -657,7 +869,7 @@ Bstatement *BnodeBuilder::mkDeferStmt(Bfunction *func,
   assert(undefer);
   assert(defer);
   std::vector<Bnode *> kids = { undefer, defer };
-  Bstatement *rval = new Bstatement(N_DeferStmt, func, kids, loc);
+  Bstatement *rval = newStmt(N_DeferStmt, func, kids, loc);
   return archive(rval);
 }
 
@@ -671,7 +883,7 @@ Bstatement *BnodeBuilder::mkExcepStmt(Bfunction *func,
   assert(onexception);
   assert(finally);
   std::vector<Bnode *> kids = { body, onexception, finally };
-  Bstatement *rval = new Bstatement(N_ExcepStmt, func, kids, loc);
+  Bstatement *rval = newStmt(N_ExcepStmt, func, kids, loc);
   return archive(rval);
 }
 
@@ -701,9 +913,11 @@ Bstatement *BnodeBuilder::mkSwitchStmt(Bfunction *func,
       kids.push_back(v);
   for (auto &st : stmts)
     kids.push_back(st);
-  SwitchDescriptor *d = new SwitchDescriptor(vals);
-  swcases_.push_back(d);
-  Bstatement *rval = new Bstatement(N_SwitchStmt, func, kids, loc);
+  FcnArena &arena = fcnArena(func);
+  SwitchDescriptor *d =
+      new (arena.alloc.Allocate<SwitchDescriptor>()) SwitchDescriptor(vals);
+  arena.swcases.push_back(d);
+  Bstatement *rval = newStmt(N_SwitchStmt, func, kids, loc);
   rval->u.swcases = d;
   return archive(rval);
 
@@ -715,7 +929,7 @@ Bblock *BnodeBuilder::mkBlock(Bfunction *func,
                               const std::vector<Bvariable *> &vars,
                               Location loc)
 {
-  Bblock *rval = new Bblock(func, vars, loc);
+  Bblock *rval = newBlock(func, vars, loc);
   return archive(rval);
 }
 
@@ -723,7 +937,15 @@ void BnodeBuilder::addStatementToBlock(Bblock *block, Bstatement *st)
 {
   assert(block);
   assert(st);
-  block->kids_.push_back(st);
+  if (block->numKids_ == block->kidCapacity_) {
+    unsigned ncap = std::max(4u, block->kidCapacity_ * 2);
+    Bnode **kids = fcnArena(block->function()).alloc.Allocate<Bnode *>(ncap);
+    std::copy(block->kids_, block->kids_ + block->numKids_, kids);
+    block->kids_ = kids;
+    block->kidCapacity_ = ncap;
+  }
+  block->kids_[block->numKids_++] = st;
+  integrityVisitor_->setParent(st, block, block->numKids_ - 1);
 }
 
 Bexpression *
@@ -739,9 +961,8 @@ BnodeBuilder::cloneSub(Bexpression *expr,
     Bexpression *clc = cloneSubtree(ce);
     newChildren.push_back(clc);
   }
-  Bexpression *res = new Bexpression(*expr);
+  Bexpression *res = newExpr(*expr, newChildren);
   archive(res);
-  res->kids_ = newChildren;
 
   llvm::Value *iv = expr->value();
   llvm::Value *newv = nullptr;
@@ -773,6 +994,17 @@ Bexpression *BnodeBuilder::cloneSubtree(Bexpression *expr) {
   return cloneSub(expr, vm);
 }
 
+void BnodeBuilder::setTag(Bexpression *expr, llvm::StringRef tag)
+{
+  assert(expr);
+  if (tag.empty()) {
+    expr->tag_ = nullptr;
+    return;
+  }
+  // Keys in a StringSet are stored with a trailing null.
+  expr->tag_ = tags_.insert(tag).first->getKeyData();
+}
+
 std::vector<Bexpression *>
 BnodeBuilder::extractChildenAndDestroy(Bexpression *expr)
 {
@@ -780,7 +1012,7 @@ BnodeBuilder::extractChildenAndDestroy(Bexpression *expr)
   assert(expr);
   assert(expr->value() == nullptr);
   assert(expr->instructions().empty());
-  for (unsigned idx = 0; idx < expr->kids_.size(); ++idx) {
+  for (unsigned idx = 0; idx < expr->numKids_; ++idx) {
     Bnode *kid = expr->kids_[idx];
     integrityVisitor_->unsetParent(kid, expr, idx);
     Bexpression *ekid = kid->castToBexpression();
@@ -21,6 +21,13 @@
 
 #include "backend.h"
 
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringSet.h"
+#include "llvm/Support/Allocator.h"
+
+#include <unordered_map>
+
 namespace llvm {
 class Instruction;
 class Value;
@@ -97,7 +104,9 @@ enum VisitWhich {
 // gofrontend, but it acts as an abstract base for the Bexpression and
 // Bstatement classes. A given Bnode has zero or more Bnode children;
 // the number and type (expr or stmt) children are determined by
-// the Bnode flavor.
+// the Bnode flavor. The array of child pointers is not owned by the
+// node itself; it is carved out of the same arena as the node (see
+// BnodeBuilder), and is sized exactly for fixed-arity flavors.
 
 class Bnode {
  public:
@@ -139,10 +148,12 @@ class Bnode {
   friend class IntegrityVisitor;
 
   // TODO: hide this once GenBlocksVisitor is working
-  const std::vector<Bnode *> &children() const { return kids_; }
+  llvm::ArrayRef<Bnode *> children() const {
+    return llvm::makeArrayRef(kids_, numKids_);
+  }
 
  protected:
-  Bnode(NodeFlavor flavor, const std::vector<Bnode *> &kids, Location loc);
+  Bnode(NodeFlavor flavor, llvm::MutableArrayRef<Bnode *> kids, Location loc);
   Bnode(const Bnode &src);
   SwitchDescriptor *getSwitchCases();
 
@@ -156,7 +167,9 @@ class Bnode {
   }
 
  private:
-  std::vector<Bnode *> kids_;
+  Bnode **kids_;
+  unsigned numKids_;
+  unsigned kidCapacity_;
   union {
     Bvariable *var;
     Bfunction *func; // filled in only for fcn constants
@@ -172,15 +185,25 @@ class Bnode {
 };
 
 // This helper class handles construction for all Bnode objects.
-// Notes on storage allocation: ideally once an LLVM function has been
-// constructed and sent off to the back end for a given Go function,
-// we would want to delete all of the Bexpression's used by that
-// function before moving on to the next function. Putting this into
-// practice is tricky, however, since some Bexpressions (for example,
-// var exprs and function addresses) wind up being held over and
-// reused else where (for example, in emitted GC descriptors). For the
-// moment we don't try to free Bexpressions at intermediate points
-// in the compilation, but we do free Bstatements.
+// Notes on storage allocation: Bnodes are carved out of bump-pointer
+// arenas rather than allocated individually with 'new'. Each
+// Bstatement (along with any switch descriptor it uses) is placed in
+// an arena belonging to the statement's function; once the body for
+// that function has been set, the entire arena is released in one
+// shot. Bexpressions created while a function is being generated (see
+// setCurrentFunction) are placed in the same arena, and record that
+// function as their owner. The exception is module-scope constants
+// (constant-valued expressions built only from other module-scope
+// expressions, such as those registered via makeGlobalExpression),
+// which can be held over and reused elsewhere (for example, in
+// emitted GC descriptors); these, along with expressions created
+// outside of any function, live in a module-lifetime arena, in which
+// storage released by freeExpr is recycled for new expressions. Child
+// pointer arrays are allocated in the same arena as their parent
+// node; block statements (which acquire children one at a time) grow
+// their arrays geometrically, abandoning the previous array to the
+// arena. Expression tags are interned by the builder, so that each
+// distinct tag string is stored once.
 
 class BnodeBuilder {
  public:
@@ -190,6 +213,35 @@ class BnodeBuilder {
   // Deletes all allocated Bstatements (also switch descriptors)
   void freeStmts();
 
+  // Deletes the Bstatements, switch descriptors and Bexpressions
+  // created for the specified function, and releases the arena holding
+  // them.
+  void freeStmts(Bfunction *func);
+
+  // Set the function whose body is currently being generated (null if
+  // none); new expressions are allocated in its arena (see above).
+  void setCurrentFunction(Bfunction *func) { curFcn_ = func; }
+
+  // Returns a string summarizing the number of live nodes (for
+  // memory usage reporting).
+  std::string statistics() const;
+
+  // Tree integrity checking is incremental: parent links are recorded
+  // as nodes are created and as statements are added to blocks. This
+  // returns true if sharing has been detected since the last call to
+  // resolveSharing() below.
+  bool sharingPending() const;
+
+  // Returns true if statement sharing (never repairable) has been
+  // detected since the last call to resolveSharing().
+  bool stmtSharingPending() const;
+
+  // Repair (by cloning) any expression sharing detected since the
+  // last call. Returns false if unrepairable sharing was found, in
+  // which case 'msg' describes it, and 'roots' receives the roots of
+  // the trees holding the original parent of each offending node.
+  bool resolveSharing(std::string &msg, std::vector<Bnode *> &roots);
+
   // expressions
   Bexpression *mkError(Btype *errortype);
   Bexpression *mkConst(Btype *btype, llvm::Value *val);
@@ -260,11 +312,21 @@ class BnodeBuilder {
   void addStatementToBlock(Bblock *block, Bstatement *st);
 
   // Free up this expr (it is garbage). Does not free up children.
+  // Storage for module-scope expressions is recycled; that for other
+  // expressions is released along with the owning function's arena.
   void freeExpr(Bexpression *expr);
 
   // Clone an expression subtree.
   Bexpression *cloneSubtree(Bexpression *expr);
 
+  // Set the tag for an expression (interned, see above).
+  void setTag(Bexpression *expr, llvm::StringRef tag);
+
+  // Inform the builder that child 'oldkid' of 'parent' is about to be
+  // replaced by 'newkid' (by a node walker; see go-llvm-simplify.h),
+  // so that parent links used for integrity checking can be updated.
+  void noteChildReplacement(Bnode *parent, Bnode *oldkid, Bnode *newkid);
+
   // Inform the builder that we're about to extract all of the
   // children of the specified node and incorporate them into a new
   // node (after which the old node will be thrown away). Returns
@@ -279,14 +341,59 @@ class BnodeBuilder {
                         std::map<llvm::Value *, llvm::Value *> &vm);
   void checkTreeInteg(Bnode *node);
 
+  // Storage for the statements (and expressions) of a given function.
+  // Expressions are recorded by id, since they may be freed (and the
+  // id reused) before the arena is released.
+  struct FcnArena {
+    llvm::BumpPtrAllocator alloc;
+    std::vector<Bstatement *> sarchive;
+    std::vector<SwitchDescriptor *> swcases;
+    std::vector<unsigned> eids;
+  };
+  FcnArena &fcnArena(Bfunction *func);
+
+  // Returns the function that should own a new expression with the
+  // specified flavor, value and children, or null for module scope.
+  Bfunction *exprOwner(NodeFlavor fl, llvm::Value *val,
+                       llvm::ArrayRef<Bnode *> kids) const;
+
+  // Placement-construct a new expression in the arena of its owner (see
+  // exprOwner), or a new statement (or block) in the arena for
+  // function 'func'. Child arrays are copied into the same arena. The
+  // second form copies 'src' but with children 'kids'.
+  Bexpression *newExpr(NodeFlavor fl, const std::vector<Bnode *> &kids,
+                       llvm::Value *val, Btype *typ, Location loc);
+  Bexpression *newExpr(const Bexpression &src,
+                       const std::vector<Bnode *> &kids);
+  void *allocExpr(Bfunction *owner);
+  Bstatement *newStmt(NodeFlavor fl, Bfunction *func,
+                      const std::vector<Bnode *> &kids, Location loc);
+  Bblock *newBlock(Bfunction *func, const std::vector<Bvariable *> &vars,
+                   Location loc);
+  llvm::MutableArrayRef<Bnode *> copyKids(llvm::BumpPtrAllocator &alloc,
+                                          llvm::ArrayRef<Bnode *> kids);
+
  private:
   std::unique_ptr<Bstatement> errorStatement_;
+  llvm::BumpPtrAllocator exprArena_;
+  std::vector<void *> exprFreeList_;
+  llvm::StringSet<> tags_;
   std::vector<Bexpression *> earchive_;
-  std::vector<Bstatement *> sarchive_;
-  std::vector<SwitchDescriptor*> swcases_;
+  Bfunction *curFcn_;
+  std::unordered_map<Bfunction *, std::unique_ptr<FcnArena> > fcnArenas_;
   std::unique_ptr<IntegrityVisitor> integrityVisitor_;
 };
 
+// Node walkers (below) can either recurse on the C++ stack (the
+// default), or keep an explicit stack of pending nodes, which is
+// preferable for very deep trees. Neither form allocates memory
+// during the walk, apart from growing the explicit stack (whose
+// storage is retained by the walker and reused on subsequent walks).
+
+enum WalkStackDisp {
+  RecursiveWalk, ExplicitStackWalk
+};
+
 // This class helps automate walking of a Bnode subtree; it invokes
 // callbacks in the supplied visitor object at useful points during
 // the walk that is instigated by 'simple_walk_nodes' below.
@@ -294,45 +401,83 @@ class BnodeBuilder {
 template<class Visitor>
 class SimpleNodeWalker {
 public:
-  SimpleNodeWalker(Visitor &vis) : visitor_(vis) { }
+  SimpleNodeWalker(Visitor &vis, WalkStackDisp disp = RecursiveWalk)
+      : visitor_(vis), disp_(disp) { }
 
   void walk(Bnode *node) {
     assert(node);
+    if (disp_ == ExplicitStackWalk)
+      walkExplicit(node);
+    else
+      walkRecursive(node);
+  }
 
+ private:
+  void walkRecursive(Bnode *node) {
     // pre-node hook
     visitor_.visitNodePre(node);
 
     // walk children
-    for (unsigned idx = 0; idx < node->children().size(); ++idx) {
-      Bnode *child = node->children()[idx];
-      walk(child);
-    }
+    for (unsigned idx = 0; idx < node->numKids_; ++idx)
+      walkRecursive(node->kids_[idx]);
 
     // post-node hook
     visitor_.visitNodePost(node);
   }
 
+  void walkExplicit(Bnode *root) {
+    stack_.clear();
+    visitor_.visitNodePre(root);
+    stack_.push_back(std::make_pair(root, 0u));
+    while (!stack_.empty()) {
+      Bnode *node = stack_.back().first;
+      unsigned idx = stack_.back().second;
+      if (idx < node->numKids_) {
+        stack_.back().second = idx + 1;
+        Bnode *child = node->kids_[idx];
+        visitor_.visitNodePre(child);
+        stack_.push_back(std::make_pair(child, 0u));
+      } else {
+        visitor_.visitNodePost(node);
+        stack_.pop_back();
+      }
+    }
+  }
+
  private:
   Visitor &visitor_;
+  WalkStackDisp disp_;
+  llvm::SmallVector<std::pair<Bnode *, unsigned>, 32> stack_;
 };
 
 template<class Visitor>
-inline void simple_walk_nodes(Bnode *root, Visitor &vis) {
-  SimpleNodeWalker<Visitor> walker(vis);
+inline void simple_walk_nodes(Bnode *root, Visitor &vis,
+                              WalkStackDisp disp = RecursiveWalk) {
+  SimpleNodeWalker<Visitor> walker(vis, disp);
   walker.walk(root);
 }
 
 // A more complicated node walker that allows for replacement of child
-// nodes, plus stopping the walk if the visitor so decides.
+// nodes, plus stopping the walk if the visitor so decides. Children
+// are visited in place by index (replacements are written back via
+// replaceChild), so visitors may replace children but not add or
+// remove them.
 
 template<class Visitor>
 class UpdatingNodeWalker {
 public:
-  UpdatingNodeWalker(Visitor &vis) : visitor_(vis) { }
+  UpdatingNodeWalker(Visitor &vis, WalkStackDisp disp = RecursiveWalk)
+      : visitor_(vis), disp_(disp) { }
 
   std::pair<VisitDisp, Bnode *> walk(Bnode *node) {
     assert(node);
+    if (disp_ == ExplicitStackWalk)
+      return walkExplicit(node);
+    return walkRecursive(node);
+  }
 
+ private:
+  std::pair<VisitDisp, Bnode *> walkRecursive(Bnode *node) {
     // pre-node hook
     auto pairPre = visitor_.visitNodePre(node);
     if (pairPre.second != node)
@@ -340,9 +485,8 @@ public:
     if (pairPre.first == StopWalk)
       return std::make_pair(StopWalk, node);
 
-    std::vector<Bnode *> children = node->children();
-    for (unsigned idx = 0; idx < children.size(); ++idx) {
-      Bnode *child = children[idx];
+    for (unsigned idx = 0; idx < node->numKids_; ++idx) {
+      Bnode *child = node->kids_[idx];
 
       // pre-child hook
       auto pairPre = visitor_.visitChildPre(node, child);
@@ -354,7 +498,7 @@ public:
         return std::make_pair(StopWalk, node);
 
       // walk child
-      auto pairChild = walk(child);
+      auto pairChild = walkRecursive(child);
       if (pairChild.second != child) {
         node->replaceChild(idx, pairChild.second);
         child = pairChild.second;
@@ -380,13 +524,97 @@ public:
     return std::make_pair(ContinueWalk, node);
   }
 
+  // Explicit stack version of the above. Each stack entry holds a
+  // node whose children are being walked, along with the index of the
+  // child currently being visited; hook invocation order (and the
+  // handling of replacements and StopWalk) is identical.
+
+  std::pair<VisitDisp, Bnode *> walkExplicit(Bnode *node) {
+    stack_.clear();
+    for (;;) {
+      // pre-node hook for 'node', which is either the root or the
+      // child at the current index of the node atop the stack.
+      auto pairPre = visitor_.visitNodePre(node);
+      node = pairPre.second;
+      if (pairPre.first == StopWalk)
+        return stopWalk(node);
+      stack_.push_back(std::make_pair(node, 0u));
+
+      // Advance to the next child to be walked, completing nodes
+      // whose children are exhausted along the way.
+      for (;;) {
+        Bnode *parent = stack_.back().first;
+        unsigned idx = stack_.back().second;
+        if (idx < parent->numKids_) {
+          Bnode *child = parent->kids_[idx];
+
+          // pre-child hook
+          auto pairPre = visitor_.visitChildPre(parent, child);
+          if (pairPre.second != child) {
+            parent->replaceChild(idx, pairPre.second);
+            child = pairPre.second;
+          }
+          if (pairPre.first == StopWalk) {
+            stack_.pop_back();
+            return stopWalk(parent);
+          }
+          node = child;
+          break;
+        }
+
+        // post-node hook
+        auto pairPost = visitor_.visitNodePost(parent);
+        stack_.pop_back();
+        if (stack_.empty())
+          return pairPost;
+        if (pairPost.first == StopWalk)
+          return stopWalk(pairPost.second);
+
+        // Back in the parent: record the walked child
+        Bnode *gparent = stack_.back().first;
+        unsigned pidx = stack_.back().second;
+        Bnode *child = pairPost.second;
+        if (gparent->kids_[pidx] != child)
+          gparent->replaceChild(pidx, child);
+
+        // post-child hook
+        auto pairPostChild = visitor_.visitChildPost(gparent, child);
+        if (pairPostChild.second != child)
+          gparent->replaceChild(pidx, pairPostChild.second);
+        if (pairPostChild.first == StopWalk) {
+          stack_.pop_back();
+          return stopWalk(gparent);
+        }
+        stack_.back().second = pidx + 1;
+      }
+    }
+  }
+
+  // Unwind the explicit stack following a StopWalk; 'node' is the
+  // result for the child at the current index of the node atop the
+  // stack (or for the root, if the stack is empty).
+  std::pair<VisitDisp, Bnode *> stopWalk(Bnode *node) {
+    while (!stack_.empty()) {
+      Bnode *parent = stack_.back().first;
+      unsigned idx = stack_.back().second;
+      if (parent->kids_[idx] != node)
+        parent->replaceChild(idx, node);
+      node = parent;
+      stack_.pop_back();
+    }
+    return std::make_pair(StopWalk, node);
+  }
+
  private:
   Visitor &visitor_;
+  WalkStackDisp disp_;
+  llvm::SmallVector<std::pair<Bnode *, unsigned>, 32> stack_;
 };
 
 template<class Visitor>
-inline Bnode *update_walk_nodes(Bnode *root, Visitor &vis) {
-  UpdatingNodeWalker<Visitor> walker(vis);
+inline Bnode *update_walk_nodes(Bnode *root, Visitor &vis,
+                                WalkStackDisp disp = RecursiveWalk) {
+  UpdatingNodeWalker<Visitor> walker(vis, disp);
   auto p = walker.walk(root);
   return p.second;
 }
@@ -19,7 +19,7 @@
 
 Bstatement::Bstatement(NodeFlavor fl,
                        Bfunction *func,
-                       const std::vector<Bnode *> &kids,
+                       llvm::MutableArrayRef<Bnode *> kids,
                        Location loc)
     : Bnode(fl, kids, loc), function_(func)
 {
@@ -51,7 +51,7 @@ std::vector<Bstatement *> Bstatement::getChildStmts()
 Bexpression *Bstatement::getNthChildAsExpr(NodeFlavor fl, unsigned cidx)
 {
   assert(flavor() == fl);
-  const std::vector<Bnode *> &kids = children();
+  llvm::ArrayRef<Bnode *> kids = children();
   assert(cidx < kids.size());
   Bexpression *e = kids[cidx]->castToBexpression();
   assert(e);
@@ -61,7 +61,7 @@ Bexpression *Bstatement::getNthChildAsExpr(NodeFlavor fl, unsigned cidx)
 Bstatement *Bstatement::getNthChildAsStmt(NodeFlavor fl, unsigned cidx)
 {
   assert(flavor() == fl);
-  const std::vector<Bnode *> &kids = children();
+  llvm::ArrayRef<Bnode *> kids = children();
   assert(cidx < kids.size());
   Bstatement *s = kids[cidx]->castToBstatement();
   assert(s);
@@ -137,7 +137,7 @@ std::vector<Bexpression *> Bstatement::getSwitchStmtNthCase(unsigned idx)
   assert(idx < swcases->cases().size());
   const SwitchCaseDesc &cdesc = swcases->cases().at(idx);
   std::vector<Bexpression *> rval;
-  const std::vector<Bnode *> &kids = children();
+  llvm::ArrayRef<Bnode *> kids = children();
   for (unsigned ii = 0; ii < cdesc.len; ++ii) {
     Bexpression *e = kids[ii+cdesc.st]->castToBexpression();
     assert(e);
@@ -152,7 +152,7 @@ Bstatement *Bstatement::getSwitchStmtNthStmt(unsigned idx)
   SwitchDescriptor *swcases = getSwitchCases();
   assert(idx < swcases->cases().size());
   const SwitchCaseDesc &cdesc = swcases->cases().at(idx);
-  const std::vector<Bnode *> &kids = children();
+  llvm::ArrayRef<Bnode *> kids = children();
   Bstatement *st = kids[cdesc.stmt]->castToBstatement();
   assert(st);
   return st;
@@ -171,7 +171,7 @@ LabelId Bstatement::getLabelStmtDefinedLabel()
 Bblock::Bblock(Bfunction *func,
                const std::vector<Bvariable *> &vars,
                Location loc)
-    : Bstatement(N_BlockStmt, func, std::vector<Bnode *>(), loc)
+    : Bstatement(N_BlockStmt, func, llvm::MutableArrayRef<Bnode *>(), loc)
     , vars_(vars)
 {
 }
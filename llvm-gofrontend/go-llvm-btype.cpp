@@ -15,6 +15,8 @@
 #include "go-llvm-bexpression.h"
 #include "go-system.h"
 
+#include "llvm/ADT/Hashing.h"
+#include "llvm/ADT/StringRef.h"
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/IR/DerivedTypes.h"
 #include "llvm/IR/Constants.h"
@@ -47,6 +49,18 @@ void Btype::osdump(llvm::raw_ostream &os, unsigned ilevel) const {
     os << "<nil type_>\n";
 }
 
+// Note that component types (pointed-to types, field types, etc) are
+// compared by identity and not structurally. Anonymous types are
+// hash-consed by the type manager (structurally equal types are the
+// same object, or are forwarded to it via canonical()), and named
+// types and placeholders are by definition distinct from any other
+// type, so a pointer comparison suffices.
+
+static inline const Btype *canonicalType(const Btype *t)
+{
+  return t ? t->canonical() : nullptr;
+}
+
 bool Btype::equal(const Btype &other) const
 {
   if (this == &other)
@@ -72,27 +86,24 @@ bool Btype::equal(const Btype &other) const
     case PointerT: {
       const BPointerType *bpt = castToBPointerType();
       const BPointerType *obpt = other.castToBPointerType();
-      if ((bpt->toType() != nullptr) != (obpt->toType() != nullptr))
-        return false;
-      return bpt->toType()->equal(*obpt->toType());
+      return canonicalType(bpt->toType()) == canonicalType(obpt->toType());
     }
     case ArrayT: {
       const BArrayType *bat = castToBArrayType();
       const BArrayType *obat = other.castToBArrayType();
-      if ((bat->elemType() != nullptr) != (obat->elemType() != nullptr))
+      if (canonicalType(bat->elemType()) != canonicalType(obat->elemType()))
         return false;
-      return (bat->nelSize() == obat->nelSize() &&
-              bat->elemType()->equal(*obat->elemType()));
+      return (bat->elemType() == nullptr || bat->nelSize() == obat->nelSize());
     }
     case StructT: {
       const BStructType *bst = castToBStructType();
       const BStructType *obst = other.castToBStructType();
-      const std::vector<Backend::Btyped_identifier> &ft = bst->fields();
-      const std::vector<Backend::Btyped_identifier> &fo = obst->fields();
+      llvm::ArrayRef<Backend::Btyped_identifier> ft = bst->fields();
+      llvm::ArrayRef<Backend::Btyped_identifier> fo = obst->fields();
       if (ft.size() != fo.size())
         return false;
       for (unsigned i = 0; i < ft.size(); ++i) {
-        if (! ft[i].btype->equal(*fo[i].btype))
+        if (canonicalType(ft[i].btype) != canonicalType(fo[i].btype))
           return false;
         if (ft[i].name != fo[i].name)
           return false;
@@ -104,20 +115,18 @@ bool Btype::equal(const Btype &other) const
     case FunctionT: {
       const BFunctionType *bft = castToBFunctionType();
       const BFunctionType *obft = other.castToBFunctionType();
-      if ((bft->receiverType() != nullptr) !=
-          (obft->receiverType() != nullptr))
-        return false;
-      if (bft->receiverType() &&
-          ! bft->receiverType()->equal(*obft->receiverType()))
+      if (canonicalType(bft->receiverType()) !=
+          canonicalType(obft->receiverType()))
         return false;
-      if (! bft->resultType()->equal(*obft->resultType()))
+      if (canonicalType(bft->resultType()) !=
+          canonicalType(obft->resultType()))
         return false;
       const std::vector<Btype *> &pt = bft->paramTypes();
       const std::vector<Btype *> &po = obft->paramTypes();
       if (pt.size() != po.size())
         return false;
       for (unsigned i = 0; i < pt.size(); ++i) {
-        if (! pt[i]->equal(*po[i]))
+        if (canonicalType(pt[i]) != canonicalType(po[i]))
           return false;
       }
       if (bft->followsCabi() != obft->followsCabi())
@@ -130,55 +139,45 @@ bool Btype::equal(const Btype &other) const
   return false;
 }
 
-unsigned Btype::hash() const
-{
-  unsigned hv = static_cast<unsigned>(flavor());
-  std::size_t hn = std::hash<std::string>{}(name());
-  std::size_t ht = std::hash<llvm::Type *>{}(type());
-  unsigned h = ((hn + ht) << 3) | hv;
-  return h;
-}
+// Note: the hash has to be consistent with ::equal above, so it can
+// only draw on properties that ::equal compares. In addition to the
+// LLVM type and name we mix in a few cheap structural properties
+// (signedness, field names, param count), but don't recurse into
+// child Btypes.
 
-Btype *Btype::clone() const
+unsigned Btype::hash() const
 {
-  Btype *rval = nullptr;
+  llvm::hash_code h = llvm::hash_combine(static_cast<unsigned>(flavor()),
+                                         type(), llvm::StringRef(name()));
   switch(flavor_) {
     case AuxT:
-    case FloatT: {
-      rval = new Btype(flavor(), type(), location());
+    case FloatT:
       break;
-    }
-    case IntegerT: {
-      const BIntegerType *bit = castToBIntegerType();
-      rval = bit->clone();
+    case IntegerT:
+      h = llvm::hash_combine(h, castToBIntegerType()->isUnsigned());
       break;
-    }
-    case PointerT: {
-      const BPointerType *bpt = castToBPointerType();
-      rval = bpt->clone();
+    case PointerT:
+      h = llvm::hash_combine(h, castToBPointerType()->toType() != nullptr);
       break;
-    }
-    case ArrayT: {
-      const BArrayType *bat = castToBArrayType();
-      rval = bat->clone();
+    case ArrayT:
+      h = llvm::hash_combine(h, castToBArrayType()->elemType() != nullptr);
       break;
-    }
     case StructT: {
       const BStructType *bst = castToBStructType();
-      rval = bst->clone();
+      h = llvm::hash_combine(h, bst->fields().size());
+      for (auto &f : bst->fields())
+        h = llvm::hash_combine(h, llvm::StringRef(f.name));
       break;
     }
     case FunctionT: {
       const BFunctionType *bft = castToBFunctionType();
-      rval = bft->clone();
+      h = llvm::hash_combine(h, bft->paramTypes().size(),
+                             bft->receiverType() != nullptr,
+                             bft->followsCabi());
       break;
     }
   }
-  if (type())
-    rval->setType(type());
-  rval->setPlaceholder(isPlaceholder());
-  rval->setName(name());
-  return rval;
+  return static_cast<unsigned>(h);
 }
 
 bool Btype::isUnresolvedPlaceholder() const {
@@ -21,6 +21,8 @@
 
 #include "backend.h"
 
+#include "llvm/ADT/ArrayRef.h"
+
 namespace llvm {
 class Type;
 class Value;
@@ -43,8 +45,8 @@ class Btype {
     ArrayT, FloatT, FunctionT, IntegerT, PointerT, StructT, AuxT
   };
   Btype(TyFlavor flavor, llvm::Type *type, Location location)
-      : type_(type), location_(location), flavor_(flavor),
-        isPlaceholder_(false) { }
+      : type_(type), canonical_(nullptr), location_(location),
+        flavor_(flavor), isPlaceholder_(false) { }
   virtual ~Btype() { }
 
   TyFlavor flavor() const { return flavor_; }
@@ -72,8 +74,16 @@ class Btype {
   // struct types.
   bool isUnresolvedPlaceholder() const;
 
-  // Create a shallow copy of this type
-  Btype *clone() const;
+  // Anonymous types are hash-consed, but resolving a placeholder can
+  // turn an existing anonymous type into a structural duplicate of
+  // some other type. In that case the duplicate is forwarded to the
+  // surviving type, which is returned here (otherwise this type).
+  Btype *canonical() { return canonical_ ? canonical_ : this; }
+  const Btype *canonical() const { return canonical_ ? canonical_ : this; }
+  void setCanonical(Btype *t) {
+    assert(!t || t->canonical() == t);
+    canonical_ = t;
+  }
 
   // debugging
   void dump() const;
@@ -106,6 +116,7 @@ class Btype {
   Btype() : type_(NULL) {}
   std::string name_;
   llvm::Type *type_;
+  Btype *canonical_;
   Location location_;
   TyFlavor flavor_;
   bool isPlaceholder_;
@@ -121,11 +132,6 @@ class BIntegerType : public Btype {
   bool isUnsigned() const { return isUnsigned_; }
   unsigned bits() const { return bits_; }
 
-  // Create a shallow copy of this type
-  Btype *clone() const {
-    return new BIntegerType(isUnsigned_, bits_, type(), location());
-  }
-
  private:
   unsigned bits_;
   bool isUnsigned_;
@@ -148,11 +154,6 @@ class BFloatType : public Btype {
 
   unsigned bits() const { return bits_; }
 
-  // Create a shallow copy of this type
-  Btype *clone() const {
-    return new BFloatType(bits_, type(), location());
-  }
-
  private:
   unsigned bits_;
 };
@@ -170,8 +171,9 @@ inline const BFloatType *Btype::castToBFloatType() const {
 class BStructType : public Btype {
  public:
 
-  // For concrete struct types
-  BStructType(const std::vector<Backend::Btyped_identifier> &fields,
+  // For concrete struct types. Field storage is not owned by the
+  // struct type; see TypeManager::allocFields.
+  BStructType(llvm::MutableArrayRef<Backend::Btyped_identifier> fields,
               llvm::Type *type, Location location)
       : Btype(StructT, type, location), fields_(fields) { }
 
@@ -186,27 +188,18 @@ class BStructType : public Btype {
   Btype *fieldType(unsigned idx) const {
     return fields_[idx].btype;
   }
-  void setFieldType(unsigned idx, Btype *t) {
-    assert(t);
-    fields_[idx].btype = t;
-  }
   const std::string &fieldName(unsigned idx) const {
     return fields_[idx].name;
   }
-  const std::vector<Backend::Btyped_identifier> &fields() const {
+  llvm::ArrayRef<Backend::Btyped_identifier> fields() const {
     return fields_;
   }
-  void setFields(const std::vector<Backend::Btyped_identifier> &fields) {
+  void setFields(llvm::MutableArrayRef<Backend::Btyped_identifier> fields) {
     fields_ = fields;
   }
 
-  // Create a shallow copy of this type
-  Btype *clone() const {
-    return new BStructType(fields_, type(), location());
-  }
-
  private:
-  std::vector<Backend::Btyped_identifier> fields_;
+  llvm::MutableArrayRef<Backend::Btyped_identifier> fields_;
 };
 
 inline BStructType *Btype::castToBStructType() {
@@ -255,11 +248,6 @@ class BArrayType : public Btype {
   void setNelements(Bexpression *nel) { nelements_ = nel; }
   uint64_t nelSize() const;
 
-  // Create a shallow copy of this type
-  Btype *clone() const {
-    return new BArrayType(elemType_, nelements_, type(), location());
-  }
-
  private:
   Btype *elemType_;
   Bexpression *nelements_;
@@ -298,11 +286,6 @@ class BPointerType : public Btype {
     toType_ = to;
   }
 
-  // Create a shallow copy of this type
-  Btype *clone() const {
-    return new BPointerType(toType_, type(), location());
-  }
-
  private:
   Btype *toType_;
 };
@@ -342,12 +325,6 @@ class BFunctionType : public Btype {
   // occupy the first slot in paramTypes.
   const std::vector<Btype *> &paramTypes() const { return paramTypes_; }
 
-  // Create a shallow copy of this type
-  Btype *clone() const {
-    return new BFunctionType(receiverType_, paramTypes_, resultTypes_, rtype_,
-                             type(), followsCabi(), location());
-  }
-
  private:
   Btype *receiverType_;
   std::vector<Btype *> paramTypes_;
@@ -0,0 +1,130 @@
+//===-- go-llvm-chunker.cpp - FunctionChunker class methods ---------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Methods for FunctionChunker class.
+//
+//===----------------------------------------------------------------------===//
+
+#include "go-llvm-chunker.h"
+
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+#include "llvm/Transforms/Utils/ModuleUtils.h"
+#include "llvm/Transforms/Utils/ValueMapper.h"
+
+#include <vector>
+
+FunctionChunker::FunctionChunker(llvm::Module *module,
+                                 const std::string &prefix)
+    : module_(module), prefix_(prefix), localsPromoted_(false)
+{
+}
+
+// Collect the global values referenced by the body of function 'f'
+// (including those referenced indirectly via constant expressions).
+
+static void
+collectReferencedGlobals(llvm::Function *f,
+                         llvm::SmallPtrSetImpl<llvm::GlobalValue *> &refs)
+{
+  llvm::SmallVector<llvm::Constant *, 32> worklist;
+  llvm::SmallPtrSet<llvm::Constant *, 32> seen;
+  if (f->hasPersonalityFn())
+    worklist.push_back(f->getPersonalityFn());
+  for (llvm::BasicBlock &bb : *f)
+    for (llvm::Instruction &inst : bb)
+      for (llvm::Value *op : inst.operands())
+        if (llvm::Constant *c = llvm::dyn_cast<llvm::Constant>(op))
+          if (seen.insert(c).second)
+            worklist.push_back(c);
+  while (!worklist.empty()) {
+    llvm::Constant *c = worklist.pop_back_val();
+    if (llvm::GlobalValue *gv = llvm::dyn_cast<llvm::GlobalValue>(c)) {
+      refs.insert(gv);
+      continue;
+    }
+    for (llvm::Value *op : c->operands())
+      if (llvm::Constant *oc = llvm::dyn_cast<llvm::Constant>(op))
+        if (seen.insert(oc).second)
+          worklist.push_back(oc);
+  }
+}
+
+// Returns the (stable) external name for module-local symbol 'gv'.
+// The name includes a sequence number, so it can't collide with any
+// other symbol in the module.
+
+const std::string &FunctionChunker::promotedName(llvm::GlobalValue *gv)
+{
+  auto it = promoted_.find(gv);
+  if (it != promoted_.end())
+    return it->second;
+  std::string name = prefix_ + std::to_string(promoted_.size());
+  if (gv->hasName())
+    name += "." + gv->getName().str();
+  return promoted_[gv] = name;
+}
+
+std::unique_ptr<llvm::Module>
+FunctionChunker::extract(llvm::ArrayRef<llvm::Function *> fns)
+{
+  assert(!localsPromoted_);
+
+  llvm::SmallPtrSet<llvm::GlobalValue *, 32> refs;
+  llvm::SmallPtrSet<const llvm::GlobalValue *, 32> batch;
+  for (llvm::Function *f : fns) {
+    assert(!f->hasLocalLinkage());
+    batch.insert(f);
+    collectReferencedGlobals(f, refs);
+  }
+
+  llvm::ValueToValueMapTy vmap;
+  std::unique_ptr<llvm::Module> chunk =
+      llvm::CloneModule(module_, vmap, [&](const llvm::GlobalValue *gv) {
+        return batch.count(gv) != 0;
+      });
+
+  // Module inline asm (which declares the export data section) stays
+  // with the main module.
+  chunk->setModuleInlineAsm("");
+
+  for (llvm::GlobalValue *gv : refs) {
+    if (!gv->hasLocalLinkage())
+      continue;
+    llvm::GlobalValue *cgv = llvm::cast<llvm::GlobalValue>(vmap[gv]);
+    cgv->setName(promotedName(gv));
+    assert(cgv->getName() == promotedName(gv));
+    cgv->setLinkage(llvm::GlobalValue::ExternalLinkage);
+    cgv->setVisibility(llvm::GlobalValue::HiddenVisibility);
+  }
+  return chunk;
+}
+
+void FunctionChunker::promoteLocals()
+{
+  assert(!localsPromoted_);
+  localsPromoted_ = true;
+  if (promoted_.empty())
+    return;
+
+  std::vector<llvm::GlobalValue *> used;
+  for (auto &p : promoted_) {
+    llvm::GlobalValue *gv = p.first;
+    gv->setName(p.second);
+    assert(gv->getName() == p.second);
+    gv->setLinkage(llvm::GlobalValue::ExternalLinkage);
+    gv->setVisibility(llvm::GlobalValue::HiddenVisibility);
+    used.push_back(gv);
+  }
+  llvm::appendToCompilerUsed(*module_, used);
+}
@@ -0,0 +1,73 @@
+//===-- go-llvm-chunker.h - decls for FunctionChunker class ---------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Defines FunctionChunker class.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVMGOFRONTEND_GO_LLVM_CHUNKER_H
+#define LLVMGOFRONTEND_GO_LLVM_CHUNKER_H
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/MapVector.h"
+
+#include <memory>
+#include <string>
+
+namespace llvm {
+class Function;
+class GlobalValue;
+class Module;
+}
+
+// Helper for compiling a module in pieces while the module is still
+// being generated (llvm-goparse -fstreaming-codegen). A "chunk" is a
+// copy of some set of completed functions, in a separate module in
+// which everything else appears only as a declaration.
+//
+// Module-local symbols (string constants and the like) referenced
+// from a chunk have to be promoted to hidden external symbols so that
+// the chunk can refer to them. Since the backend is still generating
+// IR while chunks are being extracted, the main module is left alone
+// at that point: the promoted names are applied only to the chunks,
+// and are recorded so that they can be applied to the main module
+// once IR generation is complete (see promoteLocals).
+
+class FunctionChunker {
+ public:
+  // 'prefix' is used to form the external names of promoted symbols;
+  // it should be unique to the package being compiled.
+  FunctionChunker(llvm::Module *module, const std::string &prefix);
+
+  // Clone the functions in 'fns' into a new chunk module. The
+  // functions must have external linkage.
+  std::unique_ptr<llvm::Module> extract(llvm::ArrayRef<llvm::Function *> fns);
+
+  // Apply the names used by the chunks to the main module's
+  // definitions of promoted symbols, giving them hidden external
+  // linkage. The symbols are also added to llvm.compiler.used:
+  // their only users may have been function bodies that were moved
+  // into chunks, and the optimizer would otherwise discard them. To
+  // be invoked once IR generation is complete, and before the main
+  // module is optimized; no further chunks can be extracted after
+  // this point.
+  void promoteLocals();
+
+  unsigned numPromoted() const { return promoted_.size(); }
+
+ private:
+  llvm::Module *module_;
+  std::string prefix_;
+  llvm::MapVector<llvm::GlobalValue *, std::string> promoted_;
+  bool localsPromoted_;
+
+  const std::string &promotedName(llvm::GlobalValue *gv);
+};
+
+#endif // LLVMGOFRONTEND_GO_LLVM_CHUNKER_H
@@ -28,6 +28,11 @@ bool go_be_saw_errors()
   return error_count > 0;
 }
 
+void go_be_reset_errors()
+{
+  error_count = 0;
+}
+
 void
 go_be_error(const std::string& errmsg)
 {
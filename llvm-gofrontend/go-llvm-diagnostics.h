@@ -16,4 +16,8 @@
 
 extern bool go_be_saw_errors();
 
+// Reset the error count (used when compiling multiple packages
+// within the same process).
+extern void go_be_reset_errors();
+
 #endif // !defined(GO_LLVM_DIAGNOSTICS_H)
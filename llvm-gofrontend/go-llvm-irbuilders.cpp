@@ -14,16 +14,46 @@
 #include "go-llvm-irbuilders.h"
 #include "namegen.h"
 
+#include "llvm/IR/Intrinsics.h"
+#include "llvm/IR/Module.h"
+
 std::vector<llvm::Instruction*> BlockLIRBuilder::instructions()
 {
-  std::vector<llvm::Instruction*> rv;
-  for (auto &i : dummyBlock_->getInstList())
-    rv.push_back(&i);
+  llvm::ArrayRef<llvm::Instruction*> insns = collected_.instructions();
+  std::vector<llvm::Instruction*> rv(insns.begin(), insns.end());
+  collected_.clear();
+  bool nameCasts = !namegen_->discardNames();
   for (auto &i : rv) {
-    i->removeFromParent();
-    // hack: irbuilder likes to create unnamed bitcasts
-    if (i->isCast() && i->getName() == "")
+    // hack: memcpy creates unnamed bitcasts (see below)
+    if (nameCasts && i->isCast() && i->getName() == "")
       i->setName(namegen_->namegen("cast"));
   }
   return rv;
 }
+
+// Like the IRBuilder helper of the same name, this always creates a
+// cast instruction (as opposed to a folded constant expression).
+
+llvm::Value *BlockLIRBuilder::castToInt8Ptr(llvm::Value *ptr)
+{
+  llvm::PointerType *pt = llvm::cast<llvm::PointerType>(ptr->getType());
+  if (pt->getElementType()->isIntegerTy(8))
+    return ptr;
+  llvm::PointerType *i8pt = getInt8PtrTy(pt->getAddressSpace());
+  return Insert(new llvm::BitCastInst(ptr, i8pt));
+}
+
+llvm::CallInst *BlockLIRBuilder::CreateMemCpy(llvm::Value *dst,
+                                              llvm::Value *src,
+                                              uint64_t size,
+                                              unsigned align)
+{
+  dst = castToInt8Ptr(dst);
+  src = castToInt8Ptr(src);
+  llvm::Value *sz = getInt64(size);
+  llvm::Type *tys[] = { dst->getType(), src->getType(), sz->getType() };
+  llvm::Function *memcpyFn =
+      llvm::Intrinsic::getDeclaration(module_, llvm::Intrinsic::memcpy, tys);
+  llvm::Value *ops[] = { dst, src, sz, getInt32(align), getFalse() };
+  return CreateCall(memcpyFn, ops);
+}
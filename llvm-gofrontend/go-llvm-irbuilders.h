@@ -84,35 +84,46 @@ class BinstructionsLIRBuilder :
 
 // Some of the methods in the LLVM IRBuilder class (ex: CreateMemCpy) assume that
 // you are appending to an existing basic block (which is typically
-// not what we want to do in many cases in the bridge code).
+// not what we want to do in many cases in the bridge code, since the
+// block an instruction winds up in isn't known until GenBlocks runs).
 //
-// This builder works around this issue by creating a dummy basic block
-// to capture any instructions generated, then when the builder is
-// destroyed it detaches the instructions from the block so that
-// they can be returned in a list.
+// This builder collects the instructions it creates in a list without
+// inserting them into any block (GenBlocks later inserts each one
+// exactly once, into its final block), and provides replacements for
+// the IRBuilder methods that need a containing block.
 
-class BlockLIRBuilder : public LIRBuilder {
+class BlockLIRBuilder :
+    public llvm::IRBuilder<llvm::ConstantFolder, BinstructionsInserter> {
+  typedef llvm::IRBuilder<llvm::ConstantFolder,
+                          BinstructionsInserter> IRBuilderBase;
  public:
   BlockLIRBuilder(llvm::Function *func, NameGen *namegen)
-      : LIRBuilder(func->getContext(), llvm::ConstantFolder()),
-        dummyBlock_(llvm::BasicBlock::Create(func->getContext(), "", func)),
+      : IRBuilderBase(func->getContext(), llvm::ConstantFolder()),
+        module_(func->getParent()),
         namegen_(namegen)
   {
-    SetInsertPoint(dummyBlock_.get());
+    setDest(&collected_);
   }
 
   ~BlockLIRBuilder() {
-    assert(dummyBlock_->getInstList().empty());
-    dummyBlock_->removeFromParent();
+    assert(collected_.instructions().empty());
   }
 
-  // Return the instructions generated by this builder. Note that
-  // this detaches them from the dummy block we emitted them into,
-  // hence is not intended to be invoked more than once.
+  // Emit a call to the memcpy intrinsic. Hides the IRBuilder method
+  // of the same name, which requires an insertion block.
+  llvm::CallInst *CreateMemCpy(llvm::Value *dst, llvm::Value *src,
+                               uint64_t size, unsigned align);
+
+  // Return the instructions generated by this builder. Not intended
+  // to be invoked more than once.
   std::vector<llvm::Instruction*> instructions();
 
  private:
-  std::unique_ptr<llvm::BasicBlock> dummyBlock_;
+  llvm::Value *castToInt8Ptr(llvm::Value *ptr);
+
+ private:
+  llvm::Module *module_;
+  Binstructions collected_;
   NameGen *namegen_;
 };
 
@@ -6,6 +6,7 @@
 
 #include "go-location.h"
 #include "go-llvm-linemap.h"
+#include "go-llvm-memstats.h"
 
 #include "llvm/Support/LEB128.h"
 
@@ -223,6 +224,18 @@ std::string Llvm_linemap::statistics()
   return ss.str();
 }
 
+size_t Llvm_linemap::memoryBytes() const
+{
+  size_t bytes = vectorBytes(files_) + vectorBytes(segments_) +
+      vectorBytes(encoded_locations_);
+  for (auto &f : files_)
+    bytes += f.capacity();
+  // One tree node (key, value and three links) per file map entry.
+  for (auto &kv : fmap_)
+    bytes += sizeof(kv) + kv.first.capacity() + 3 * sizeof(void *);
+  return bytes;
+}
+
 void Llvm_linemap::dumpHandle(unsigned handle)
 {
   Location loc(handle);
@@ -49,6 +49,9 @@ class Llvm_linemap : public Linemap
 
   std::string statistics();
 
+  // Memory used by the linemap's tables, in bytes (for -fmem-report).
+  size_t memoryBytes() const;
+
   int
   location_line(Location);
 
@@ -0,0 +1,38 @@
+//===-- go-llvm-memstats.h - container memory estimates -------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Helpers for estimating the memory held by the containers in the
+// backend's major data structures (for llvm-goparse -fmem-report).
+// LLVM containers (DenseMap, BumpPtrAllocator, etc) report their own
+// sizes; these cover the std containers.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVMGOFRONTEND_GO_LLVM_MEMSTATS_H
+#define LLVMGOFRONTEND_GO_LLVM_MEMSTATS_H
+
+#include <cstddef>
+
+// Storage reserved by a std::vector (or similar).
+template<typename C>
+size_t vectorBytes(const C &v)
+{
+  return v.capacity() * sizeof(typename C::value_type);
+}
+
+// Storage used by a node-based std::unordered_{map,set}: the bucket
+// array, plus one node (element and link) per element.
+template<typename C>
+size_t hashTableBytes(const C &t)
+{
+  return t.bucket_count() * sizeof(void *) +
+      t.size() * (sizeof(typename C::value_type) + sizeof(void *));
+}
+
+#endif // LLVMGOFRONTEND_GO_LLVM_MEMSTATS_H
@@ -0,0 +1,89 @@
+//===-- go-llvm-simplify.cpp - Bnode simplifier ---------------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Methods for SimplifyVisitor class.
+//
+//===----------------------------------------------------------------------===//
+
+#include "go-llvm-simplify.h"
+#include "go-llvm-bexpression.h"
+
+#include "llvm/IR/DataLayout.h"
+#include "llvm/IR/InstrTypes.h"
+
+// Conversion 'conv' has conversion 'inner' as its operand. If the two
+// casts can be replaced by a single cast with the same opcode as the
+// outer one, rewrite the outer cast to use the inner cast's operand,
+// delete the inner cast, and return the node that is to replace
+// 'inner' as the child of 'conv'.
+
+Bexpression *SimplifyVisitor::foldCastChain(Bexpression *conv,
+                                            Bexpression *inner)
+{
+  if (conv->instructions().size() != 1 || inner->instructions().size() != 1)
+    return nullptr;
+  llvm::CastInst *c2 =
+      llvm::dyn_cast<llvm::CastInst>(conv->instructions()[0]);
+  llvm::CastInst *c1 =
+      llvm::dyn_cast<llvm::CastInst>(inner->instructions()[0]);
+  if (!c1 || !c2 || c2 != conv->value() || c1 != inner->value())
+    return nullptr;
+  if (c2->getOperand(0) != c1 || !c1->hasOneUse())
+    return nullptr;
+  Bexpression *src = inner->children()[0]->castToBexpression();
+  if (!src || src->value() != c1->getOperand(0))
+    return nullptr;
+
+  llvm::Type *srcTy = c1->getSrcTy();
+  llvm::Type *midTy = c1->getDestTy();
+  llvm::Type *dstTy = c2->getDestTy();
+  llvm::Type *srcIntPtrTy = (srcTy->isPtrOrPtrVectorTy() ?
+                             datalayout_.getIntPtrType(srcTy) : nullptr);
+  llvm::Type *midIntPtrTy = (midTy->isPtrOrPtrVectorTy() ?
+                             datalayout_.getIntPtrType(midTy) : nullptr);
+  llvm::Type *dstIntPtrTy = (dstTy->isPtrOrPtrVectorTy() ?
+                             datalayout_.getIntPtrType(dstTy) : nullptr);
+  unsigned opc =
+      llvm::CastInst::isEliminableCastPair(c1->getOpcode(), c2->getOpcode(),
+                                           srcTy, midTy, dstTy, srcIntPtrTy,
+                                           midIntPtrTy, dstIntPtrTy);
+  if (opc != c2->getOpcode())
+    return nullptr;
+
+  // Rewire the outer cast, then get rid of the inner one (which now
+  // has no uses).
+  c2->setOperand(0, c1->getOperand(0));
+  inner->clear();
+  c1->dropAllReferences();
+  delete c1;
+
+  builder_.noteChildReplacement(conv, inner, src);
+  builder_.freeExpr(inner);
+  stats_.castChains += 1;
+  return src;
+}
+
+std::pair<VisitDisp, Bnode *>
+SimplifyVisitor::visitChildPost(Bnode *parent, Bnode *child)
+{
+  Bexpression *expr = child->castToBexpression();
+  if (!expr)
+    return std::make_pair(ContinueWalk, child);
+
+  // Cast chains are collapsed from the point of view of the outer
+  // conversion; the inner conversion is the node that goes away.
+  Bexpression *pexpr = parent->castToBexpression();
+  if (pexpr && pexpr->flavor() == N_Conversion &&
+      expr->flavor() == N_Conversion) {
+    Bexpression *repl = foldCastChain(pexpr, expr);
+    if (repl)
+      return std::make_pair(ContinueWalk, repl);
+  }
+  return std::make_pair(ContinueWalk, child);
+}
@@ -0,0 +1,76 @@
+//===-- go-llvm-simplify.h - decls for Bnode simplifier -------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Defines SimplifyVisitor class.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVMGOFRONTEND_GO_LLVM_SIMPLIFY_H
+#define LLVMGOFRONTEND_GO_LLVM_SIMPLIFY_H
+
+#include "go-llvm-bnode.h"
+
+namespace llvm {
+class DataLayout;
+}
+
+class Bexpression;
+
+// Counts of rewrites performed by the simplifier.
+
+struct SimplifyStats {
+  unsigned castChains;   // conversion of conversion collapsed
+  SimplifyStats() : castChains(0) { }
+  unsigned total() const { return castChains; }
+  void add(const SimplifyStats &other) {
+    castChains += other.castChains;
+  }
+};
+
+// This visitor is run (via UpdatingNodeWalker) over the Bnode tree
+// for a function just prior to IR generation, see
+// Llvm_backend::function_set_body. Bexpressions are built eagerly, so
+// each node already carries its LLVM value and instructions; the only
+// rewrites worth doing are those that remove instructions. At present
+// that means cast chains: a conversion whose operand is another
+// conversion (ex: bitcast of bitcast, zext of zext) is collapsed if
+// LLVM reports the cast pair as eliminable to the outer cast's opcode,
+// in which case the inner cast instruction and node are deleted.
+// (Rewrites of instruction-free subtrees, such as &*p or constant
+// subexpressions, would only reshape the node tree without changing
+// the IR, and so are not done.)
+
+class SimplifyVisitor {
+ public:
+  SimplifyVisitor(BnodeBuilder &builder, const llvm::DataLayout &dl)
+      : builder_(builder), datalayout_(dl) { }
+
+  std::pair<VisitDisp, Bnode *> visitNodePre(Bnode *node) {
+    return std::make_pair(ContinueWalk, node);
+  }
+  std::pair<VisitDisp, Bnode *> visitNodePost(Bnode *node) {
+    return std::make_pair(ContinueWalk, node);
+  }
+  std::pair<VisitDisp, Bnode *> visitChildPre(Bnode *parent, Bnode *child) {
+    return std::make_pair(ContinueWalk, child);
+  }
+  std::pair<VisitDisp, Bnode *> visitChildPost(Bnode *parent, Bnode *child);
+
+  const SimplifyStats &stats() const { return stats_; }
+
+ private:
+  Bexpression *foldCastChain(Bexpression *conv, Bexpression *inner);
+
+ private:
+  BnodeBuilder &builder_;
+  const llvm::DataLayout &datalayout_;
+  SimplifyStats stats_;
+};
+
+#endif // LLVMGOFRONTEND_GO_LLVM_SIMPLIFY_H
@@ -63,6 +63,21 @@ void IntegrityVisitor::unsetParent(Bnode *child, Bnode *parent, unsigned slot)
 {
   if (! shouldBeTracked(child))
     return;
+
+  // If this link was recorded as (not yet resolved) sharing, then
+  // dropping it is all that's needed.
+  parslot ps = std::make_pair(parent, slot);
+  for (auto sit = sharing_.begin(); sit != sharing_.end(); ++sit) {
+    if (sit->first == child && sit->second == ps) {
+      sharing_.erase(sit);
+      if (child->isStmt())
+        stmtShareCount_ -= 1;
+      else
+        exprShareCount_ -= 1;
+      return;
+    }
+  }
+
   auto it = nparent_.find(child);
   assert(it != nparent_.end());
   parslot pps = it->second;
@@ -84,27 +99,102 @@ void IntegrityVisitor::setParent(Bnode *child, Bnode *parent, unsigned slot)
     unsigned prevSlot = pps.second;
     if (prevParent == parent && prevSlot == slot)
       return;
-    const char *wh = nullptr;
-    if (child->isStmt()) {
+    if (child->isStmt())
       stmtShareCount_ += 1;
-      wh = "stmt";
-    } else {
+    else
       exprShareCount_ += 1;
-      wh = "expr";
-    }
-    ss_ << "error: " << wh << " has multiple parents\n";
-    ss_ << "child " << wh << ":\n";
-    dump(child);
-    ss_ << "parent 1:\n";
-    dump(prevParent);
-    ss_ << "parent 2:\n";
-    dump(parent);
+    // Keep the original parent link; the new one is recorded as
+    // sharing (to be repaired if possible). Most sharing is repaired,
+    // so the description (see reportSharing) is produced only if it
+    // turns out not to be.
     parslot ps = std::make_pair(parent, slot);
     sharing_.push_back(std::make_pair(child, ps));
+    return;
   }
   nparent_[child] = std::make_pair(parent, slot);
 }
 
+// Returns the root of the tree containing 'node', according to the
+// parent links recorded so far.
+
+Bnode *IntegrityVisitor::rootOf(Bnode *node)
+{
+  for (;;) {
+    auto it = nparent_.find(node);
+    if (it == nparent_.end())
+      return node;
+    node = it->second.first;
+  }
+}
+
+// Describe a sharing record (the shared node and both of its
+// parents) in the message, and if requested note the root of the tree
+// holding the original parent.
+
+void IntegrityVisitor::reportSharing(const std::pair<Bnode *, parslot> &share,
+                                     std::vector<Bnode *> *roots)
+{
+  Bnode *child = share.first;
+  const char *wh = (child->isStmt() ? "stmt" : "expr");
+  ss_ << "error: " << wh << " has multiple parents\n";
+  ss_ << "child " << wh << ":\n";
+  dump(child);
+  auto it = nparent_.find(child);
+  if (it != nparent_.end()) {
+    ss_ << "parent 1:\n";
+    dump(it->second.first);
+    if (roots)
+      roots->push_back(rootOf(it->second.first));
+  }
+  ss_ << "parent 2:\n";
+  dump(share.second.first);
+}
+
+// Remove parent info for the children of the specified node, along
+// with any sharing records in which it appears (invoked when the node
+// is about to be deleted).
+
+void IntegrityVisitor::forgetParent(Bnode *parent)
+{
+  for (auto &kid : parent->children()) {
+    auto it = nparent_.find(kid);
+    if (it != nparent_.end() && it->second.first == parent)
+      nparent_.erase(it);
+  }
+  nparent_.erase(parent);
+  if (sharing_.empty())
+    return;
+  for (unsigned idx = 0; idx < sharing_.size(); ) {
+    auto &p = sharing_[idx];
+    if (p.first != parent && p.second.first != parent) {
+      idx++;
+      continue;
+    }
+    if (p.first->isStmt())
+      stmtShareCount_ -= 1;
+    else
+      exprShareCount_ -= 1;
+    sharing_.erase(sharing_.begin() + idx);
+  }
+}
+
+// Record the replacement of 'oldchild' by 'newchild' at the specified
+// slot of 'parent'. The new child is expected to have been detached
+// from its previous parent (if any), so this is not treated as
+// sharing.
+
+void IntegrityVisitor::reparent(Bnode *oldchild, Bnode *newchild,
+                                Bnode *parent, unsigned slot)
+{
+  parslot ps = std::make_pair(parent, slot);
+  auto it = nparent_.find(oldchild);
+  if (it != nparent_.end() && it->second == ps)
+    nparent_.erase(it);
+  if (! shouldBeTracked(newchild))
+    return;
+  nparent_[newchild] = ps;
+}
+
 void IntegrityVisitor::setParent(llvm::Instruction *inst,
                                  Bexpression *exprParent,
                                  unsigned slot)
@@ -159,34 +249,42 @@ bool IntegrityVisitor::repairableSubTree(Bexpression *root)
   return true;
 }
 
-bool IntegrityVisitor::repair(Bnode *node)
+bool IntegrityVisitor::repair(std::vector<Bnode *> *roots)
 {
+  // Cloning creates new nodes via the builder, which (in incremental
+  // mode) may record parent links in this visitor; hence the copy.
+  std::vector<std::pair<Bnode *, parslot> > sharing;
+  sharing.swap(sharing_);
   std::set<Bexpression *> visited;
-  for (auto &p : sharing_) {
+  for (unsigned idx = 0; idx < sharing.size(); ++idx) {
+    auto &p = sharing[idx];
     Bexpression *child = p.first->castToBexpression();
     parslot ps = p.second;
     Bnode *parent = ps.first;
     unsigned slot = ps.second;
     assert(child);
     if (visited.find(child) == visited.end()) {
-      // Repairable?
-      if (!repairableSubTree(child))
+      // Repairable? If not, describe the offending (unrepaired) records.
+      if (!repairableSubTree(child)) {
+        for (; idx < sharing.size(); ++idx)
+          if (!repairableSubTree(sharing[idx].first->castToBexpression()))
+            reportSharing(sharing[idx], roots);
         return false;
+      }
       visited.insert(child);
     }
     Bexpression *childClone = be_->nodeBuilder().cloneSubtree(child);
     parent->replaceChild(slot, childClone);
+    nparent_[childClone] = ps;
   }
   return true;
 }
 
-void IntegrityVisitor::visit(Bnode *node)
+void IntegrityVisitor::visitNodePost(Bnode *node)
 {
   unsigned idx = 0;
-  for (auto &child : node->children()) {
-    visit(child);
+  for (auto &child : node->children())
     setParent(child, node, idx++);
-  }
   Bexpression *expr = node->castToBexpression();
   if (expr) {
     idx = 0;
@@ -197,23 +295,59 @@ void IntegrityVisitor::visit(Bnode *node)
 
 bool IntegrityVisitor::examine(Bnode *node)
 {
-  // Walk the tree to see what sort of sharing we have.
-  visit(node);
+  return examine(llvm::ArrayRef<Bnode *>(node));
+}
+
+bool IntegrityVisitor::examine(llvm::ArrayRef<Bnode *> roots)
+{
+  // Walk the tree(s) to see what sort of sharing we have. Function
+  // bodies can be very deeply nested, hence the explicit stack.
+  for (Bnode *root : roots)
+    simple_walk_nodes(root, *this, ExplicitStackWalk);
 
   // Inst sharing and statement sharing are not repairable.
-  if (instShareCount_ != 0 || stmtShareCount_ != 0)
+  if (instShareCount_ != 0 || stmtShareCount_ != 0) {
+    for (auto &p : sharing_)
+      reportSharing(p, nullptr);
     return false;
+  }
 
   if (exprShareCount_ == 0)
     return true;
 
-  if (doRepairs() != RepairSharing)
+  if (doRepairs() != RepairSharing) {
+    for (auto &p : sharing_)
+      reportSharing(p, nullptr);
     return false;
+  }
 
   // Attempt repair..
-  if (repair(node))
+  if (repair(nullptr))
     return true;
 
   // Repair failed -- return failure
   return false;
 }
+
+bool IntegrityVisitor::resolveSharing(std::vector<Bnode *> &roots)
+{
+  bool rval = true;
+  if (stmtShareCount_ != 0) {
+    for (auto &p : sharing_)
+      if (p.first->isStmt())
+        reportSharing(p, &roots);
+    rval = false;
+  } else if (exprShareCount_ != 0) {
+    if (doRepairs() == RepairSharing) {
+      rval = repair(&roots);
+    } else {
+      for (auto &p : sharing_)
+        reportSharing(p, &roots);
+      rval = false;
+    }
+  }
+  sharing_.clear();
+  stmtShareCount_ = 0;
+  exprShareCount_ = 0;
+  return rval;
+}
@@ -14,8 +14,13 @@
 #ifndef LLVMGOFRONTEND_GO_LLVM_TREE_INTEGRITY_H
 #define LLVMGOFRONTEND_GO_LLVM_TREE_INTEGRITY_H
 
+#include "go-llvm-memstats.h"
+
+#include "llvm/ADT/ArrayRef.h"
 #include "llvm/Support/raw_ostream.h"
 
+#include <vector>
+
 namespace llvm {
 class Instruction;
 }
@@ -82,6 +87,15 @@ struct TreeIntegCtl {
 // restore tree integrity). This unsharing/repairing is applied only
 // to a whitelisted set of expression nodes (for example, cloning of
 // call expressions is not allowed).
+//
+// The checker can be run in two ways. The first is to invoke
+// examine() on a subtree, which walks the entire subtree from scratch.
+// The second ("incremental") mode is used by BnodeBuilder, which
+// records parent links in a single long-lived visitor as each node is
+// created (or as statements are added to blocks); any sharing
+// detected is held until the next call to resolveSharing(), at which
+// point it is repaired (if allowed/possible). This avoids re-walking
+// nested subtrees each time a new statement or block is created.
 
 class IntegrityVisitor {
  public:
@@ -91,7 +105,41 @@ class IntegrityVisitor {
         instShareCount_(0), stmtShareCount_(0), exprShareCount_(0) { }
 
   bool examine(Bnode *n);
+
+  // Examine several trees as one (sharing between them is detected).
+  bool examine(llvm::ArrayRef<Bnode *> roots);
+
   std::string msg() { return ss_.str(); }
+  void clearMsg() { ss_.flush(); str_.clear(); }
+
+  // Incremental mode: returns true if sharing has been recorded since
+  // the last call to resolveSharing().
+  bool sharingPending() const { return !sharing_.empty(); }
+
+  // Returns true if statement sharing (which is never repairable) has
+  // been recorded by examine(), or in incremental mode since the last
+  // call to resolveSharing().
+  bool stmtSharingPending() const { return stmtShareCount_ != 0; }
+
+  // Incremental mode: repair any sharing recorded since the last call
+  // (if permitted), then reset. Returns false if some of the sharing
+  // was unrepairable, in which case msg() describes it and 'roots'
+  // receives the roots of the trees holding the original parent of
+  // each offending node.
+  bool resolveSharing(std::vector<Bnode *> &roots);
+
+  // Drop any parent info recorded for 'parent' and its children (along
+  // with pending sharing involving them); used when statements are
+  // freed, so that stale entries aren't mistaken for sharing if a node
+  // is later allocated at the same address.
+  void forgetParent(Bnode *parent);
+
+  // Number of nodes for which parent info is currently recorded, and
+  // the (estimated) memory used to do so.
+  size_t parentEntries() const { return nparent_.size(); }
+  size_t parentBytes() const {
+    return hashTableBytes(nparent_) + hashTableBytes(iparent_);
+  }
 
  private:
   Llvm_backend *be_;
@@ -107,12 +155,18 @@ class IntegrityVisitor {
   unsigned exprShareCount_;
 
  private:
-  bool repair(Bnode *n);
-  void visit(Bnode *n);
+  bool repair(std::vector<Bnode *> *roots);
+  void reportSharing(const std::pair<Bnode *, parslot> &share,
+                     std::vector<Bnode *> *roots);
+  Bnode *rootOf(Bnode *node);
+  void visitNodePre(Bnode *n) { }
+  void visitNodePost(Bnode *n);
   bool repairableSubTree(Bexpression *root);
   bool shouldBeTracked(Bnode *child);
   void unsetParent(Bnode *child, Bnode *parent, unsigned slot);
   void setParent(Bnode *child, Bnode *parent, unsigned slot);
+  void reparent(Bnode *oldchild, Bnode *newchild,
+                Bnode *parent, unsigned slot);
   void setParent(llvm::Instruction *inst, Bexpression *par, unsigned slot);
   void dumpTag(const char *tag, void *ptr);
   void dump(llvm::Instruction *inst);
@@ -122,6 +176,7 @@ class IntegrityVisitor {
   CkTreeRepairDisp doRepairs() const { return control_.repairDisp; }
 
   friend BnodeBuilder;
+  template<class Visitor> friend class SimpleNodeWalker;
 };
 
 #endif // LLVMGOFRONTEND_GO_LLVM_TREE_INTEGRITY_H
@@ -15,6 +15,7 @@
 #include "go-llvm-dibuildhelper.h"
 #include "go-llvm-bexpression.h"
 #include "go-llvm-cabi-oracle.h"
+#include "go-llvm-memstats.h"
 
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/IR/Constants.h"
@@ -23,6 +24,8 @@
 #include "llvm/IR/DIBuilder.h"
 #include "llvm/IR/Type.h"
 
+#include <memory>
+
 TypeManager::TypeManager(llvm::LLVMContext &context, llvm::CallingConv::ID conv)
     : context_(context)
     , datalayout_(nullptr)
@@ -76,16 +79,12 @@ TypeManager::TypeManager(llvm::LLVMContext &context, llvm::CallingConv::ID conv)
 
 TypeManager::~TypeManager()
 {
-  for (auto &t : anonTypes_)
-    delete t;
-  for (auto &t : placeholders_)
-    delete t;
-  for (auto &t : duplicates_)
-    delete t;
-  for (auto &kv : auxTypeMap_)
-    delete kv.second;
-  for (auto &t : namedTypes_)
-    delete t;
+  // Storage for the types themselves is released along with the arena.
+  for (auto &t : allTypes_)
+    t->~Btype();
+  for (auto &fields : allFields_)
+    for (auto &f : fields)
+      f.~Btyped_identifier();
 }
 
 void TypeManager::initializeTypeManager(Bexpression *errorExpression,
@@ -127,9 +126,15 @@ void TypeManager::reinstallAnonType(Btype *typ)
 {
   auto it = anonTypes_.find(typ);
   if (it != anonTypes_.end()) {
-    // type already exists -- take the type we were intending to
-    // install in anonTypes_ and record as duplicate.
-    duplicates_.insert(typ);
+    // type already exists -- the type we were intending to install
+    // in anonTypes_ is now a duplicate. The duplicate can't be
+    // discarded (there may be outstanding references to it), so
+    // forward it to the existing type; types built from it (via
+    // pointerType, arrayType, etc) will then unify with types built
+    // from the existing type.
+    Btype *existing = *it;
+    assert(existing->canonical() == existing);
+    typ->setCanonical(existing);
     return;
   }
   anonTypes_.insert(typ);
@@ -149,6 +154,7 @@ void TypeManager::updatePlaceholderUnderlyingType(Btype *pht,
   assert(pht->isPlaceholder());
 
   // make changes
+  invalidateTypeCaches(pht);
   pht->setType(newtyp->type());
   if (! newtyp->isPlaceholder())
     pht->setPlaceholder(false);
@@ -182,8 +188,8 @@ BFunctionType *TypeManager::makeAuxFcnType(llvm::FunctionType *ft)
   Location loc;
   bool followsCabi = false;
   BFunctionType *rval =
-      new BFunctionType(recvTyp, params, results, rbtype, ft,
-                        followsCabi, loc);
+      makeType<BFunctionType>(recvTyp, params, results, rbtype, ft,
+                              followsCabi, loc);
   auxTypeMap_[ft] = rval;
   return rval;
 }
@@ -195,7 +201,7 @@ Btype *TypeManager::makeAuxType(llvm::Type *lt) {
   if (it != auxTypeMap_.end())
     return it->second;
   Location loc;
-  Btype *rval = new Btype(Btype::AuxT, lt, loc);
+  Btype *rval = makeType<Btype>(Btype::AuxT, lt, loc);
   auxTypeMap_[lt] = rval;
   return rval;
 }
@@ -247,7 +253,7 @@ Btype *TypeManager::floatType(int bits)
   }
 
   // Install in cache
-  BFloatType *rval = new BFloatType(bits, llft, loc);
+  BFloatType *rval = makeType<BFloatType>(bits, llft, loc);
   anonTypes_.insert(rval);
   return rval;
 }
@@ -299,7 +305,7 @@ Btype *TypeManager::integerType(bool is_unsigned, int bits)
   }
 
   // Install in cache
-  BIntegerType *rval = new BIntegerType(is_unsigned, bits, llit, loc);
+  BIntegerType *rval = makeType<BIntegerType>(is_unsigned, bits, llit, loc);
   anonTypes_.insert(rval);
   return rval;
 }
@@ -327,6 +333,19 @@ TypeManager::makeLLVMStructType(const std::vector<Btyped_identifier> &fields) {
   return lst;
 }
 
+// Record the fact that 'referrer' refers to the unresolved
+// placeholder 'target'. A given referrer may wind up recorded more
+// than once (ex: a struct with several fields of the same type, or a
+// placeholder pointer redirected more than once); the resolver
+// tolerates this, but we weed out the common consecutive case here.
+
+void TypeManager::addPlaceholderRef(Btype *target, Btype *referrer)
+{
+  llvm::SmallVectorImpl<Btype *> &refs = placeholderRefs_[target];
+  if (refs.empty() || refs.back() != referrer)
+    refs.push_back(referrer);
+}
+
 bool TypeManager::addPlaceholderRefs(Btype *btype)
 {
   bool rval = false;
@@ -334,7 +353,7 @@ bool TypeManager::addPlaceholderRefs(Btype *btype)
     case Btype::ArrayT: {
       BArrayType *bat = btype->castToBArrayType();
       if (bat->elemType()->isUnresolvedPlaceholder()) {
-        placeholderRefs_[bat->elemType()].insert(btype);
+        addPlaceholderRef(bat->elemType(), btype);
         rval = true;
       }
       break;
@@ -342,17 +361,17 @@ bool TypeManager::addPlaceholderRefs(Btype *btype)
     case Btype::PointerT: {
       BPointerType *bpt = btype->castToBPointerType();
       if (bpt->toType()->isUnresolvedPlaceholder()) {
-        placeholderRefs_[bpt->toType()].insert(btype);
+        addPlaceholderRef(bpt->toType(), btype);
         rval = true;
       }
       break;
     }
     case Btype::StructT: {
       BStructType *bst = btype->castToBStructType();
-      const std::vector<Backend::Btyped_identifier> &fields = bst->fields();
+      llvm::ArrayRef<Backend::Btyped_identifier> fields = bst->fields();
       for (unsigned i = 0; i < fields.size(); ++i) {
         if (fields[i].btype->isUnresolvedPlaceholder()) {
-          placeholderRefs_[fields[i].btype].insert(bst);
+          addPlaceholderRef(fields[i].btype, bst);
           rval = true;
         }
       }
@@ -403,7 +422,7 @@ Btype *TypeManager::structType(const std::vector<Btyped_identifier> &rawfields)
     // create a concrete LLVM type, so manufacture a placeholder
     // instead.
     llst = makeOpaqueLlvmType("IPST");
-    rval = new BStructType(fields, llst, loc);
+    rval = makeType<BStructType>(allocFields(fields), llst, loc);
     rval->setPlaceholder(addPlaceholderRefs(rval));
   } else {
     // No placeholder fields -- manufacture the concrete LLVM, then
@@ -416,7 +435,7 @@ Btype *TypeManager::structType(const std::vector<Btyped_identifier> &rawfields)
       assert(existing->castToBStructType());
       return existing;
     }
-    rval = new BStructType(fields, llst, loc);
+    rval = makeType<BStructType>(allocFields(fields), llst, loc);
   }
 
   if (traceLevel() > 1) {
@@ -442,7 +461,7 @@ llvm::Type *TypeManager::makeOpaqueLlvmType(const char *tag) {
 Btype *TypeManager::placeholderStructType(const std::string &name,
                                           Location location)
 {
-  BStructType *pst = new BStructType(name, location);
+  BStructType *pst = makeType<BStructType>(name, location);
   llvm::Type *opaque = makeOpaqueLlvmType("PST");
   pst->setType(opaque);
   placeholders_.insert(pst);
@@ -496,7 +515,7 @@ Btype *TypeManager::pointerType(Btype *toType)
   }
 
   // Create new type
-  BPointerType *rval = new BPointerType(toType, llpt, loc);
+  BPointerType *rval = makeType<BPointerType>(toType, llpt, loc);
   rval->setPlaceholder(addPlaceholderRefs(rval));
   if (traceLevel() > 1) {
     std::cerr << "\n^ pointer type "
@@ -524,7 +543,7 @@ Btype *TypeManager::placeholderPointerType(const std::string &name,
                                            Location location,
                                            bool forfunc)
 {
-  Btype *ppt = new BPointerType(name, location);
+  Btype *ppt = makeType<BPointerType>(name, location);
   llvm::Type *opaque = makeOpaqueLlvmType("PPT");
   llvm::PointerType *pto = llvm::PointerType::get(opaque, addressSpace_);
   ppt->setType(pto);
@@ -532,6 +551,44 @@ Btype *TypeManager::placeholderPointerType(const std::string &name,
   return ppt;
 }
 
+// A function type's classification can be reused only once all of the
+// types it passes or returns by value have a layout. Note that a
+// struct with a placeholder somewhere inside it (not necessarily at
+// the top level) doesn't make the function type itself a placeholder,
+// but its LLVM type is still opaque (unsized).
+
+static bool hasFinalLayout(Btype *btype)
+{
+  llvm::Type *typ = btype->type();
+  return typ->isVoidTy() || typ->isSized();
+}
+
+CABIOracle *TypeManager::abiOracle(BFunctionType *ft,
+                                   std::unique_ptr<CABIOracle> *owned)
+{
+  assert(owned);
+  auto it = abiOracles_.find(ft);
+  if (it != abiOracles_.end()) {
+    abiOracleStats_.hits += 1;
+    return it->second.get();
+  }
+
+  bool cacheable = !ft->isPlaceholder() && hasFinalLayout(ft->resultType());
+  for (auto pt : ft->paramTypes())
+    if (!hasFinalLayout(pt))
+      cacheable = false;
+
+  CABIOracle *rval = new CABIOracle(ft, this);
+  if (cacheable) {
+    abiOracleStats_.misses += 1;
+    abiOracles_[ft].reset(rval);
+  } else {
+    abiOracleStats_.uncached += 1;
+    owned->reset(rval);
+  }
+  return rval;
+}
+
 llvm::Type *
 TypeManager::makeLLVMFunctionType(const std::vector<Btype *> &paramTypes,
                                   Btype *rbtype,
@@ -615,28 +672,28 @@ TypeManager::functionType(const Btyped_identifier &receiver,
 
   // Manufacture new BFunctionType to return
   BFunctionType *rval =
-      new BFunctionType(receiver.btype, paramTypes, resultTypes,
-                        rbtype, llft, followsCabi, location);
+      makeType<BFunctionType>(receiver.btype, paramTypes, resultTypes,
+                              rbtype, llft, followsCabi, location);
 
   // Do some book-keeping
   bool isPlace = false;
   if (result_struct && result_struct->isUnresolvedPlaceholder()) {
-    placeholderRefs_[result_struct].insert(rval);
+    addPlaceholderRef(result_struct, rval);
     isPlace = true;
   }
   if (receiver.btype && receiver.btype->isUnresolvedPlaceholder()) {
-    placeholderRefs_[receiver.btype].insert(rval);
+    addPlaceholderRef(receiver.btype, rval);
     isPlace = true;
   }
   for (auto p : paramTypes) {
     if (p->isUnresolvedPlaceholder()) {
-      placeholderRefs_[p].insert(rval);
+      addPlaceholderRef(p, rval);
       isPlace = true;
     }
   }
   for (auto r : resultTypes) {
     if (r->isUnresolvedPlaceholder()) {
-      placeholderRefs_[r].insert(rval);
+      addPlaceholderRef(r, rval);
       isPlace = true;
     }
   }
@@ -676,7 +733,7 @@ Btype *TypeManager::arrayType(Btype *elemType, Bexpression *length)
   }
 
   // Create appropriate Btype
-  BArrayType *rval = new BArrayType(elemType, length, llat, loc);
+  BArrayType *rval = makeType<BArrayType>(elemType, length, llat, loc);
   rval->setPlaceholder(addPlaceholderRefs(rval));
 
   if (traceLevel() > 1) {
@@ -698,7 +755,7 @@ Btype *TypeManager::arrayType(Btype *elemType, Bexpression *length)
 Btype *TypeManager::placeholderArrayType(const std::string &name,
                                          Location location)
 {
-  Btype *pat = new BArrayType(name, location);
+  Btype *pat = makeType<BArrayType>(name, location);
   llvm::Type *opaque = makeOpaqueLlvmType("PAT");
   pat->setType(opaque);
   placeholders_.insert(pat);
@@ -729,7 +786,7 @@ Btype *TypeManager::elementTypeByIndex(Btype *btype, unsigned fieldIndex)
   return at->elemType();
 }
 
-void TypeManager::postProcessResolvedPointerPlaceholder(BPointerType *bpt,
+bool TypeManager::postProcessResolvedPointerPlaceholder(BPointerType *bpt,
                                                         Btype *btype)
 {
   assert(bpt);
@@ -753,16 +810,16 @@ void TypeManager::postProcessResolvedPointerPlaceholder(BPointerType *bpt,
   if (wasHashed)
     reinstallAnonType(bpt);
 
-  postProcessResolvedPlaceholder(bpt);
+  return true;
 }
 
-void TypeManager::postProcessResolvedStructPlaceholder(BStructType *bst,
+bool TypeManager::postProcessResolvedStructPlaceholder(BStructType *bst,
                                                         Btype *btype)
 {
   assert(bst);
   assert(bst->isPlaceholder());
 
-  std::vector<Btyped_identifier> fields(bst->fields());
+  llvm::ArrayRef<Btyped_identifier> fields = bst->fields();
   bool hasPl = false;
   for (unsigned i = 0; i < fields.size(); ++i) {
     const Btype *ft = fields[i].btype;
@@ -776,27 +833,26 @@ void TypeManager::postProcessResolvedStructPlaceholder(BStructType *bst,
       hasPl = true;
     }
   }
-  if (! hasPl) {
+  if (hasPl)
+    return false;
 
-    // No need to unhash the type -- we can simple update it in place.
-    llvm::SmallVector<llvm::Type *, 64> elems(fields.size());
-    for (unsigned i = 0; i < fields.size(); ++i)
-      elems[i] = fields[i].btype->type();
-    llvm::StructType *llst = llvm::cast<llvm::StructType>(bst->type());
-    llst->setBody(elems);
-    bst->setPlaceholder(false);
-
-    if (traceLevel() > 1) {
-      std::cerr << "\n^ resolving placeholder struct type "
-                << ((void*)bst) << " to concrete struct type:\n";
-      bst->dump();
-    }
+  // No need to unhash the type -- we can simple update it in place.
+  llvm::SmallVector<llvm::Type *, 64> elems(fields.size());
+  for (unsigned i = 0; i < fields.size(); ++i)
+    elems[i] = fields[i].btype->type();
+  llvm::StructType *llst = llvm::cast<llvm::StructType>(bst->type());
+  llst->setBody(elems);
+  bst->setPlaceholder(false);
 
-    postProcessResolvedPlaceholder(bst);
+  if (traceLevel() > 1) {
+    std::cerr << "\n^ resolving placeholder struct type "
+              << ((void*)bst) << " to concrete struct type:\n";
+    bst->dump();
   }
+  return true;
 }
 
-void TypeManager::postProcessResolvedArrayPlaceholder(BArrayType *bat,
+bool TypeManager::postProcessResolvedArrayPlaceholder(BArrayType *bat,
                                                        Btype *btype)
 {
   assert(bat);
@@ -824,10 +880,10 @@ void TypeManager::postProcessResolvedArrayPlaceholder(BArrayType *bat,
   if (wasHashed)
     reinstallAnonType(bat);
 
-  postProcessResolvedPlaceholder(bat);
+  return true;
 }
 
-void TypeManager::postProcessResolvedFunctionPlaceholder(BFunctionType *bft,
+bool TypeManager::postProcessResolvedFunctionPlaceholder(BFunctionType *bft,
                                                          Btype *btype)
 {
   assert(bft);
@@ -854,7 +910,51 @@ void TypeManager::postProcessResolvedFunctionPlaceholder(BFunctionType *bft,
   if (wasHashed)
     reinstallAnonType(bft);
 
-  postProcessResolvedPlaceholder(bft);
+  return true;
+}
+
+std::string TypeManager::typeManagerStatistics() const
+{
+  unsigned nrefs = 0;
+  size_t refBytes = placeholderRefs_.getMemorySize();
+  for (auto &kv : placeholderRefs_) {
+    nrefs += kv.second.size();
+    if (!kv.second.isSmall())
+      refBytes += kv.second.capacity_in_bytes();
+  }
+  size_t stringBytes = typToStringCache_.getMemorySize();
+  for (auto &kv : typToStringCache_)
+    stringBytes += kv.second.capacity();
+  size_t arenaBytes = typeArena_.getTotalMemory() + vectorBytes(allTypes_) +
+      vectorBytes(allFields_);
+  size_t tableBytes = anonTypes_.getMemorySize() +
+      hashTableBytes(namedTypes_) + hashTableBytes(placeholders_) +
+      auxTypeMap_.getMemorySize() + refBytes +
+      layoutCache_.getMemorySize() + stringBytes +
+      abiOracles_.getMemorySize() +
+      abiOracles_.size() * sizeof(CABIOracle);
+  std::stringstream ss;
+  ss << "anonTypes=" << anonTypes_.size()
+     << " namedTypes=" << namedTypes_.size()
+     << " placeholders=" << placeholders_.size()
+     << " placeholderRefs=" << placeholderRefs_.size()
+     << " (" << nrefs << " refs)"
+     << " auxTypes=" << auxTypeMap_.size()
+     << " abiOracles=" << abiOracles_.size()
+     << " (" << abiOracleStats_.hits << " hits "
+     << abiOracleStats_.misses << " misses "
+     << abiOracleStats_.uncached << " uncached)"
+     << " allTypes=" << allTypes_.size()
+     << " typeArenaBytes=" << arenaBytes
+     << " layoutCache=" << layoutCache_.size()
+     << " typeStrings=" << typToStringCache_.size()
+     << " resolveWaves=" << phStats_.waves
+     << " resolvedTypes=" << phStats_.resolved
+     << " resolveVisits=" << phStats_.visits
+     << " maxResolveWorklist=" << phStats_.maxWorklist
+     << " tableBytes=" << tableBytes
+     << " bytes=" << (arenaBytes + tableBytes);
+  return ss.str();
 }
 
 // When one of the "set_placeholder_*_type()" methods is called to
@@ -868,47 +968,61 @@ void TypeManager::postProcessResolvedFunctionPlaceholder(BFunctionType *bft,
 // changes we need to unhash it (remove it from the table), then apply
 // the changes, then add it back into the table. During the addition,
 // the new type may collide with some other existing type in the
-// table. If this happens, we record the type in the separate
-// placeholders_ set, so as to make sure we can delete it at the end
-// of the compilation (this is managed by reinstallAnonType).
+// table. If this happens, the colliding type is simply left out of
+// the table (this is managed by reinstallAnonType).
+//
+// Resolution proceeds as a "wave" driven by an explicit worklist of
+// newly resolved types (as opposed to recursing on the C++ stack,
+// which gets very deep for large recursive type graphs). Each
+// referring type is resolved at most once; once a type has been
+// resolved, its list of referrers is no longer needed and is
+// discarded.
 //
 void TypeManager::postProcessResolvedPlaceholder(Btype *btype)
 {
-  auto it = placeholderRefs_.find(btype);
-  if (it == placeholderRefs_.end())
-    return;
+  phStats_.waves += 1;
+  std::vector<Btype *> worklist;
+  worklist.push_back(btype);
 
-  for (auto refType : it->second) {
+  while (! worklist.empty()) {
+    Btype *resolved = worklist.back();
+    worklist.pop_back();
+    invalidateTypeCaches(resolved);
 
-    if (!refType->isPlaceholder())
+    auto it = placeholderRefs_.find(resolved);
+    if (it == placeholderRefs_.end())
       continue;
 
-    BPointerType *bpt = refType->castToBPointerType();
-    if (bpt) {
-      postProcessResolvedPointerPlaceholder(bpt, btype);
-      continue;
-    }
-
-    BArrayType *bat = refType->castToBArrayType();
-    if (bat) {
-      postProcessResolvedArrayPlaceholder(bat, btype);
-      continue;
-    }
-
-    BStructType *bst = refType->castToBStructType();
-    if (bst) {
-      postProcessResolvedStructPlaceholder(bst, btype);
-      continue;
-    }
-
-    BFunctionType *bft = refType->castToBFunctionType();
-    if (bft) {
-      postProcessResolvedFunctionPlaceholder(bft, btype);
-      continue;
+    // Take ownership of the referrer list before visiting it, since
+    // resolving a referrer may create new types (and thus add
+    // entries to the table).
+    llvm::SmallVector<Btype *, 4> refs(std::move(it->second));
+    placeholderRefs_.erase(it);
+
+    for (auto refType : refs) {
+      phStats_.visits += 1;
+      if (!refType->isPlaceholder())
+        continue;
+
+      bool done = false;
+      if (BPointerType *bpt = refType->castToBPointerType())
+        done = postProcessResolvedPointerPlaceholder(bpt, resolved);
+      else if (BArrayType *bat = refType->castToBArrayType())
+        done = postProcessResolvedArrayPlaceholder(bat, resolved);
+      else if (BStructType *bst = refType->castToBStructType())
+        done = postProcessResolvedStructPlaceholder(bst, resolved);
+      else if (BFunctionType *bft = refType->castToBFunctionType())
+        done = postProcessResolvedFunctionPlaceholder(bft, resolved);
+      else
+        assert(false); // Should never get here
+
+      if (done) {
+        phStats_.resolved += 1;
+        worklist.push_back(refType);
+      }
     }
-
-    // Should never get here
-    assert(false);
+    if (worklist.size() > phStats_.maxWorklist)
+      phStats_.maxWorklist = worklist.size();
   }
 }
 
@@ -941,6 +1055,7 @@ bool TypeManager::setPlaceholderPointerType(Btype *placeholder,
   }
 
   // Update the target type for the pointer
+  invalidateTypeCaches(placeholder);
   BPointerType *bpt = placeholder->castToBPointerType();
   bpt->setToType(to_type);
   bpt->setType(to_type->type());
@@ -949,7 +1064,7 @@ bool TypeManager::setPlaceholderPointerType(Btype *placeholder,
   if (to_type->isUnresolvedPlaceholder()) {
     // We're redirecting this type to another placeholder -- delay the
     // creation of the final LLVM type and record the reference.
-    placeholderRefs_[to_type].insert(placeholder);
+    addPlaceholderRef(to_type, placeholder);
   } else {
     // The target is a concrete type. Reset the placeholder flag on
     // this type, then call a helper to update any other types that
@@ -1022,7 +1137,8 @@ TypeManager::setPlaceholderStructType(Btype *placeholder,
   assert(placeholders_.find(placeholder) != placeholders_.end());
   BStructType *phst = placeholder->castToBStructType();
   assert(phst);
-  phst->setFields(fields);
+  invalidateTypeCaches(phst);
+  phst->setFields(allocFields(fields));
 
   // If we still have fields with placeholder types, then we still can't
   // manufacture a concrete LLVM type. If no placeholders, then we can
@@ -1099,6 +1215,56 @@ bool TypeManager::setPlaceholderArrayType(Btype *placeholder,
   return true;
 }
 
+// Create a shallow copy of a type (including its name and
+// placeholder status) in the type arena. A struct type's clone shares
+// the original's field array (fields are replaced, never updated in
+// place). The clone is a distinct type, so it is not forwarded to
+// anything even if the original is.
+
+Btype *TypeManager::cloneType(Btype *btype)
+{
+  Btype *rval = nullptr;
+  switch(btype->flavor()) {
+    case Btype::AuxT:
+      rval = makeType<Btype>(*btype);
+      break;
+    case Btype::FloatT:
+      rval = makeType<BFloatType>(*btype->castToBFloatType());
+      break;
+    case Btype::IntegerT:
+      rval = makeType<BIntegerType>(*btype->castToBIntegerType());
+      break;
+    case Btype::PointerT:
+      rval = makeType<BPointerType>(*btype->castToBPointerType());
+      break;
+    case Btype::ArrayT:
+      rval = makeType<BArrayType>(*btype->castToBArrayType());
+      break;
+    case Btype::StructT:
+      rval = makeType<BStructType>(*btype->castToBStructType());
+      break;
+    case Btype::FunctionT:
+      rval = makeType<BFunctionType>(*btype->castToBFunctionType());
+      break;
+  }
+  assert(rval && "unknown type flavor");
+  rval->setCanonical(nullptr);
+  return rval;
+}
+
+llvm::MutableArrayRef<Backend::Btyped_identifier>
+TypeManager::allocFields(llvm::ArrayRef<Btyped_identifier> fields)
+{
+  if (fields.empty())
+    return llvm::MutableArrayRef<Btyped_identifier>();
+  Btyped_identifier *mem =
+      typeArena_.Allocate<Btyped_identifier>(fields.size());
+  std::uninitialized_copy(fields.begin(), fields.end(), mem);
+  llvm::MutableArrayRef<Btyped_identifier> rval(mem, fields.size());
+  allFields_.push_back(rval);
+  return rval;
+}
+
 // Return a named version of a type.
 
 Btype *TypeManager::namedType(const std::string &name,
@@ -1107,12 +1273,13 @@ Btype *TypeManager::namedType(const std::string &name,
 {
   // TODO: add support for debug metadata
 
-  Btype *rval = btype->clone();
+  Btype *rval = cloneType(btype);
   rval->setLocation(location);
   addPlaceholderRefs(rval);
   rval->setName(name);
   namedTypes_.insert(rval);
   revNames_[btype] = rval;
+  typToStringCache_.clear();
 
   if (traceLevel() > 1) {
     std::cerr << "\n^ named type '" << name << "' "
@@ -1243,7 +1410,7 @@ llvm::Type *TypeManager::placeholderProxyType(Btype *typ,
     }
     case Btype::StructT: {
       BStructType *bst = typ->castToBStructType();
-      const std::vector<Backend::Btyped_identifier> &fields = bst->fields();
+      llvm::ArrayRef<Backend::Btyped_identifier> fields = bst->fields();
       llvm::SmallVector<llvm::Type *, 64> elems(fields.size());
       for (unsigned i = 0; i < fields.size(); ++i) {
         llvm::Type *ft = placeholderProxyType(fields[i].btype, pmap);
@@ -1275,6 +1442,36 @@ llvm::Type *TypeManager::placeholderProxyType(Btype *typ,
   return nullptr;
 }
 
+// Returns the memoized layout info for a type, computing it if need
+// be, or null if the type doesn't yet have a sized LLVM type (an
+// unresolved placeholder, for example). Once a type's LLVM type is
+// sized, its size and alignment won't change; entries are nonetheless
+// dropped when a placeholder is updated (see invalidateTypeCaches).
+
+TypeManager::TypeLayoutInfo *TypeManager::layoutInfo(Btype *btype)
+{
+  auto it = layoutCache_.find(btype);
+  if (it != layoutCache_.end())
+    return &it->second;
+  if (!btype->type()->isSized())
+    return nullptr;
+  TypeLayoutInfo &info = layoutCache_[btype];
+  info.size = datalayout_->getTypeAllocSize(btype->type());
+  info.align = datalayout_->getPrefTypeAlignment(btype->type());
+  info.fieldAlign = 0;
+  return &info;
+}
+
+// Discard any memoized info for a type that is being updated. The
+// stringified types are simply flushed, since a type's string
+// incorporates the strings (and names) of the types it refers to.
+
+void TypeManager::invalidateTypeCaches(Btype *btype)
+{
+  layoutCache_.erase(btype);
+  typToStringCache_.clear();
+}
+
 // Return the size of a type.
 
 // Note: frontend sometimes asks for the size of a placeholder
@@ -1287,13 +1484,12 @@ int64_t TypeManager::typeSize(Btype *btype) {
   if (btype == errorType_)
     return 1;
 
-  llvm::Type *toget = btype->type();
-  llvm::SmallPtrSet<llvm::Type *, 32> vis;
-  if (!btype->type()->isSized(&vis)) {
-    pproxymap pmap;
-    toget = placeholderProxyType(btype, &pmap);
-    assert(toget);
-  }
+  if (TypeLayoutInfo *info = layoutInfo(btype))
+    return info->size;
+
+  pproxymap pmap;
+  llvm::Type *toget = placeholderProxyType(btype, &pmap);
+  assert(toget);
 
   uint64_t uvalbytes = datalayout_->getTypeAllocSize(toget);
   return static_cast<int64_t>(uvalbytes);
@@ -1304,6 +1500,8 @@ int64_t TypeManager::typeSize(Btype *btype) {
 int64_t TypeManager::typeAlignment(Btype *btype) {
   if (btype == errorType_)
     return 1;
+  if (TypeLayoutInfo *info = layoutInfo(btype))
+    return info->align;
   unsigned uval = datalayout_->getPrefTypeAlignment(btype->type());
   return static_cast<int64_t>(uval);
 }
@@ -1317,8 +1515,13 @@ int64_t TypeManager::typeAlignment(Btype *btype) {
 
 int64_t TypeManager::typeFieldAlignment(Btype *btype) {
   // Corner cases.
-  if (!btype->type()->isSized() || btype == errorType_)
+  if (btype == errorType_)
+    return -1;
+  TypeLayoutInfo *info = layoutInfo(btype);
+  if (!info)
     return -1;
+  if (info->fieldAlign != 0)
+    return info->fieldAlign;
 
   // Create a new anonymous struct with two fields: first field is a
   // single byte, second field is of type btype. Then use
@@ -1331,9 +1534,9 @@ int64_t TypeManager::typeFieldAlignment(Btype *btype) {
   llvm::StructType *dummyst = llvm::StructType::get(context_, elems);
   const llvm::StructLayout *sl = datalayout_->getStructLayout(dummyst);
   uint64_t uoff = sl->getElementOffset(1);
-  unsigned talign = datalayout_->getPrefTypeAlignment(btype->type());
-  int64_t rval = (uoff < talign ? uoff : talign);
-  return rval;
+  uint64_t talign = static_cast<uint64_t>(info->align);
+  info->fieldAlign = static_cast<int64_t>(uoff < talign ? uoff : talign);
+  return info->fieldAlign;
 }
 
 // Return the offset of a field in a struct.
@@ -1422,8 +1625,13 @@ bool TypeManager::isPtrToArrayOf(llvm::Type *typ, llvm::Type *arElmTyp)
 
 std::string TypeManager::typToString(Btype *typ)
 {
+  auto it = typToStringCache_.find(typ);
+  if (it != typToStringCache_.end())
+    return it->second;
   std::map<Btype *, std::string> smap;
-  return typToStringRec(typ, smap);
+  std::string rval = typToStringRec(typ, smap);
+  typToStringCache_[typ] = rval;
+  return rval;
 }
 
 std::string
@@ -1480,7 +1688,7 @@ TypeManager::typToStringRec(Btype *typ, std::map<Btype *, std::string> &smap)
       smap[typ] = sst.str();
 
       ss << "struct{";
-      const std::vector<Backend::Btyped_identifier> &fields = bst->fields();
+      llvm::ArrayRef<Backend::Btyped_identifier> fields = bst->fields();
       for (unsigned i = 0; i < fields.size(); ++i) {
         ss << (i == 0 ? "" : ",");
         ss << typToStringRec(fields[i].btype, smap);
@@ -1574,8 +1782,8 @@ llvm::DIType *TypeManager::buildStructDIType(BStructType *bst,
 
   // Process struct members
   llvm::SmallVector<llvm::Metadata *, 16> members;
-  const std::vector<Backend::Btyped_identifier> &fields = bst->fields();
-  for (unsigned fidx = 0; fidx < bst->fields().size(); ++fidx) {
+  llvm::ArrayRef<Backend::Btyped_identifier> fields = bst->fields();
+  for (unsigned fidx = 0; fidx < fields.size(); ++fidx) {
     const Backend::Btyped_identifier &field = fields[fidx];
     llvm::DIType *fieldType = buildDIType(field.btype, helper);
     uint64_t memberBits = typeSize(field.btype);
@@ -21,7 +21,11 @@
 #include "namegen.h"
 #include "backend.h"
 
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/SmallVector.h"
 #include "llvm/IR/CallingConv.h"
+#include "llvm/Support/Allocator.h"
 
 namespace llvm {
 class DataLayout;
@@ -34,6 +38,7 @@ class raw_ostream;
 class FunctionType;
 }
 
+class CABIOracle;
 class DIBuildHelper;
 
 using Btyped_identifier = Backend::Btyped_identifier;
@@ -160,16 +165,18 @@ class TypeManager {
   // and see if we can completely resolve them.
   void postProcessResolvedPlaceholder(Btype *btype);
 
-  // Helpers for the routine above
-  void postProcessResolvedPointerPlaceholder(BPointerType *bpt, Btype *btype);
-  void postProcessResolvedStructPlaceholder(BStructType *bst, Btype *btype);
-  void postProcessResolvedArrayPlaceholder(BArrayType *bat, Btype *btype);
-  void postProcessResolvedFunctionPlaceholder(BFunctionType *bft, Btype *btype);
+  // Helpers for the routine above. Each returns true if the referring
+  // type in question is now fully resolved.
+  bool postProcessResolvedPointerPlaceholder(BPointerType *bpt, Btype *btype);
+  bool postProcessResolvedStructPlaceholder(BStructType *bst, Btype *btype);
+  bool postProcessResolvedArrayPlaceholder(BArrayType *bat, Btype *btype);
+  bool postProcessResolvedFunctionPlaceholder(BFunctionType *bft, Btype *btype);
 
   // For a newly create type, adds entries to the placeholderRefs
   // table for any contained types. Returns true if any placeholders
   // found.
   bool addPlaceholderRefs(Btype *type);
+  void addPlaceholderRef(Btype *target, Btype *referrer);
 
   // Helpers
   bool isFuncDescriptorType(llvm::Type *typ);
@@ -200,6 +207,16 @@ class TypeManager {
   // Calling convention
   llvm::CallingConv::ID callingConv() const { return cconv_; }
 
+  // Returns a C ABI oracle for the specified function type. Oracles
+  // are memoized per function type, so that the function definition
+  // and all of the call sites for a given signature share the results
+  // of a single classification; such oracles are owned by the type
+  // manager. If the function type can't be classified once and for
+  // all (it refers to types that have no layout yet), a new oracle is
+  // created and handed to the caller via 'owned'.
+  CABIOracle *abiOracle(BFunctionType *ft,
+                        std::unique_ptr<CABIOracle> *owned);
+
   // For named types, this returns the declared type name. If a type
   // is unnamed, then it returns a stringified representation of the
   // type (e.g, "[10]uint64").
@@ -212,6 +229,10 @@ class TypeManager {
   unsigned traceLevel() const { return traceLevel_; }
   void setTypeManagerTraceLevel(unsigned level) { traceLevel_ = level; }
 
+  // Returns a string summarizing the sizes of the type tables (for
+  // memory usage reporting).
+  std::string typeManagerStatistics() const;
+
   // for type name generation
   std::string tnamegen(const std::string &tag,
                        unsigned expl = NameGen::ChooseVer) {
@@ -234,26 +255,43 @@ class TypeManager {
   typedef std::unordered_map<Btype *, llvm::Type *> pproxymap;
   llvm::Type *placeholderProxyType(Btype *typ, pproxymap *pmap);
 
-  template <typename T1, typename T2> struct pairvalmap_hash {
-    typedef std::pair<T1, T2> pairtype;
-    unsigned int operator()(const pairtype &p) const {
-      std::size_t h1 = std::hash<T1>{}(p.first);
-      std::size_t h2 = std::hash<T2>{}(p.second);
-      return h1 + h2;
-    }
+  // Memoized size/alignment info for types with sized LLVM types.
+  // A fieldAlign value of zero indicates "not yet computed".
+  struct TypeLayoutInfo {
+    int64_t size;
+    int64_t align;
+    int64_t fieldAlign;
   };
+  TypeLayoutInfo *layoutInfo(Btype *btype);
 
-  template <typename T1, typename T2> struct pairvalmap_equal {
-    typedef std::pair<T1, T2> pairtype;
-    bool operator()(const pairtype &p1, const pairtype &p2) const {
-      return (p1.first == p2.first && p1.second == p2.second);
-    }
-  };
+  // Drop memoized info for a type that is about to change.
+  void invalidateTypeCaches(Btype *btype);
+
+  // Placement-construct a new Btype in the type arena.
+  template<typename T, typename... Args>
+  T *makeType(Args&&... args) {
+    T *rval = new (typeArena_.Allocate<T>()) T(std::forward<Args>(args)...);
+    allTypes_.push_back(rval);
+    return rval;
+  }
+
+  // Shallow copy of a type (see namedType).
+  Btype *cloneType(Btype *btype);
 
-  template <typename T1, typename T2, typename V>
-  using pairvalmap =
-      std::unordered_map<std::pair<T1, T2>, V, pairvalmap_hash<T1, T2>,
-                         pairvalmap_equal<T1, T2>>;
+  // Copy a struct type's fields into the type arena.
+  llvm::MutableArrayRef<Btyped_identifier>
+  allocFields(llvm::ArrayRef<Btyped_identifier> fields);
+
+  // Btypes are not allocated individually; they live in this arena
+  // for the lifetime of the type manager. Anonymous types are
+  // hash-consed via anonTypes_ below, so structurally equal anonymous
+  // types are the same object. We keep a list of all types created so
+  // that their destructors can be run when the type manager goes away.
+  // Struct fields are stored in the arena as well (as compact arrays
+  // that may be shared between a struct type and its named clones).
+  llvm::BumpPtrAllocator typeArena_;
+  std::vector<Btype *> allTypes_;
+  std::vector<llvm::MutableArrayRef<Btyped_identifier>> allFields_;
 
   // Context information needed for the LLVM backend.
   llvm::LLVMContext &context_;
@@ -262,21 +300,30 @@ class TypeManager {
   unsigned addressSpace_;
   unsigned traceLevel_;
 
-  class btype_hash {
-  public:
-    unsigned int operator()(const Btype *t) const {
+  // Hashing/equality for anonymous types is structural (via
+  // Btype::hash and Btype::equal); the empty/tombstone keys are the
+  // usual DenseMap pointer sentinels, which must not be dereferenced.
+  struct AnonTypeInfo {
+    static Btype *getEmptyKey() {
+      return llvm::DenseMapInfo<Btype *>::getEmptyKey();
+    }
+    static Btype *getTombstoneKey() {
+      return llvm::DenseMapInfo<Btype *>::getTombstoneKey();
+    }
+    static unsigned getHashValue(const Btype *t) {
       return t->hash();
     }
-  };
-
-  class btype_equal {
-  public:
-    bool operator()(const Btype *t1, const Btype *t2) const {
+    static bool isEqual(const Btype *t1, const Btype *t2) {
+      if (t1 == t2)
+        return true;
+      if (t1 == getEmptyKey() || t1 == getTombstoneKey() ||
+          t2 == getEmptyKey() || t2 == getTombstoneKey())
+        return false;
       return t1->equal(*t2);
     }
   };
 
-  typedef std::unordered_set<Btype *, btype_hash, btype_equal> anonTypeSetType;
+  typedef llvm::DenseSet<Btype *, AnonTypeInfo> anonTypeSetType;
 
   // Anonymous typed are hashed/commoned via this set.
   anonTypeSetType anonTypes_;
@@ -284,7 +331,7 @@ class TypeManager {
   // This map stores oddball types that get created internally by the
   // back end (ex: void type, or predefined complex). Key is LLVM
   // type, value is Btype.
-  std::unordered_map<llvm::Type *, Btype *> auxTypeMap_;
+  llvm::DenseMap<llvm::Type *, Btype *> auxTypeMap_;
 
   // Repository for named types (those specifically created by the
   // ::named_type method).
@@ -297,26 +344,47 @@ class TypeManager {
   // Backend::placeholder_<XYZ>_type() method calls.
   std::unordered_set<Btype *> placeholders_;
 
-  // These types became redundant/duplicate after one or more
-  // of their placeholder children were updated.
-  std::unordered_set<Btype *> duplicates_;
-
   // For managing placeholder types. An entry [X, {A,B,C}] indicates
   // that placeholder type X is referred to by the other placeholder
-  // types A, B, and C.
-  std::unordered_map<Btype *, std::set<Btype *> > placeholderRefs_;
+  // types A, B, and C. The entry for X is dropped once X is resolved.
+  llvm::DenseMap<Btype *, llvm::SmallVector<Btype *, 4> > placeholderRefs_;
+
+  // Caches for typeSize/typeAlignment/typeFieldAlignment and for
+  // typToString, respectively.
+  llvm::DenseMap<Btype *, TypeLayoutInfo> layoutCache_;
+  llvm::DenseMap<Btype *, std::string> typToStringCache_;
+
+  // Memoized C ABI oracles (see abiOracle above).
+  llvm::DenseMap<BFunctionType *, std::unique_ptr<CABIOracle> > abiOracles_;
+  struct AbiOracleStats {
+    unsigned hits;
+    unsigned misses;
+    unsigned uncached;
+    AbiOracleStats() : hits(0), misses(0), uncached(0) { }
+  };
+  AbiOracleStats abiOracleStats_;
+
+  // Statistics on placeholder resolution.
+  struct PlaceholderStats {
+    unsigned waves;        // calls to postProcessResolvedPlaceholder
+    unsigned resolved;     // referring types resolved as a result
+    unsigned visits;       // referrer list entries examined
+    unsigned maxWorklist;  // high water mark for worklist size
+    PlaceholderStats() : waves(0), resolved(0), visits(0), maxWorklist(0) { }
+  };
+  PlaceholderStats phStats_;
 
   // Set of circular types. These are pointers to opaque types that
   // are returned by the ::circular_pointer_type() method.
-  std::unordered_set<llvm::Type *> circularPointerTypes_;
+  llvm::DenseSet<llvm::Type *> circularPointerTypes_;
 
   // Map from placeholder type to circular pointer type. Key is placeholder
   // pointer type, value is circular pointer type marker.
-  std::unordered_map<Btype *, Btype *> circularPointerTypeMap_;
+  llvm::DenseMap<Btype *, Btype *> circularPointerTypeMap_;
 
   // Maps for inserting conversions involving circular pointers.
-  std::unordered_map<Btype *, Btype *> circularConversionLoadMap_;
-  std::unordered_map<Btype *, Btype *> circularConversionAddrMap_;
+  llvm::DenseMap<Btype *, Btype *> circularConversionLoadMap_;
+  llvm::DenseMap<Btype *, Btype *> circularConversionAddrMap_;
 
   // For storing the pointers involved in a circular pointer type loop.
   // Temporary; filled in only during processing of the loop.
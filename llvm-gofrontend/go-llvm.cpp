@@ -21,8 +21,10 @@
 #include "go-llvm-dibuildhelper.h"
 #include "go-llvm-cabi-oracle.h"
 #include "go-llvm-irbuilders.h"
+#include "go-llvm-memstats.h"
 #include "gogo.h"
 
+#include "llvm/ADT/Triple.h"
 #include "llvm/Analysis/TargetLibraryInfo.h"
 #include "llvm/IR/Constants.h"
 #include "llvm/IR/DataLayout.h"
@@ -39,6 +41,8 @@
 #include "llvm/IR/Value.h"
 #include "llvm/IR/Verifier.h"
 #include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Timer.h"
+#include "llvm/Transforms/Utils/ModuleUtils.h"
 
 Llvm_backend::Llvm_backend(llvm::LLVMContext &context,
                            llvm::Module *module,
@@ -54,7 +58,7 @@ Llvm_backend::Llvm_backend(llvm::LLVMContext &context,
     , traceLevel_(0)
     , checkIntegrity_(true)
     , createDebugMetaData_(true)
-    , exportDataStarted_(false)
+    , simplifyNodes_(false)
     , exportDataFinalized_(false)
     , errorCount_(0u)
     , TLI_(nullptr)
@@ -159,6 +163,53 @@ void Llvm_backend::setTraceLevel(unsigned level)
   setTypeManagerTraceLevel(level);
 }
 
+void Llvm_backend::setDiscardValueNames(bool discard)
+{
+  setDiscardNames(discard);
+  context_.setDiscardValueNames(discard);
+}
+
+std::string Llvm_backend::statistics()
+{
+  size_t cacheBytes = valueExprmap_.getMemorySize() +
+      valueVarMap_.getMemorySize() +
+      stringConstantMap_.getNumBuckets() * sizeof(void *) +
+      stringConstantMap_.getAllocator().getTotalMemory() +
+      hashTableBytes(immutableStructRefs_) + hashTableBytes(fcnNameMap_) +
+      vectorBytes(functions_);
+  std::stringstream ss;
+  ss << "nodes: " << nbuilder_.statistics() << "\n"
+     << "types: " << typeManagerStatistics() << "\n"
+     << "caches: valueExprs=" << valueExprmap_.size()
+     << " valueVars=" << valueVarMap_.size()
+     << " stringConstants=" << stringConstantMap_.size()
+     << " immutableStructRefs=" << immutableStructRefs_.size()
+     << " fcnNames=" << fcnNameMap_.size()
+     << " functions=" << functions_.size()
+     << " bytes=" << cacheBytes << "\n"
+     << "simplify: casts=" << simplifyStats_.castChains;
+  return ss.str();
+}
+
+void Llvm_backend::enableTimers()
+{
+  if (timerGroup_)
+    return;
+  static const char *names[NumBackendTimers][2] = {
+    { "function_set_body", "Function body generation (total)" },
+    { "genblocks", "GenBlocks walk" },
+    { "tree_integrity", "Tree integrity checking" },
+    { "dibuild", "Debug meta-data generation" },
+    { "placeholder", "Placeholder type resolution" },
+    { "simplify", "Bnode simplification" }
+  };
+  timerGroup_.reset(new llvm::TimerGroup("gobackend",
+                                         "Go backend IR generation"));
+  for (unsigned idx = 0; idx < NumBackendTimers; ++idx)
+    timers_.emplace_back(new llvm::Timer(names[idx][0], names[idx][1],
+                                         *timerGroup_));
+}
+
 void
 Llvm_backend::verifyModule()
 {
@@ -209,18 +260,64 @@ Llvm_backend::checkTreeIntegrity(Bnode *n, TreeIntegCtl control)
   return std::make_pair(rval, iv.msg());
 }
 
-void Llvm_backend::enforceTreeIntegrity(Bnode *n)
+void Llvm_backend::verifyTreeIntegrity(Bnode *n,
+                                       llvm::ArrayRef<Bnode *> others)
 {
+  llvm::TimeRegion tr(timer(TreeIntegrityTimer));
   Llvm_backend *be = const_cast<Llvm_backend *>(this);
   TreeIntegCtl control(DumpPointers, IgnoreVarExprs, RepairSharing);
   IntegrityVisitor iv(be, control);
-  bool res = iv.examine(n);
+  std::vector<Bnode *> roots(1, n);
+  roots.insert(roots.end(), others.begin(), others.end());
+  bool res = iv.examine(roots);
   if (!res && checkIntegrity_) {
     std::cerr << iv.msg() << "\n";
     assert(false);
   }
 }
 
+void Llvm_backend::enforceTreeIntegrity(Bnode *n)
+{
+  if (!nbuilder_.sharingPending())
+    return;
+  bool res;
+  std::string msg;
+  std::vector<Bnode *> roots;
+  {
+    llvm::TimeRegion tr(timer(TreeIntegrityTimer));
+    res = nbuilder_.resolveSharing(msg, roots);
+  }
+  if (res || !checkIntegrity_)
+    return;
+
+  // The builder flags any node that acquires a second parent, even if
+  // the first parent is an expression that was subsequently discarded,
+  // so confirm the problem with a full walk of the new subtree along
+  // with the statements holding the original parents (expression
+  // trees not attached to any statement are assumed to be discarded).
+  std::vector<Bnode *> others;
+  for (Bnode *root : roots)
+    if (root != n && root->isStmt() &&
+        std::find(others.begin(), others.end(), root) == others.end())
+      others.push_back(root);
+  TreeIntegCtl control(DumpPointers, IgnoreVarExprs, RepairSharing);
+  IntegrityVisitor iv(this, control);
+  std::vector<Bnode *> walkRoots(1, n);
+  walkRoots.insert(walkRoots.end(), others.begin(), others.end());
+  {
+    llvm::TimeRegion tr(timer(TreeIntegrityTimer));
+    if (iv.examine(walkRoots))
+      return;
+  }
+
+  // Confirmed; report it in all builds. Statement sharing can't be
+  // repaired and would result in bad IR, so it is fatal in all builds.
+  std::cerr << iv.msg() << "\n";
+  if (iv.stmtSharingPending())
+    llvm::report_fatal_error("statement has multiple parents");
+  assert(false && "unrepairable expression sharing");
+}
+
 Btype *Llvm_backend::error_type() {
   errorCount_++;
   return errorType();
@@ -297,11 +394,13 @@ Btype *Llvm_backend::placeholder_array_type(const std::string &name,
 bool Llvm_backend::set_placeholder_pointer_type(Btype *placeholder,
                                                 Btype *to_type)
 {
+  llvm::TimeRegion tr(timer(PlaceholderTimer));
   return setPlaceholderPointerType(placeholder, to_type);
 }
 
 bool Llvm_backend::set_placeholder_function_type(Btype *placeholder,
                                                  Btype *ft) {
+  llvm::TimeRegion tr(timer(PlaceholderTimer));
   return setPlaceholderPointerType(placeholder, ft);
 }
 
@@ -309,6 +408,7 @@ bool
 Llvm_backend::set_placeholder_struct_type(Btype *placeholder,
                             const std::vector<Btyped_identifier> &fields)
 {
+  llvm::TimeRegion tr(timer(PlaceholderTimer));
   return setPlaceholderStructType(placeholder, fields);
 }
 
@@ -317,6 +417,7 @@ Llvm_backend::set_placeholder_struct_type(Btype *placeholder,
 bool Llvm_backend::set_placeholder_array_type(Btype *placeholder,
                                               Btype *element_btype,
                                               Bexpression *length) {
+  llvm::TimeRegion tr(timer(PlaceholderTimer));
   return setPlaceholderArrayType(placeholder, element_btype, length);
 }
 
@@ -462,6 +563,10 @@ Bexpression *Llvm_backend::makeGlobalExpression(Bexpression *expr,
                                                 Btype *btype,
                                                 Location location) {
   assert(! llvm::isa<llvm::Instruction>(val));
+  // An expression built from function-local pieces is released along
+  // with the function, so it can't be reused elsewhere.
+  if (expr->owner())
+    return expr;
   valbtype vbt(std::make_pair(val, btype));
   auto it = valueExprmap_.find(vbt);
   if (it != valueExprmap_.end()) {
@@ -502,9 +607,12 @@ Bexpression *Llvm_backend::loadFromExpr(Bexpression *expr,
                                         Location loc,
                                         const std::string &tag)
 {
-  std::string ldname(tag);
-  ldname += ".ld";
-  ldname = namegen(ldname);
+  std::string ldname;
+  if (!discardNames()) {
+    ldname = tag;
+    ldname += ".ld";
+    ldname = namegen(ldname);
+  }
 
   // If this is a load from a pointer flagged as being a circular
   // type, insert a conversion prior to the load so as to force
@@ -547,7 +655,7 @@ Bexpression *Llvm_backend::indirect_expression(Btype *btype,
     }
   }
 
-  std::string tag(expr->tag().size() == 0 ? "deref" : expr->tag());
+  std::string tag(expr->tag().empty() ? "deref" : expr->tag().str());
   Bexpression *rval = loadFromExpr(expr, btype, location, tag);
   if (vc)
     rval->setVarExprPending(expr->varContext());
@@ -589,9 +697,9 @@ Bexpression *Llvm_backend::address_expression(Bexpression *bexpr,
   // Create new expression with proper type.
   Btype *pt = pointer_type(bexpr->btype());
   Bexpression *rval = nbuilder_.mkAddress(pt, val, bexpr, location);
-  std::string adtag(bexpr->tag());
+  std::string adtag(bexpr->tag().str());
   adtag += ".ad";
-  rval->setTag(adtag);
+  nbuilder_.setTag(rval, adtag);
   const VarContext &vc = bexpr->varContext();
   rval->setVarExprPending(vc.lvalue(), vc.addrLevel() + 1);
 
@@ -643,7 +751,8 @@ Bexpression *Llvm_backend::resolveVarContext(Bexpression *expr,
       return expr;
     }
     Btype *btype = expr->btype();
-    Bexpression *rval = loadFromExpr(expr, btype, expr->location(), expr->tag());
+    Bexpression *rval = loadFromExpr(expr, btype, expr->location(),
+                                     expr->tag().str());
     return rval;
   }
   return expr;
@@ -879,7 +988,7 @@ Bexpression *Llvm_backend::var_expression(Bvariable *var,
     return errorExpression();
 
   Bexpression *varexp = nbuilder_.mkVar(var, location);
-  varexp->setTag(var->name().c_str());
+  nbuilder_.setTag(varexp, var->name());
   varexp->setVarExprPending(in_lvalue_pos == VE_lvalue, 0);
   return varexp;
 }
@@ -1002,32 +1111,39 @@ Bexpression *Llvm_backend::string_constant_expression(const std::string &val)
     return makeGlobalExpression(bconst, zer, stringType(), Location());
   }
 
-  // Create constant
-  bool doAddNull = true;
-  llvm::Constant *scon =
-      llvm::ConstantDataArray::getString(context_,
-                                         llvm::StringRef(val),
-                                         doAddNull);
-
   // Return existing const if installed in table already.
-  auto it = stringConstantMap_.find(scon);
+  auto it = stringConstantMap_.find(val);
   if (it != stringConstantMap_.end())
     return it->second;
 
   // New string. Manufacture a module-scope var to hold the constant,
   // then install various maps.
+  bool doAddNull = true;
+  llvm::Constant *scon =
+      llvm::ConstantDataArray::getString(context_,
+                                         llvm::StringRef(val),
+                                         doAddNull);
   Bvariable *svar =
       makeModuleVar(makeAuxType(scon->getType()),
                     "", "", Location(), MV_Constant, MV_DefaultSection,
                     MV_NotInComdat, MV_DefaultVisibility,
                     llvm::GlobalValue::PrivateLinkage, scon, 1);
-  llvm::Constant *varval = llvm::cast<llvm::Constant>(svar->value());
+
+  // The address of a string literal is never significant, so mark
+  // the var unnamed_addr. Together with private linkage, alignment 1
+  // and the trailing NUL, this lets codegen place it in a mergeable
+  // C-string section (.rodata.str1.1 on ELF), where the linker can
+  // common identical literals across packages.
+  llvm::GlobalVariable *glob =
+      llvm::cast<llvm::GlobalVariable>(svar->value());
+  glob->setUnnamedAddr(llvm::GlobalValue::UnnamedAddr::Global);
+
   llvm::Constant *bitcast =
-      llvm::ConstantExpr::getBitCast(varval, stringType()->type());
+      llvm::ConstantExpr::getBitCast(glob, stringType()->type());
   Bexpression *bconst = nbuilder_.mkConst(stringType(), bitcast);
   Bexpression *rval =
       makeGlobalExpression(bconst, bitcast, stringType(), Location());
-  stringConstantMap_[scon] = rval;
+  stringConstantMap_[val] = rval;
   return rval;
 }
 
@@ -1266,9 +1382,9 @@ Bexpression *Llvm_backend::struct_field_expression(Bexpression *bstruct,
   if (bstruct->varExprPending())
     rval->setVarExprPending(bstruct->varContext());
 
-  std::string tag(bstruct->tag());
+  std::string tag(bstruct->tag().str());
   tag += ".field";
-  rval->setTag(tag);
+  nbuilder_.setTag(rval, tag);
 
   // We're done
   return rval;
@@ -1305,7 +1421,7 @@ Bexpression *Llvm_backend::conditional_expression(Bfunction *function,
       else_expr == errorExpression())
     return errorExpression();
 
-  curFcn_ = function;
+  setCurFcn(function);
   assert(condition && then_expr);
 
   condition = resolveVarContext(condition);
@@ -1782,9 +1898,9 @@ Bexpression *Llvm_backend::pointer_offset_expression(Bexpression *base,
   Bexpression *rval = nbuilder_.mkArrayIndex(base->btype(), gep, base,
                                              index, location);
 
-  std::string tag(base->tag());
+  std::string tag(base->tag().str());
   tag += ".ptroff";
-  rval->setTag(tag);
+  nbuilder_.setTag(rval, tag);
 
   // We're done
   return rval;
@@ -1813,16 +1929,17 @@ Bexpression *Llvm_backend::array_index_expression(Bexpression *barray,
   if (barray->varExprPending())
     rval->setVarExprPending(barray->varContext());
 
-  std::string tag(barray->tag());
+  std::string tag(barray->tag().str());
   tag += ".index";
-  rval->setTag(tag);
+  nbuilder_.setTag(rval, tag);
 
   // We're done
   return rval;
 }
 
 struct GenCallState {
-  CABIOracle oracle;
+  std::unique_ptr<CABIOracle> ownedOracle;
+  CABIOracle *oracle;
   Binstructions instructions;
   BinstructionsLIRBuilder builder;
   std::vector<Bexpression *> resolvedArgs;
@@ -1836,7 +1953,7 @@ struct GenCallState {
                Bfunction *callerFunc,
                BFunctionType *calleeFcnTyp,
                TypeManager *tm)
-      : oracle(calleeFcnTyp, tm),
+      : oracle(tm->abiOracle(calleeFcnTyp, &ownedOracle)),
         instructions(),
         builder(context, &instructions),
         chainVal(nullptr),
@@ -1861,7 +1978,7 @@ static bool needSretTemp(const CABIParamInfo &returnInfo,
 
 void Llvm_backend::genCallProlog(GenCallState &state)
 {
-  const CABIParamInfo &returnInfo = state.oracle.returnInfo();
+  const CABIParamInfo &returnInfo = state.oracle->returnInfo();
   if (needSretTemp(returnInfo, state.calleeFcnType)) {
     assert(state.sretTemp == nullptr);
     std::string tname(namegen("sret.actual"));
@@ -1873,7 +1990,7 @@ void Llvm_backend::genCallProlog(GenCallState &state)
   }
 
   // Chain param if needed
-  const CABIParamInfo &chainInfo = state.oracle.chainInfo();
+  const CABIParamInfo &chainInfo = state.oracle->chainInfo();
   if (chainInfo.disp() != ParmIgnore) {
     assert(chainInfo.disp() == ParmDirect);
     llvm::Value *cval = state.chainVal;
@@ -1889,7 +2006,7 @@ Llvm_backend::genCallMarshallArgs(const std::vector<Bexpression *> &fn_args,
 {
   const std::vector<Btype *> &paramTypes = state.calleeFcnType->paramTypes();
   for (unsigned idx = 0; idx < fn_args.size(); ++idx) {
-    const CABIParamInfo &paramInfo = state.oracle.paramInfo(idx);
+    const CABIParamInfo &paramInfo = state.oracle->paramInfo(idx);
 
     if (paramInfo.attr() == AttrNest)
       continue;
@@ -2002,19 +2119,19 @@ Llvm_backend::genCallMarshallArgs(const std::vector<Bexpression *> &fn_args,
 void Llvm_backend::genCallAttributes(GenCallState &state, llvm::CallInst *call)
 {
   // Sret attribute if needed
-  const CABIParamInfo &returnInfo = state.oracle.returnInfo();
+  const CABIParamInfo &returnInfo = state.oracle->returnInfo();
   if (returnInfo.disp() == ParmIndirect)
     call->addAttribute(1, llvm::Attribute::StructRet);
 
   // Nest attribute if needed
-  const CABIParamInfo &chainInfo = state.oracle.chainInfo();
+  const CABIParamInfo &chainInfo = state.oracle->chainInfo();
   if (chainInfo.disp() != ParmIgnore)
     call->addAttribute(chainInfo.sigOffset()+1, llvm::Attribute::Nest);
 
   // Remainder of param attributes
   const std::vector<Btype *> &paramTypes = state.calleeFcnType->paramTypes();
   for (unsigned idx = 0; idx < paramTypes.size(); ++idx) {
-    const CABIParamInfo &paramInfo = state.oracle.paramInfo(idx);
+    const CABIParamInfo &paramInfo = state.oracle->paramInfo(idx);
     if (paramInfo.disp() == ParmIgnore)
       continue;
     assert(paramInfo.attr() != AttrNest);
@@ -2033,7 +2150,7 @@ void Llvm_backend::genCallEpilog(GenCallState &state,
                                  llvm::Instruction *callInst,
                                  Bexpression *callExpr)
 {
-  const CABIParamInfo &returnInfo = state.oracle.returnInfo();
+  const CABIParamInfo &returnInfo = state.oracle->returnInfo();
 
 
   if (needSretTemp(returnInfo, state.calleeFcnType)) {
@@ -2143,7 +2260,7 @@ Bstatement *Llvm_backend::expression_statement(Bfunction *bfunction,
 {
   if (expr == errorExpression() || bfunction == errorFunction_.get())
     return errorStatement();
-  curFcn_ = bfunction;
+  setCurFcn(bfunction);
   Bstatement *es =
       nbuilder_.mkExprStmt(bfunction,
                            resolve(expr, bfunction),
@@ -2160,7 +2277,7 @@ Bstatement *Llvm_backend::init_statement(Bfunction *bfunction,
   if (var == errorVariable_.get() || init == errorExpression() ||
       bfunction == errorFunction_.get())
     return errorStatement();
-  curFcn_ = bfunction;
+  setCurFcn(bfunction);
   if (init) {
     if (init->compositeInitPending()) {
       init = resolveCompositeInit(init, bfunction, var->value());
@@ -2317,7 +2434,7 @@ Bstatement *Llvm_backend::assignment_statement(Bfunction *bfunction,
   if (lhs == errorExpression() || rhs == errorExpression() ||
       bfunction == errorFunction_.get())
     return errorStatement();
-  curFcn_ = bfunction;
+  setCurFcn(bfunction);
   Bexpression *lhs2 = resolveVarContext(lhs, VE_lvalue);
   Bexpression *rhs2 = rhs;
   if (rhs->compositeInitPending()) {
@@ -2343,7 +2460,7 @@ Llvm_backend::return_statement(Bfunction *bfunction,
 {
   if (bfunction == errorFunction_.get() || exprVectorHasError(vals))
     return errorStatement();
-  curFcn_ = bfunction;
+  setCurFcn(bfunction);
 
   // Resolve arguments
   std::vector<Bexpression *> resolvedVals;
@@ -2421,7 +2538,7 @@ Bstatement *Llvm_backend::if_statement(Bfunction *bfunction,
                                        Location location) {
   if (condition == errorExpression())
     return errorStatement();
-  curFcn_ = bfunction;
+  setCurFcn(bfunction);
   condition = resolve(condition, bfunction);
   assert(then_block);
   Btype *bt = makeAuxType(llvmBoolType());
@@ -2443,7 +2560,7 @@ Bstatement *Llvm_backend::switch_statement(Bfunction *bfunction,
   // Error handling
   if (value == errorExpression())
     return errorStatement();
-  curFcn_ = bfunction;
+  setCurFcn(bfunction);
   for (auto casev : cases)
     if (exprVectorHasError(casev))
       return errorStatement();
@@ -2511,6 +2628,7 @@ Bblock *Llvm_backend::block(Bfunction *function, Bblock *enclosing,
                             const std::vector<Bvariable *> &vars,
                             Location start_location, Location) {
   assert(function);
+  setCurFcn(function);
 
   // FIXME: record debug location
 
@@ -2658,7 +2776,7 @@ Bvariable *Llvm_backend::local_variable(Bfunction *function,
   assert(function);
   if (btype == errorType() || function == errorFunction_.get())
     return errorVariable_.get();
-  curFcn_ = function;
+  setCurFcn(function);
   return function->localVariable(name, btype, is_address_taken, location);
 }
 
@@ -2670,7 +2788,7 @@ Bvariable *Llvm_backend::parameter_variable(Bfunction *function,
                                             Location location)
 {
   assert(function);
-  curFcn_ = function;
+  setCurFcn(function);
   if (btype == errorType() || function == errorFunction_.get())
     return errorVariable_.get();
   return function->parameterVariable(name, btype,
@@ -2701,7 +2819,7 @@ Bvariable *Llvm_backend::temporary_variable(Bfunction *function,
 {
   if (binit == errorExpression())
     return errorVariable_.get();
-  curFcn_ = function;
+  setCurFcn(function);
   std::string tname(namegen("tmpv"));
   Bvariable *tvar = local_variable(function, tname, btype,
                                    is_address_taken, location);
@@ -3007,7 +3125,17 @@ bool Llvm_backend::function_set_parameters(
 // Helper class for assigning instructions to LLVM basic blocks
 // and materializing control transfers.
 //
-// FIXME: convert to use new Bnode walk paradigm.
+// Rather than recursing on the statement/expression tree, the walk
+// is driven by an explicit stack of pending work items, so that
+// machine-generated functions with very large bodies or very deep
+// nesting (long else-if chains, giant composite initializers) can be
+// handled in bounded stack space and linear time. The 'gen*' routines
+// below handle the first part of the lowering for a given statement,
+// then push work items for the remaining steps (walking of child
+// statements, emitting branches to join points, etc). The block
+// currently being filled in is tracked in 'curblock_'; a null value
+// indicates that the current block has been terminated (for example,
+// by a return or goto).
 //
 class GenBlocks {
 public:
@@ -3019,22 +3147,63 @@ public:
   void finishFunction(llvm::BasicBlock *entry);
 
   Bfunction *function() { return function_; }
-  llvm::BasicBlock *genIf(Bstatement *ifst,
-                          llvm::BasicBlock *curblock);
-  llvm::BasicBlock *genSwitch(Bstatement *swst,
-                              llvm::BasicBlock *curblock);
-  llvm::BasicBlock *genDefer(Bstatement *defst,
-                             llvm::BasicBlock *curblock);
-  llvm::BasicBlock *genReturn(Bstatement *rst,
-                             llvm::BasicBlock *curblock);
-  llvm::BasicBlock *genExcep(Bstatement *excepst,
-                             llvm::BasicBlock *curblock);
 
  private:
+  // Kinds of pending work items (see 'WorkItem' below).
+  enum WorkKind {
+    WalkNode,         // walk 'node'
+    EmitExprInsts,    // assign instructions of expr 'node' to curblock_
+    EndLexBlock,      // finish debug scope for block 'node'
+    IfBranches,       // condition of if stmt 'node' walked
+    SwitchCases,      // value of switch stmt 'node' walked
+    BranchTo,         // branch from curblock_ (if still open) to bb1
+    SetBlock,         // make bb1 the current block
+    CheckBlock,       // assert that curblock_ is bb1
+    SwitchCaseEnd,    // close out switch case block bb1 (epilog is bb2)
+    DeferCatch,       // undefer call of 'node' walked (pad bb1, catch bb2,
+                      // finish bb3)
+    DeferFinish,      // defer call walked (catch bb1, finish bb2, cont bb3)
+    ExcepCatch,       // body of excep stmt 'node' walked (pad bb1, cont bb2)
+    ExcepFinally,     // on-exception stmt walked (cont bb1, catchpad bb2)
+    ExcepReturn       // finally stmt walked; emit cached return if any
+  };
+
+  struct WorkItem {
+    WorkKind kind;
+    Bnode *node;
+    llvm::BasicBlock *bb1;
+    llvm::BasicBlock *bb2;
+    llvm::BasicBlock *bb3;
+  };
+
+  void pushWork(WorkKind kind, Bnode *node,
+                llvm::BasicBlock *bb1 = nullptr,
+                llvm::BasicBlock *bb2 = nullptr,
+                llvm::BasicBlock *bb3 = nullptr) {
+    WorkItem wi = { kind, node, bb1, bb2, bb3 };
+    worklist_.push_back(wi);
+  }
+  void perform(const WorkItem &wi);
+  void walkNode(Bnode *node);
+  void emitExprInsts(Bexpression *expr);
+  void genIf(Bstatement *ifst);
+  void genIfBranches(Bstatement *ifst);
+  void genSwitch(Bstatement *swst);
+  void genSwitchCases(Bstatement *swst);
+  void genDefer(Bstatement *defst);
+  void genDeferCatch(Bstatement *defst, llvm::BasicBlock *padbb,
+                     llvm::BasicBlock *catchbb, llvm::BasicBlock *finbb);
+  void genReturn(Bstatement *rst);
+  void genExcep(Bstatement *excepst);
+  void genExcepCatch(Bstatement *excepst, llvm::BasicBlock *padbb,
+                     llvm::BasicBlock *contbb);
+  void genExcepFinally(Bstatement *excepst, llvm::BasicBlock *contbb,
+                       llvm::BasicBlock *catchpadbb);
+  void genExcepReturn();
+
   llvm::BasicBlock *mkLLVMBlock(const std::string &name,
                             unsigned expl = Llvm_backend::ChooseVer);
   llvm::BasicBlock *getBlockForLabel(LabelId lab);
-  llvm::BasicBlock *walkExpr(llvm::BasicBlock *curblock, Bexpression *expr);
   std::pair<llvm::Instruction*, llvm::BasicBlock *>
   rewriteToMayThrowCall(llvm::CallInst *call,
                         llvm::BasicBlock *curblock);
@@ -3054,6 +3223,8 @@ public:
   std::vector<llvm::BasicBlock*> padBlockStack_;
   llvm::BasicBlock* finallyBlock_;
   Bstatement *cachedReturn_;
+  llvm::BasicBlock *curblock_;
+  std::vector<WorkItem> worklist_;
   bool emitOrphanedCode_;
   bool createDebugMetaData_;
 };
@@ -3067,10 +3238,11 @@ GenBlocks::GenBlocks(llvm::LLVMContext &context,
                      llvm::BasicBlock *entryBlock)
     : context_(context), be_(be), function_(function),
       dibuildhelper_(nullptr), finallyBlock_(nullptr),
-      cachedReturn_(nullptr), emitOrphanedCode_(false),
+      cachedReturn_(nullptr), curblock_(nullptr), emitOrphanedCode_(false),
       createDebugMetaData_(createDebugMetadata)
 {
   if (createDebugMetaData_) {
+    llvm::TimeRegion tr(be->timer(Llvm_backend::DIBuildTimer));
     dibuildhelper_.reset(new DIBuildHelper(topNode,
                                            be->typeManager(),
                                            be->linemap(),
@@ -3084,8 +3256,10 @@ GenBlocks::GenBlocks(llvm::LLVMContext &context,
 void GenBlocks::finishFunction(llvm::BasicBlock *entry)
 {
   function_->fixupProlog(entry);
-  if (createDebugMetaData_)
+  if (createDebugMetaData_) {
+    llvm::TimeRegion tr(be_->timer(Llvm_backend::DIBuildTimer));
     dibuildhelper().endFunction(function_);
+  }
 }
 
 llvm::BasicBlock *GenBlocks::mkLLVMBlock(const std::string &name,
@@ -3166,42 +3340,41 @@ GenBlocks::postProcessInst(llvm::Instruction *inst,
   return std::make_pair(inst, curblock);
 }
 
-llvm::BasicBlock *GenBlocks::walkExpr(llvm::BasicBlock *curblock,
-                                      Bexpression *expr)
+void GenBlocks::emitExprInsts(Bexpression *expr)
 {
-  // Visit children first
-  const std::vector<Bnode *> &kids = expr->children();
-  for (auto &child : kids)
-    curblock = walk(child, curblock);
-
-  // Now visit instructions for this expr
+  // Children have already been visited; now visit instructions for
+  // this expr.
   for (auto originst : expr->instructions()) {
-    if (!curblock) {
+    if (!curblock_) {
       delete originst;
       continue;
     }
-    auto pair = postProcessInst(originst, curblock);
+    auto pair = postProcessInst(originst, curblock_);
     auto inst = pair.first;
-    if (createDebugMetaData_)
+    if (createDebugMetaData_) {
+      llvm::TimeRegion tr(be_->timer(Llvm_backend::DIBuildTimer));
       dibuildhelper().processExprInst(expr, inst);
-    curblock->getInstList().push_back(inst);
-    curblock = pair.second;
+    }
+    curblock_->getInstList().push_back(inst);
+    curblock_ = pair.second;
   }
-  return curblock;
 }
 
-llvm::BasicBlock *GenBlocks::genIf(Bstatement *ifst,
-                                   llvm::BasicBlock *curblock)
+void GenBlocks::genIf(Bstatement *ifst)
 {
   assert(ifst->flavor() == N_IfStmt);
 
+  // Walk condition first
+  pushWork(IfBranches, ifst);
+  pushWork(WalkNode, ifst->getIfStmtCondition());
+}
+
+void GenBlocks::genIfBranches(Bstatement *ifst)
+{
   Bexpression *cond = ifst->getIfStmtCondition();
   Bstatement *trueStmt = ifst->getIfStmtTrueBlock();
   Bstatement *falseStmt = ifst->getIfStmtFalseBlock();
 
-  // Walk condition first
-  curblock = walkExpr(curblock, cond);
-
   // Create true block
   llvm::BasicBlock *tblock = mkLLVMBlock("then");
 
@@ -3215,31 +3388,34 @@ llvm::BasicBlock *GenBlocks::genIf(Bstatement *ifst,
 
   // Insert conditional branch into current block
   llvm::Value *cval = cond->value();
-  llvm::BranchInst::Create(tblock, fblock, cval, curblock);
+  llvm::BranchInst::Create(tblock, fblock, cval, curblock_);
 
-  // Visit true block
-  llvm::BasicBlock *tsucc = walk(trueStmt, tblock);
-  if (tsucc && ! tsucc->getTerminator())
-    llvm::BranchInst::Create(ft, tsucc);
-
-  // Walk false block if present
+  // Visit true block, then false block if present; each falls
+  // through to 'ft', which then becomes the current block. Work
+  // items are performed in LIFO order, hence pushed in reverse.
+  pushWork(SetBlock, nullptr, ft);
+  pushWork(BranchTo, nullptr, ft);
   if (falseStmt) {
-    llvm::BasicBlock *fsucc = walk(falseStmt, fblock);
-    if (fsucc && ! fsucc->getTerminator())
-      llvm::BranchInst::Create(ft, fsucc);
+    pushWork(WalkNode, falseStmt);
+    pushWork(SetBlock, nullptr, fblock);
+    pushWork(BranchTo, nullptr, ft);
   }
-
-  return ft;
+  pushWork(WalkNode, trueStmt);
+  curblock_ = tblock;
 }
 
-llvm::BasicBlock *GenBlocks::genSwitch(Bstatement *swst,
-                                       llvm::BasicBlock *curblock)
+void GenBlocks::genSwitch(Bstatement *swst)
 {
   assert(swst->flavor() == N_SwitchStmt);
 
   // Walk switch value first
+  pushWork(SwitchCases, swst);
+  pushWork(WalkNode, swst->getSwitchStmtValue());
+}
+
+void GenBlocks::genSwitchCases(Bstatement *swst)
+{
   Bexpression *swval = swst->getSwitchStmtValue();
-  curblock = walkExpr(curblock, swval);
 
   // Unpack switch
   unsigned ncases = swst->getSwitchStmtNumCases();
@@ -3264,20 +3440,10 @@ llvm::BasicBlock *GenBlocks::genSwitch(Bstatement *swst,
   if (!defBB)
     defBB = epilogBB;
 
+  // Create switch. Case statements are walked starting in their own
+  // blocks, so the switch can be added to the current block now.
   LIRBuilder builder(context_, llvm::ConstantFolder());
-
-  // Walk statement/block
-  for (unsigned idx = 0; idx < ncases; ++idx) {
-    Bstatement *st = swst->getSwitchStmtNthStmt(idx);
-    walk(st, blocks[idx]);
-    if (! blocks[idx]->getTerminator()) {
-      builder.SetInsertPoint(blocks[idx]);
-      builder.CreateBr(epilogBB);
-    }
-  }
-
-  // Create switch
-  builder.SetInsertPoint(curblock);
+  builder.SetInsertPoint(curblock_);
   llvm::SwitchInst *swinst = builder.CreateSwitch(swval->value(), defBB);
 
   // Connect values with blocks
@@ -3290,7 +3456,15 @@ llvm::BasicBlock *GenBlocks::genSwitch(Bstatement *swst,
     }
   }
 
-  return epilogBB;
+  // Walk statement/block for each case (in reverse, see above),
+  // after which the epilog is the current block.
+  pushWork(SetBlock, nullptr, epilogBB);
+  for (unsigned idx = ncases; idx != 0; --idx) {
+    Bstatement *st = swst->getSwitchStmtNthStmt(idx - 1);
+    pushWork(SwitchCaseEnd, nullptr, blocks[idx - 1], epilogBB);
+    pushWork(WalkNode, st);
+    pushWork(SetBlock, nullptr, blocks[idx - 1]);
+  }
 }
 
 // In most cases a return statement is handled in canonical way,
@@ -3309,8 +3483,7 @@ llvm::BasicBlock *GenBlocks::genSwitch(Bstatement *swst,
 // variable. This fact permits us to copy a return from one place in
 // the program to another while getting the same semantics.
 
-llvm::BasicBlock *GenBlocks::genReturn(Bstatement *rst,
-                                       llvm::BasicBlock *curblock)
+void GenBlocks::genReturn(Bstatement *rst)
 {
   assert(rst->flavor() == N_ReturnStmt);
 
@@ -3326,18 +3499,19 @@ llvm::BasicBlock *GenBlocks::genReturn(Bstatement *rst,
     } else {
       Bnode::destroy(re, DelInstructions);
     }
-    llvm::BranchInst::Create(finallyBlock_, curblock);
+    llvm::BranchInst::Create(finallyBlock_, curblock_);
+    // A return terminates the current block
+    curblock_ = nullptr;
   } else {
-    // Walk return expression
-    llvm::BasicBlock *bb = walkExpr(curblock, re);
-    assert(curblock == bb);
+    // Walk return expression, after which the current block is
+    // terminated.
+    pushWork(SetBlock, nullptr, nullptr);
+    pushWork(CheckBlock, nullptr, curblock_);
+    pushWork(WalkNode, re);
   }
-  // A return terminates the current block
-  return nullptr;
 }
 
-llvm::BasicBlock *GenBlocks::genDefer(Bstatement *defst,
-                                      llvm::BasicBlock *curblock)
+void GenBlocks::genDefer(Bstatement *defst)
 {
   assert(defst->flavor() == N_DeferStmt);
 
@@ -3346,7 +3520,6 @@ llvm::BasicBlock *GenBlocks::genDefer(Bstatement *defst,
   if (! func->hasPersonalityFn())
     func->setPersonalityFn(be_->personalityFunction());
 
-  Bexpression *defcallex = defst->getDeferStmtDeferCall();
   Bexpression *undcallex = defst->getDeferStmtUndeferCall();
 
   // Finish bb (see the comments for Llvm_backend::function_defer_statement
@@ -3362,9 +3535,9 @@ llvm::BasicBlock *GenBlocks::genDefer(Bstatement *defst,
   // Catch BB will contain checkdefer (defercall) code.
   llvm::BasicBlock *catchbb =
       llvm::BasicBlock::Create(context_, be_->namegen("catch"), func);
-  if (curblock)
-    llvm::BranchInst::Create(finbb, curblock);
-  curblock = finbb;
+  if (curblock_)
+    llvm::BranchInst::Create(finbb, curblock_);
+  curblock_ = finbb;
 
   // Push pad block onto stack. This will be an indication that any call
   // in the undcallex subtree should be converted into an invoke with
@@ -3372,8 +3545,15 @@ llvm::BasicBlock *GenBlocks::genDefer(Bstatement *defst,
   padBlockStack_.push_back(padbb);
 
   // Walk the undcall expression.
-  curblock = walkExpr(curblock, undcallex);
+  pushWork(DeferCatch, defst, padbb, catchbb, finbb);
+  pushWork(WalkNode, undcallex);
+}
 
+void GenBlocks::genDeferCatch(Bstatement *defst,
+                              llvm::BasicBlock *padbb,
+                              llvm::BasicBlock *catchbb,
+                              llvm::BasicBlock *finbb)
+{
   // Pop the pad block stack.
   padBlockStack_.pop_back();
 
@@ -3384,20 +3564,15 @@ llvm::BasicBlock *GenBlocks::genDefer(Bstatement *defst,
   padinst->addClause(llvm::Constant::getNullValue(be_->llvmPtrType()));
   llvm::BranchInst::Create(catchbb, padbb);
 
-  llvm::BasicBlock *contbb = curblock;
+  llvm::BasicBlock *contbb = curblock_;
 
-  // Catch block containing defer call.
-  curblock = catchbb;
-  auto bb = walkExpr(curblock, defcallex);
-  assert(bb == curblock);
-  llvm::BranchInst::Create(finbb, catchbb);
-
-  // Continue bb is final bb.
-  return contbb;
+  // Catch block containing defer call. Continue bb is final bb.
+  curblock_ = catchbb;
+  pushWork(DeferFinish, nullptr, catchbb, finbb, contbb);
+  pushWork(WalkNode, defst->getDeferStmtDeferCall());
 }
 
-llvm::BasicBlock *GenBlocks::genExcep(Bstatement *excepst,
-                                      llvm::BasicBlock *curblock)
+void GenBlocks::genExcep(Bstatement *excepst)
 {
   assert(excepst->flavor() == N_ExcepStmt);
 
@@ -3408,8 +3583,6 @@ llvm::BasicBlock *GenBlocks::genExcep(Bstatement *excepst,
 
   Bstatement *body = excepst->getExcepStmtBody();
   assert(body);
-  Bstatement *ifexception = excepst->getExcepStmtOnException();
-  assert(ifexception);
   Bstatement *finally = excepst->getExcepStmtFinally(); // may be null
 
   // Create a landing pad block. This pad will be where control
@@ -3440,15 +3613,25 @@ llvm::BasicBlock *GenBlocks::genExcep(Bstatement *excepst,
   padBlockStack_.push_back(padbb);
 
   // Walk the body statement.
-  curblock = walk(body, curblock);
+  pushWork(ExcepCatch, excepst, padbb, contbb);
+  pushWork(WalkNode, body);
+}
+
+void GenBlocks::genExcepCatch(Bstatement *excepst,
+                              llvm::BasicBlock *padbb,
+                              llvm::BasicBlock *contbb)
+{
+  llvm::Function *func = function()->function();
+  Bstatement *ifexception = excepst->getExcepStmtOnException();
+  assert(ifexception);
 
   // Pop the pad block stack.
   padBlockStack_.pop_back();
 
   // If the body block ended without a return, then insert a jump
   // to the continue / or finally clause.
-  if (curblock)
-    llvm::BranchInst::Create(contbb, curblock);
+  if (curblock_)
+    llvm::BranchInst::Create(contbb, curblock_);
 
   // Emit landing pad inst in pad block, followed by branch to catch bb.
   llvm::LandingPadInst *padinst =
@@ -3467,9 +3650,17 @@ llvm::BasicBlock *GenBlocks::genExcep(Bstatement *excepst,
 
   // Push second pad, walk exception stmt, then pop the pad.
   padBlockStack_.push_back(catchpadbb);
-  auto bb = walk(ifexception, catchbb);
-  if (bb)
-    llvm::BranchInst::Create(contbb, bb);
+  curblock_ = catchbb;
+  pushWork(ExcepFinally, excepst, contbb, catchpadbb);
+  pushWork(WalkNode, ifexception);
+}
+
+void GenBlocks::genExcepFinally(Bstatement *excepst,
+                                llvm::BasicBlock *contbb,
+                                llvm::BasicBlock *catchpadbb)
+{
+  if (curblock_)
+    llvm::BranchInst::Create(contbb, curblock_);
   padBlockStack_.pop_back();
 
   // Return handling now complete.
@@ -3483,90 +3674,172 @@ llvm::BasicBlock *GenBlocks::genExcep(Bstatement *excepst,
   llvm::BranchInst::Create(contbb, catchpadbb);
 
   // Handle finally statement where applicable.
-  curblock = contbb;
+  curblock_ = contbb;
+  Bstatement *finally = excepst->getExcepStmtFinally();
   if (finally != nullptr) {
-    curblock = walk(finally, curblock);
-    if (cachedReturn_ != nullptr) {
-      Bexpression *re = cachedReturn_->getReturnStmtExpr();
-      llvm::BasicBlock *bb = walkExpr(curblock, re);
-      assert(curblock == bb);
-      cachedReturn_ = nullptr;
-    }
+    pushWork(ExcepReturn, nullptr);
+    pushWork(WalkNode, finally);
   }
+}
 
-  return curblock;
+void GenBlocks::genExcepReturn()
+{
+  if (cachedReturn_ != nullptr) {
+    Bexpression *re = cachedReturn_->getReturnStmtExpr();
+    cachedReturn_ = nullptr;
+    pushWork(CheckBlock, nullptr, curblock_);
+    pushWork(WalkNode, re);
+  }
 }
 
-llvm::BasicBlock *GenBlocks::walk(Bnode *node,
-                                  llvm::BasicBlock *curblock)
+void GenBlocks::walkNode(Bnode *node)
 {
   Bexpression *expr = node->castToBexpression();
-  if (expr)
-    return walkExpr(curblock, expr);
+  if (expr) {
+    // Visit children first (pushed in reverse, see above), then
+    // instructions for this expr.
+    pushWork(EmitExprInsts, expr);
+    llvm::ArrayRef<Bnode *> kids = expr->children();
+    for (auto it = kids.rbegin(); it != kids.rend(); ++it)
+      pushWork(WalkNode, *it);
+    return;
+  }
   llvm::Function *func = function()->function();
   Bstatement *stmt = node->castToBstatement();
   assert(stmt);
   switch (stmt->flavor()) {
     case N_ExprStmt: {
-      curblock = walkExpr(curblock, stmt->getExprStmtExpr());
+      pushWork(WalkNode, stmt->getExprStmtExpr());
       break;
     }
     case N_BlockStmt: {
       Bblock *bblock = stmt->castToBblock();
-      if (createDebugMetaData_)
+      if (createDebugMetaData_) {
+        llvm::TimeRegion tr(be_->timer(Llvm_backend::DIBuildTimer));
         dibuildhelper().beginLexicalBlock(bblock);
-      for (auto &st : stmt->getChildStmts())
-        curblock = walk(st, curblock);
-      if (createDebugMetaData_)
-        dibuildhelper().endLexicalBlock(bblock);
+        pushWork(EndLexBlock, bblock);
+      }
+      std::vector<Bstatement *> stmts = stmt->getChildStmts();
+      for (auto it = stmts.rbegin(); it != stmts.rend(); ++it)
+        pushWork(WalkNode, *it);
       break;
     }
     case N_IfStmt: {
-      curblock = genIf(stmt, curblock);
+      genIf(stmt);
       break;
     }
     case N_SwitchStmt: {
-      curblock = genSwitch(stmt, curblock);
+      genSwitch(stmt);
       break;
     }
     case N_ReturnStmt: {
-      curblock = genReturn(stmt, curblock);
+      genReturn(stmt);
       break;
     }
     case N_DeferStmt: {
-      curblock = genDefer(stmt, curblock);
+      genDefer(stmt);
       break;
     }
     case N_ExcepStmt: {
-      curblock = genExcep(stmt, curblock);
+      genExcep(stmt);
       break;
     }
     case N_GotoStmt: {
       llvm::BasicBlock *lbb = getBlockForLabel(stmt->getGotoStmtTargetLabel());
-      if (curblock && ! curblock->getTerminator())
-        llvm::BranchInst::Create(lbb, curblock);
+      if (curblock_ && ! curblock_->getTerminator())
+        llvm::BranchInst::Create(lbb, curblock_);
       if (emitOrphanedCode_) {
         std::string n = be_->namegen("orphan");
         llvm::BasicBlock *orphan =
             llvm::BasicBlock::Create(context_, n, func, lbb);
-        curblock = orphan;
+        curblock_ = orphan;
       } else {
-        curblock = nullptr;
+        curblock_ = nullptr;
       }
       break;
     }
     case N_LabelStmt: {
       llvm::BasicBlock *lbb =
           getBlockForLabel(stmt->getLabelStmtDefinedLabel());
-      if (curblock)
-        llvm::BranchInst::Create(lbb, curblock);
-      curblock = lbb;
+      if (curblock_)
+        llvm::BranchInst::Create(lbb, curblock_);
+      curblock_ = lbb;
       break;
     }
     default:
       assert(false && "not yet handled");
   }
-  return curblock;
+}
+
+void GenBlocks::perform(const WorkItem &wi)
+{
+  switch (wi.kind) {
+    case WalkNode:
+      walkNode(wi.node);
+      break;
+    case EmitExprInsts:
+      emitExprInsts(wi.node->castToBexpression());
+      break;
+    case EndLexBlock: {
+      llvm::TimeRegion tr(be_->timer(Llvm_backend::DIBuildTimer));
+      dibuildhelper().endLexicalBlock(wi.node->castToBblock());
+      break;
+    }
+    case IfBranches:
+      genIfBranches(wi.node->castToBstatement());
+      break;
+    case SwitchCases:
+      genSwitchCases(wi.node->castToBstatement());
+      break;
+    case BranchTo:
+      if (curblock_ && ! curblock_->getTerminator())
+        llvm::BranchInst::Create(wi.bb1, curblock_);
+      break;
+    case SetBlock:
+      curblock_ = wi.bb1;
+      break;
+    case CheckBlock:
+      assert(curblock_ == wi.bb1);
+      break;
+    case SwitchCaseEnd:
+      if (! wi.bb1->getTerminator()) {
+        LIRBuilder builder(context_, llvm::ConstantFolder());
+        builder.SetInsertPoint(wi.bb1);
+        builder.CreateBr(wi.bb2);
+      }
+      break;
+    case DeferCatch:
+      genDeferCatch(wi.node->castToBstatement(), wi.bb1, wi.bb2, wi.bb3);
+      break;
+    case DeferFinish:
+      assert(curblock_ == wi.bb1);
+      llvm::BranchInst::Create(wi.bb2, wi.bb1);
+      curblock_ = wi.bb3;
+      break;
+    case ExcepCatch:
+      genExcepCatch(wi.node->castToBstatement(), wi.bb1, wi.bb2);
+      break;
+    case ExcepFinally:
+      genExcepFinally(wi.node->castToBstatement(), wi.bb1, wi.bb2);
+      break;
+    case ExcepReturn:
+      genExcepReturn();
+      break;
+  }
+}
+
+llvm::BasicBlock *GenBlocks::walk(Bnode *node,
+                                  llvm::BasicBlock *curblock)
+{
+  assert(worklist_.empty());
+  curblock_ = curblock;
+  pushWork(WalkNode, node);
+  while (!worklist_.empty()) {
+    WorkItem wi = worklist_.back();
+    worklist_.pop_back();
+    perform(wi);
+  }
+  return curblock_;
 }
 
 llvm::BasicBlock *Llvm_backend::genEntryBlock(Bfunction *bfunction) {
@@ -3608,6 +3881,10 @@ bool Llvm_backend::function_set_body(Bfunction *function,
     return true;
   assert(curFcn_ == nullptr || curFcn_ == function);
   curFcn_ = nullptr;
+  // Expressions created while generating IR (e.g. by the simplifier)
+  // still belong to this function.
+  nbuilder_.setCurrentFunction(function);
+  llvm::TimeRegion tr(timer(FcnSetBodyTimer));
 
   // debugging
   if (traceLevel() > 1) {
@@ -3615,9 +3892,22 @@ bool Llvm_backend::function_set_body(Bfunction *function,
     code_stmt->dump();
   }
 
-  // Sanity checks
+  // Sanity checks. Sharing is detected incrementally as the tree is
+  // built (see enforceTreeIntegrity); the walk of the entire function
+  // body here is done only in asserts-enabled builds.
+  enforceTreeIntegrity(code_stmt);
+#ifndef NDEBUG
   if (checkIntegrity_)
-    enforceTreeIntegrity(code_stmt);
+    verifyTreeIntegrity(code_stmt);
+#endif
+
+  // Clean up the tree before generating IR for it (optional).
+  if (simplifyNodes_) {
+    llvm::TimeRegion str(timer(SimplifyTimer));
+    SimplifyVisitor simp(nbuilder_, datalayout());
+    update_walk_nodes(code_stmt, simp, ExplicitStackWalk);
+    simplifyStats_.add(simp.stats());
+  }
 
   // Create and populate entry block
   llvm::BasicBlock *entryBlock = genEntryBlock(function);
@@ -3628,7 +3918,11 @@ bool Llvm_backend::function_set_body(Bfunction *function,
   // Walk the code statements
   GenBlocks gb(context_, this, function, code_stmt,
                getDICompUnit(), dodebug, entryBlock);
-  llvm::BasicBlock *block = gb.walk(code_stmt, entryBlock);
+  llvm::BasicBlock *block = nullptr;
+  {
+    llvm::TimeRegion wtr(timer(GenBlocksTimer));
+    block = gb.walk(code_stmt, entryBlock);
+  }
   gb.finishFunction(entryBlock);
 
   // Fix up epilog block if needed
@@ -3641,6 +3935,15 @@ bool Llvm_backend::function_set_body(Bfunction *function,
     function->function()->dump();
   }
 
+  // Statements and expressions for this function are no longer
+  // needed; release them.
+  nbuilder_.setCurrentFunction(nullptr);
+  nbuilder_.freeStmts(function);
+
+  // Streaming mode: the client may now compile and discard the body.
+  if (fcnCompletionHook_)
+    fcnCompletionHook_(function->function());
+
   return true;
 }
 
@@ -3661,28 +3964,16 @@ void Llvm_backend::write_global_definitions(
 
 }
 
-// Post-process export data to escape quotes, etc, writing bytes
-// to the specified stringstream.
-static void postProcessExportDataChunk(const char *bytes,
-                                       unsigned int size,
-                                       std::stringstream &ss)
-{
-  std::map<char, std::string> rewrites = { { '\\', "\\\\" },
-                                           { '\0', "\\000" },
-                                           { '\n', "\\n" },
-                                           { '"', "\\\"" } };
-
-  for (unsigned idx = 0; idx < size; ++idx) {
-    const char byte = bytes[idx];
-    auto it = rewrites.find(byte);
-    if (it != rewrites.end())
-      ss << it->second;
-    else
-      ss << byte;
-  }
-}
-
-// Finalize export data.
+// Finalize export data. The export data is emitted as a constant byte
+// array placed in the ".go_export" section, where it will be found by
+// go_read_export_data when the package is imported. For ELF, the
+// section itself is declared up front (via module inline asm) so as to
+// give it the "exclude" flag (SHF_EXCLUDE), which keeps the export data
+// out of linked executables; a global with an explicit section would
+// otherwise wind up in an allocated section. Mach-O uses the same
+// segment and section names as gccgo ("__GNU_GO,__go_export"). Other
+// object formats have no equivalent of the exclude flag, so there the
+// section is a plain (allocated) data section.
 
 void Llvm_backend::finalizeExportData()
 {
@@ -3692,12 +3983,32 @@ void Llvm_backend::finalizeExportData()
 
   assert(! exportDataFinalized_);
   exportDataFinalized_ = true;
-  module().appendModuleInlineAsm("\t.text\n");
+  if (exportData_.empty())
+    return;
 
-  if (traceLevel() > 1) {
-    std::cerr << "Export data emitted:\n";
-    std::cerr << module().getModuleInlineAsm();
+  llvm::Triple triple(module().getTargetTriple());
+  std::string section(".go_export");
+  if (triple.isOSBinFormatELF()) {
+    module().appendModuleInlineAsm(
+        "\t.section \".go_export\",\"e\",@progbits");
+    module().appendModuleInlineAsm("\t.text");
+  } else if (triple.isOSBinFormatMachO()) {
+    section = "__GNU_GO,__go_export";
   }
+
+  llvm::Constant *init =
+      llvm::ConstantDataArray::getString(context_, exportData_, false);
+  llvm::GlobalVariable *gv =
+      new llvm::GlobalVariable(module(), init->getType(), true,
+                               llvm::GlobalValue::PrivateLinkage,
+                               init, "go_export");
+  gv->setSection(section);
+  gv->setAlignment(1);
+  llvm::appendToCompilerUsed(module(), { gv });
+
+  if (traceLevel() > 1)
+    std::cerr << "Export data emitted: " << exportData_.size()
+              << " bytes\n";
 }
 
 // This is called by the Go frontend proper to add data to the
@@ -3705,22 +4016,8 @@ void Llvm_backend::finalizeExportData()
 
 void Llvm_backend::write_export_data(const char *bytes, unsigned int size)
 {
-  // FIXME: this is hacky and currently very ELF-specific. Better to
-  // add real support in MC object file layer.
-
   assert(! exportDataFinalized_);
-
-  if (! exportDataStarted_) {
-    exportDataStarted_ = true;
-    const char *preamble = "\t.section \".go_export\",\"e\",@progbits";
-    module().appendModuleInlineAsm(preamble);
-  }
-
-  std::stringstream ss;
-  ss << "\t.ascii \"";
-  postProcessExportDataChunk(bytes, size, ss);
-  ss << "\"\n";
-  module().appendModuleInlineAsm(ss.str());
+  exportData_.append(bytes, size);
 }
 
 
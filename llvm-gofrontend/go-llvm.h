@@ -26,11 +26,13 @@
 #include "go-llvm-bvariable.h"
 #include "go-llvm-tree-integrity.h"
 #include "go-llvm-typemanager.h"
+#include "go-llvm-simplify.h"
 
 #include "namegen.h"
 
 #include "backend.h"
 
+#include <functional>
 #include <unordered_map>
 #include <unordered_set>
 
@@ -52,6 +54,8 @@ class LLVMContext;
 class Module;
 class StructType;
 class TargetLibraryInfo;
+class Timer;
+class TimerGroup;
 class Type;
 class Value;
 class raw_ostream;
@@ -62,6 +66,8 @@ class BlockLIRBuilder;
 class BinstructionsLIRBuilder;
 struct GenCallState;
 
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/StringMap.h"
 #include "llvm/IR/GlobalValue.h"
 
 //
@@ -354,6 +360,11 @@ public:
   // Dump LLVM IR for module
   void dumpModule();
 
+  // Returns a string summarizing the number of live Bnodes, the sizes
+  // of the type manager tables, and the sizes of the backend's value
+  // caches (for memory usage reporting).
+  std::string statistics();
+
   // Dump expression or stmt with line information. For debugging purposes.
   void dumpExpr(Bexpression *);
   void dumpStmt(Bstatement *);
@@ -369,7 +380,20 @@ public:
   std::pair<bool, std::string>
   checkTreeIntegrity(Bnode *n, TreeIntegCtl control);
 
-  // Similar to the above, but prints message to std::cerr and aborts if fail
+  // Similar to the above, but prints message to std::cerr and aborts if
+  // fail. Repairs sharing where possible; walks the whole of 'n' (and
+  // of 'others', if supplied, so as to detect sharing between them).
+  void verifyTreeIntegrity(Bnode *n,
+                           llvm::ArrayRef<Bnode *> others = llvm::None);
+
+  // Incremental version of the above, invoked as each new statement
+  // is created. Resolves sharing recorded by the node builder since
+  // the last call; in the common case (no sharing) this is O(1).
+  // Sharing that can't be repaired is confirmed with a walk of 'n'
+  // together with the statements holding the other parents (the
+  // builder's tracking can report false positives), then reported to
+  // std::cerr in all builds. Confirmed statement sharing is a fatal
+  // error in all builds; expression sharing asserts.
   void enforceTreeIntegrity(Bnode *n);
 
   // Disable tree integrity checking. This is mainly
@@ -381,6 +405,48 @@ public:
   // if meta-data is created.
   void disableDebugMetaDataGeneration() { createDebugMetaData_ = false; }
 
+  // Don't generate names for values, blocks and types. This also
+  // tells the LLVM context to discard any value names that are set
+  // (apart from those of global values). Intended for production
+  // compiles, where names serve no purpose.
+  void setDiscardValueNames(bool discard);
+
+  // Run the Bnode simplifier (see go-llvm-simplify.h) on each
+  // function body prior to generating IR for it. Off by default.
+  void setSimplifyNodes(bool simplify) { simplifyNodes_ = simplify; }
+
+  // Install a callback to be invoked on each function once its body
+  // has been completely generated (by function_set_body). This is used
+  // to support streaming code generation in the driver, where the
+  // callback may compile the function and then drop its IR body. When
+  // a callback is installed, the Bstatements for the function are
+  // freed prior to invoking it.
+  typedef std::function<void(llvm::Function *)> FcnCompletionHook;
+  void setFunctionCompletionHook(FcnCompletionHook hook) {
+    fcnCompletionHook_ = hook;
+  }
+
+  // Timers for the major phases of IR generation, collected when
+  // enabled via enableTimers() (for -ftime-report). Timers are
+  // reported via llvm::TimerGroup::printAll; the caller should then
+  // invoke llvm::TimerGroup::clearAll, so that the report isn't
+  // printed a second time when the backend is destroyed.
+  enum BackendTimer {
+    FcnSetBodyTimer,     // function_set_body (total)
+    GenBlocksTimer,      // GenBlocks::walk
+    TreeIntegrityTimer,  // enforceTreeIntegrity
+    DIBuildTimer,        // DIBuildHelper
+    PlaceholderTimer,    // placeholder type resolution
+    SimplifyTimer,       // Bnode simplification
+    NumBackendTimers
+  };
+  void enableTimers();
+
+  // Returns the specified timer, or null if timers are not enabled.
+  llvm::Timer *timer(BackendTimer which) const {
+    return timers_.empty() ? nullptr : timers_[which].get();
+  }
+
   // Return true if this is a module-scope value such as a constant
   bool moduleScopeValue(llvm::Value *val, Btype *btype) const;
 
@@ -404,11 +470,18 @@ public:
   // the specified expr in a table keyed by <llvm::Value,Btype>. If
   // the lookup succeeds, the cached value is returned, otherwise the
   // specified Bexpression is installed in the table and returned.
+  // Expressions owned by a function (see BnodeBuilder) are not cached.
   Bexpression *makeGlobalExpression(Bexpression *expr,
                                    llvm::Value *val,
                                    Btype *btype,
                                    Location location);
 
+  // Record the function whose body is being generated (see curFcn_).
+  void setCurFcn(Bfunction *func) {
+    curFcn_ = func;
+    nbuilder_.setCurrentFunction(func);
+  }
+
   enum ModVarConstant { MV_Constant, MV_NonConstant };
   enum ModVarSec { MV_UniqueSection, MV_DefaultSection };
   enum ModVarComdat { MV_InComdat, MV_NotInComdat };
@@ -596,37 +669,11 @@ public:
   llvm::Instruction *storeToTemporary(Bfunction *func, llvm::Value *val);
 
 private:
-  template <typename T1, typename T2> class pairvalmap_hash {
-    typedef std::pair<T1, T2> pairtype;
-
-  public:
-    unsigned int operator()(const pairtype &p) const {
-      std::size_t h1 = std::hash<T1>{}(p.first);
-      std::size_t h2 = std::hash<T2>{}(p.second);
-      return h1 + h2;
-    }
-  };
-
-  template <typename T1, typename T2> class pairvalmap_equal {
-    typedef std::pair<T1, T2> pairtype;
-
-  public:
-    bool operator()(const pairtype &p1, const pairtype &p2) const {
-      return (p1.first == p2.first && p1.second == p2.second);
-    }
-  };
-
-  template <typename T1, typename T2, typename V>
-  using pairvalmap =
-      std::unordered_map<std::pair<T1, T2>, V, pairvalmap_hash<T1, T2>,
-                         pairvalmap_equal<T1, T2>>;
-
-  typedef std::pair<llvm::Type *, bool> type_plus_unsigned;
-  typedef pairvalmap<llvm::Type *, bool, Btype *> integer_type_maptyp;
-
+  // Note: DenseMapInfo for std::pair mixes the hashes of the two
+  // members (as opposed to just adding them), so pointer pairs that
+  // differ only by a swap or a constant offset don't collide.
   typedef std::pair<llvm::Value *, Btype *> valbtype;
-  typedef pairvalmap<llvm::Value *, Btype *, Bexpression *>
-  btyped_value_expr_maptyp;
+  typedef llvm::DenseMap<valbtype, Bexpression *> btyped_value_expr_maptyp;
 
   // Context information needed for the LLVM backend.
   llvm::LLVMContext &context_;
@@ -667,8 +714,14 @@ private:
   // disabled for unit testing.
   bool createDebugMetaData_;
 
-  // Whether we've started / finalized export data for the module.
-  bool exportDataStarted_;
+  // Whether to simplify Bnode trees prior to IR generation, along
+  // with counts of the rewrites performed.
+  bool simplifyNodes_;
+  SimplifyStats simplifyStats_;
+
+  // Export data for the module (accumulated by write_export_data),
+  // and whether it has been finalized.
+  std::string exportData_;
   bool exportDataFinalized_;
 
   // This counter gets incremented when the FE requests an error
@@ -702,15 +755,17 @@ private:
 
   // Map from LLVM values to Bvariable. This is used for
   // module-scope variables, not vars local to a function.
-  std::unordered_map<llvm::Value *, Bvariable *> valueVarMap_;
+  llvm::DenseMap<llvm::Value *, Bvariable *> valueVarMap_;
 
   // Table for commoning strings by value. String constants have
   // concrete types like "[5 x i8]", whereas we would like to return
   // things that have type "i8*". To manage this, we eagerly create
   // module-scope vars with strings, but this tends to defeat the
-  // caching mechanisms, so here we have a map from constant string
-  // value to Bexpression holding that string const.
-  std::unordered_map<llvm::Value *, Bexpression*> stringConstantMap_;
+  // caching mechanisms, so here we have a map from string contents
+  // to Bexpression holding that string const. Keying on the contents
+  // (as opposed to the LLVM constant) means that repeated literals
+  // can be looked up without first manufacturing an LLVM constant.
+  llvm::StringMap<Bexpression*> stringConstantMap_;
 
   // For caching of immutable struct references. Similar situation here
   // as above, in that we can't look for such things in valueVarMap_
@@ -733,8 +788,17 @@ private:
 
   // Pointer to current function being generated. Used for sanity checking,
   // to catch cases where the front end switches between functions in
-  // an expected way.
+  // an expected way, and passed on to the node builder (expressions
+  // are allocated in the current function's arena).
   Bfunction *curFcn_;
+
+  // Invoked on each function once its body is complete (may be empty).
+  FcnCompletionHook fcnCompletionHook_;
+
+  // Timers for -ftime-report (empty unless enabled). Note that the
+  // group has to outlive the timers.
+  std::unique_ptr<llvm::TimerGroup> timerGroup_;
+  std::vector<std::unique_ptr<llvm::Timer> > timers_;
 };
 
 #endif
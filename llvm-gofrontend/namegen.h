@@ -16,13 +16,16 @@
 
 class NameGen {
  public:
-  NameGen() { }
+  NameGen() : discardNames_(false) { }
 
   // Tells namegen to choose its own version number for the created name
   static constexpr unsigned ChooseVer = 0xffffffff;
 
-  // For creating useful type, inst and block names.
+  // For creating useful type, inst and block names. Returns an empty
+  // name (without doing any formatting) if names are being discarded.
   std::string namegen(const std::string &tag, unsigned expl = ChooseVer) {
+    if (discardNames_)
+      return std::string();
     auto it = nametags_.find(tag);
     unsigned count = 0;
     if (it != nametags_.end())
@@ -40,9 +43,15 @@ class NameGen {
     return const_cast<NameGen*>(this);
   }
 
+  // Names are of no use in production builds; setting this skips
+  // name generation entirely (see Llvm_backend::setDiscardValueNames).
+  void setDiscardNames(bool discard) { discardNames_ = discard; }
+  bool discardNames() const { return discardNames_; }
+
  private:
   // Key is tag (ex: "add") and val is counter to uniquify.
   std::unordered_map<std::string, unsigned> nametags_;
+  bool discardNames_;
 };
 
 
@@ -36,6 +36,7 @@ compilation path.
 import getopt
 import os
 import re
+import socket
 import subprocess
 import sys
 
@@ -53,6 +54,9 @@ flag_nollvm = False
 # trace llvm-goparse invocations
 flag_trace_llinvoc = False
 
+# Unix socket of llvm-goparse compile server (if any)
+flag_server_socket = None
+
 
 def docmd(cmd):
   """Execute a command."""
@@ -63,6 +67,36 @@ def docmd(cmd):
   u.docmd(cmd)
 
 
+def invoke_server(nargs):
+  """Send compile job to llvm-goparse server, return exit status.
+
+  Job is sent as a series of NUL-terminated strings (cwd, then args);
+  reply is exit status on first line, followed by diagnostic output.
+  """
+  job = os.getcwd() + "\0" + "".join(a + "\0" for a in nargs[1:])
+  try:
+    sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+    sock.connect(flag_server_socket)
+    sock.sendall(job)
+    sock.shutdown(socket.SHUT_WR)
+    chunks = []
+    while True:
+      chunk = sock.recv(4096)
+      if not chunk:
+        break
+      chunks.append(chunk)
+    sock.close()
+  except socket.error as err:
+    u.error("unable to talk to llvm-goparse server at %s: %s"
+            % (flag_server_socket, err))
+  reply = "".join(chunks)
+  nl = reply.find("\n")
+  if nl == -1:
+    u.error("malformed reply from llvm-goparse server")
+  sys.stderr.write(reply[nl+1:])
+  return int(reply[:nl])
+
+
 def form_golibargs(driver):
   """Form correct go library args."""
   ddir = os.path.dirname(driver)
@@ -109,7 +143,6 @@ def perform():
   nargs = []
   skipc = 0
   outfile = None
-  asmfile = None
   for ii in range(1, len(sys.argv)):
     clarg = sys.argv[ii]
     if skipc != 0:
@@ -118,17 +151,19 @@ def perform():
     if clarg == "-o":
       skipc = 1
       outfile = sys.argv[ii+1]
-      asmfile = "%s.s" % outfile
       nargs.append("-o")
-      nargs.append(asmfile)
+      nargs.append(outfile)
       continue
     nargs.append(clarg)
 
-  if not asmfile or not outfile:
+  if not outfile:
     u.error("fatal error: unable to find -o "
             "option in clargs: %s" % " ".join(sys.argv))
   golibargs = form_golibargs(sys.argv[0])
   nargs += golibargs
+
+  # Emit an object file directly (no separate assembler step).
+  nargs.append("-filetype=obj")
   u.verbose(1, "revised args: %s" % " ".join(nargs))
 
   # Invoke gollvm.
@@ -137,19 +172,14 @@ def perform():
   nargs = ["llvm-goparse"] + nargs
   if flag_trace_llinvoc:
     u.verbose(0, "+ %s" % " ".join(nargs))
-  rc = subprocess.call(nargs)
+  if flag_server_socket:
+    rc = invoke_server(nargs)
+  else:
+    rc = subprocess.call(nargs)
   if rc != 0:
     u.verbose(1, "return code %d from %s" % (rc, " ".join(nargs)))
     return 1
 
-  # Invoke the assembler
-  ascmd = "as %s -o %s" % (asmfile, outfile)
-  u.verbose(1, "asm command is: %s" % ascmd)
-  rc = u.docmdnf(ascmd)
-  if rc != 0:
-    u.verbose(1, "return code %d from %s" % (rc, ascmd))
-    return 1
-
   return 0
 
 
@@ -213,6 +243,8 @@ def usage(msgarg):
     -e          show commands being invoked
     -D          dry run (echo cmds but do not execute)
     -G          pure gccgo compile (no llvm-goparse invocations)
+    -S X        send compile jobs to llvm-goparse server on socket X
+                (server started via "llvm-goparse -server=X")
 
     """ % os.path.basename(sys.argv[0])
   sys.exit(1)
@@ -221,6 +253,7 @@ def usage(msgarg):
 def parse_env_options():
   """Option parsing from env var."""
   global flag_echo, flag_dryrun, flag_nollvm, flag_trace_llinvoc
+  global flag_server_socket
 
   optstr = os.getenv("GOLLVM_WRAP_OPTIONS")
   if not optstr:
@@ -228,12 +261,12 @@ def parse_env_options():
   args = optstr.split()
 
   try:
-    optlist, _ = getopt.getopt(args, "detDG")
+    optlist, _ = getopt.getopt(args, "detDGS:")
   except getopt.GetoptError as err:
     # unrecognized option
     usage(str(err))
 
-  for opt, _ in optlist:
+  for opt, arg in optlist:
     if opt == "-d":
       u.increment_verbosity()
     elif opt == "-e":
@@ -244,6 +277,8 @@ def parse_env_options():
       flag_dryrun = True
     elif opt == "-G":
       flag_nollvm = True
+    elif opt == "-S":
+      flag_server_socket = arg
   u.verbose(1, "env var options parsing complete")
 
 
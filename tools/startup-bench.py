@@ -0,0 +1,128 @@
+#!/usr/bin/python
+"""Benchmark llvm-goparse startup time.
+
+Runs llvm-goparse repeatedly on a trivial Go package, collecting the
+time elapsed between entry to main() and the start of parsing (as
+reported by the hidden "-fstartup-time" option), along with the total
+wall clock time for each invocation. Prints min/median/max for both.
+
+Usage:
+
+   startup-bench.py [-n N] [-b path-to-llvm-goparse] [-- extra args]
+
+"""
+
+import getopt
+import os
+import re
+import shutil
+import subprocess
+import sys
+import tempfile
+import time
+
+import script_utils as u
+
+# Number of iterations
+flag_iterations = 50
+
+# llvm-goparse binary to run
+flag_binary = "llvm-goparse"
+
+# Additional args to pass to llvm-goparse
+flag_extra_args = []
+
+gosrc = """\
+package p
+
+func F(x int) int { return x + 1 }
+"""
+
+startre = re.compile(r"^startup time: (\d+) us$")
+
+
+def summarize(tag, vals):
+  """Print min/median/max for a list of values (microseconds)."""
+  svals = sorted(vals)
+  print "%-8s min %8d us   median %8d us   max %8d us" % (
+      tag, svals[0], svals[len(svals) // 2], svals[-1])
+
+
+def perform():
+  """Main driver routine."""
+  tdir = tempfile.mkdtemp(prefix="startup-bench")
+  try:
+    srcfile = os.path.join(tdir, "p.go")
+    outfile = os.path.join(tdir, "p.s")
+    with open(srcfile, "w") as wf:
+      wf.write(gosrc)
+    args = ([flag_binary, "-fstartup-time", "-o", outfile] +
+            flag_extra_args + [srcfile])
+    u.verbose(1, "cmd: %s" % " ".join(args))
+    startups = []
+    totals = []
+    for _ in range(flag_iterations):
+      t0 = time.time()
+      proc = subprocess.Popen(args, stderr=subprocess.PIPE)
+      _, perr = proc.communicate()
+      t1 = time.time()
+      if proc.returncode != 0:
+        u.error("command failed (rc=%d): %s\n%s" %
+                (proc.returncode, " ".join(args), perr))
+      for line in perr.splitlines():
+        m = startre.match(line.strip())
+        if m:
+          startups.append(int(m.group(1)))
+      totals.append(int((t1 - t0) * 1000000))
+    if not startups:
+      u.error("no startup time reported (is -fstartup-time supported?)")
+    print "%d iterations of: %s" % (flag_iterations, " ".join(args))
+    summarize("startup", startups)
+    summarize("total", totals)
+  finally:
+    shutil.rmtree(tdir)
+  return 0
+
+
+def usage(msgarg):
+  """Print usage and exit."""
+  if msgarg:
+    sys.stderr.write("error: %s\n" % msgarg)
+  print """\
+    usage:  %s [options] [-- extra llvm-goparse args]
+
+    options:
+    -d    increase debug msg verbosity level
+    -n N  run N iterations (default: %d)
+    -b X  use llvm-goparse binary X (default: %s)
+
+    """ % (os.path.basename(sys.argv[0]), flag_iterations, flag_binary)
+  sys.exit(1)
+
+
+def parse_args():
+  """Command line argument parsing."""
+  global flag_iterations, flag_binary, flag_extra_args
+
+  try:
+    optlist, args = getopt.getopt(sys.argv[1:], "dn:b:")
+  except getopt.GetoptError as err:
+    # unrecognized option
+    usage(str(err))
+
+  for opt, arg in optlist:
+    if opt == "-d":
+      u.increment_verbosity()
+    elif opt == "-n":
+      flag_iterations = int(arg)
+      if flag_iterations < 1:
+        usage("bad -n value %s" % arg)
+    elif opt == "-b":
+      flag_binary = arg
+  flag_extra_args = args
+
+
+# Setup
+u.setdeflanglocale()
+parse_args()
+sys.exit(perform())
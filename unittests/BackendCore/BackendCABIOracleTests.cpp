@@ -436,5 +436,115 @@ TEST(BackendCABIOracleTests, CallBuiltinFunction) {
   EXPECT_FALSE(broken && "Module failed to verify.");
 }
 
+TEST(BackendCABIOracleTests, OracleCaching) {
+  LLVMContext C;
+  std::unique_ptr<Llvm_backend> bep(new Llvm_backend(C, nullptr, nullptr));
+  Llvm_backend *be = bep.get();
+  TypeManager *tm = be->typeManager();
+
+  Btype *bi8t = be->integer_type(false, 8);
+  Btype *bf64t = be->float_type(64);
+  Btype *st2 = mkBackendStruct(be, bf64t, "f1", bf64t, "f2", nullptr);
+  BFunctionType *bft = mkFuncTyp(be, L_PARM, bi8t, L_PARM, st2,
+                                 L_RES, st2, L_END);
+
+  // Repeated requests for the same function type should yield the
+  // same oracle (owned by the type manager), with the same results as
+  // a freshly constructed one.
+  std::unique_ptr<CABIOracle> owned;
+  CABIOracle *o1 = tm->abiOracle(bft, &owned);
+  CABIOracle *o2 = tm->abiOracle(bft, &owned);
+  EXPECT_EQ(o1, o2);
+  EXPECT_TRUE(owned == nullptr);
+  CABIOracle cab(bft, tm);
+  EXPECT_EQ(o1->toString(), cab.toString());
+  EXPECT_EQ(o1->getFunctionTypeForABI(), cab.getFunctionTypeForABI());
+
+  // Functions with the same type share the oracle with call sites.
+  Bfunction *f1 = mkFunci32o64(be, "foo");
+  Bfunction *f2 = mkFunci32o64(be, "bar");
+  EXPECT_EQ(f1->fcnType(), f2->fcnType());
+  EXPECT_EQ(tm->abiOracle(f1->fcnType(), &owned),
+            tm->abiOracle(f2->fcnType(), &owned));
+  EXPECT_TRUE(owned == nullptr);
+
+  // A struct with a placeholder struct field is not itself a
+  // placeholder (nor is a function type that takes it by value), but
+  // it has no layout until the placeholder is resolved, so the oracle
+  // can't be memoized until then.
+  Location loc;
+  Btype *phst = be->placeholder_struct_type("ph", loc);
+  Btype *st3 = mkBackendStruct(be, phst, "f1", bi8t, "f2", nullptr);
+  EXPECT_FALSE(st3->isPlaceholder());
+  std::vector<Backend::Btyped_identifier> params = {
+      Backend::Btyped_identifier("p1", st3, loc)};
+  std::vector<Backend::Btyped_identifier> results = {
+      Backend::Btyped_identifier("r1", bi8t, loc)};
+  Backend::Btyped_identifier receiver("", nullptr, loc);
+  BFunctionType *pft =
+      tm->functionType(receiver, params, results, nullptr,
+                       false, loc)->castToBFunctionType();
+  ASSERT_TRUE(pft != nullptr);
+  EXPECT_FALSE(pft->isPlaceholder());
+  std::unique_ptr<CABIOracle> owned1, owned2;
+  CABIOracle *po1 = tm->abiOracle(pft, &owned1);
+  CABIOracle *po2 = tm->abiOracle(pft, &owned2);
+  EXPECT_EQ(po1, owned1.get());
+  EXPECT_EQ(po2, owned2.get());
+  EXPECT_NE(po1, po2);
+
+  // Once the placeholder is resolved the oracle is memoized.
+  std::vector<Backend::Btyped_identifier> fields = {
+      Backend::Btyped_identifier("x", bf64t, loc)};
+  be->set_placeholder_struct_type(phst, fields);
+  std::unique_ptr<CABIOracle> owned3;
+  CABIOracle *po3 = tm->abiOracle(pft, &owned3);
+  EXPECT_TRUE(owned3 == nullptr);
+  EXPECT_EQ(po3, tm->abiOracle(pft, &owned3));
+  EXPECT_TRUE(owned3 == nullptr);
+}
+
+TEST(BackendCABIOracleTests, DISABLED_ClassificationThroughput) {
+  LLVMContext C;
+  std::unique_ptr<Llvm_backend> bep(new Llvm_backend(C, nullptr, nullptr));
+  Llvm_backend *be = bep.get();
+  TypeManager *tm = be->typeManager();
+
+  Btype *bi8t = be->integer_type(false, 8);
+  Btype *bu64t = be->integer_type(true, 64);
+  Btype *bf32t = be->float_type(32);
+  Btype *bf64t = be->float_type(64);
+  Btype *st1 = mkBackendStruct(be, bi8t, "a", bf32t, "b", bu64t, "c", nullptr);
+  Btype *st2 = mkBackendStruct(be, bf64t, "f1", bf64t, "f2", nullptr);
+  Btype *st3 = mkBackendStruct(be, st2, "f1", st1, "f2", nullptr);
+  std::vector<BFunctionType *> ftypes = {
+    mkFuncTyp(be, L_END),
+    mkFuncTyp(be, L_PARM, bu64t, L_RES, bu64t, L_END),
+    mkFuncTyp(be, L_PARM, bi8t, L_PARM, bf32t, L_PARM, st1, L_END),
+    mkFuncTyp(be, L_PARM, st2, L_PARM, st2, L_RES, st2, L_END),
+    mkFuncTyp(be, L_PARM, st3, L_PARM, bf64t, L_RES, st3, L_END),
+  };
+
+  // Each iteration classifies every function type in the list; both
+  // flavors should come up with the same number of ABI params.
+  const unsigned iters = 200000;
+  unsigned freshArgs = 0, memoArgs = 0;
+  runBenchmark("fresh oracle", "classifications", iters, [&]() {
+    for (auto ft : ftypes) {
+      CABIOracle cab(ft, tm);
+      freshArgs += cab.getFunctionTypeForABI()->getNumParams();
+    }
+    return unsigned(ftypes.size());
+  });
+  std::unique_ptr<CABIOracle> owned;
+  runBenchmark("memoized oracle", "classifications", iters, [&]() {
+    for (auto ft : ftypes)
+      memoArgs +=
+          tm->abiOracle(ft, &owned)->getFunctionTypeForABI()->getNumParams();
+    return unsigned(ftypes.size());
+  });
+  EXPECT_EQ(freshArgs, memoArgs);
+  EXPECT_TRUE(owned == nullptr);
+}
 
 }
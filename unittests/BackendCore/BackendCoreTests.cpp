@@ -9,6 +9,8 @@
 
 #include "TestUtils.h"
 #include "go-llvm-backend.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/Module.h"
 #include "gtest/gtest.h"
 
 using namespace llvm;
@@ -101,6 +103,68 @@ TEST(BackendCoreTests, TypeHashAndCompare) {
   Btype *st2 = mkBackendThreeFieldStruct(be.get());
   EXPECT_EQ(st1->hash(), st2->hash());
   EXPECT_TRUE(st1->equal(*st1));
+
+  // Same LLVM type, different Btypes: should not be equal, and
+  // ideally should not hash to the same bucket either.
+  Btype *s32 = be->integer_type(false, 32);
+  Btype *u32 = be->integer_type(true, 32);
+  EXPECT_EQ(s32->type(), u32->type());
+  EXPECT_FALSE(s32->equal(*u32));
+  EXPECT_NE(s32->hash(), u32->hash());
+
+  // Anonymous types are hash-consed, so composite types built from
+  // the same components are the same object.
+  Btype *pst1 = be->pointer_type(st1);
+  Btype *pst2 = be->pointer_type(st2);
+  EXPECT_EQ(pst1, pst2);
+  Bexpression *val4 = mkInt64Const(be.get(), int64_t(4));
+  EXPECT_EQ(be->array_type(pst1, val4), be->array_type(pst2, val4));
+
+  // A named type is distinct from its underlying type, as are
+  // composites built from it.
+  Location loc;
+  Btype *nt = be->named_type("T", st1, loc);
+  EXPECT_NE(nt, st1);
+  EXPECT_FALSE(nt->equal(*st1));
+  EXPECT_NE(be->pointer_type(nt), pst1);
+}
+
+TEST(BackendCoreTests, PlaceholderResolvesToExistingType) {
+  LLVMContext C;
+
+  std::unique_ptr<Backend> be(go_get_backend(C));
+  Location loc;
+
+  // Create two pointers to placeholder 'ph1' that end up with
+  // different LLVM types (the second is created after ph1 has been
+  // redirected to placeholder 'ph2'), so both are hashed.
+  Btype *bi32t = be->integer_type(false, 32);
+  Btype *ph1 = be->placeholder_pointer_type("ph1", loc, false);
+  Btype *ph2 = be->placeholder_pointer_type("ph2", loc, false);
+  Btype *p1 = be->pointer_type(ph1);
+  be->set_placeholder_pointer_type(ph1, ph2);
+  Btype *p2 = be->pointer_type(ph1);
+  EXPECT_NE(p1, p2);
+  EXPECT_NE(p1->type(), p2->type());
+
+  // Resolving ph2 resolves both pointers into the same type.
+  be->set_placeholder_pointer_type(ph2, be->pointer_type(bi32t));
+  ASSERT_FALSE(p1->isPlaceholder());
+  ASSERT_FALSE(p2->isPlaceholder());
+  EXPECT_EQ(p1->type(), p2->type());
+  EXPECT_TRUE(p1->equal(*p2));
+
+  // Composite types built from either should unify.
+  Btype *pp1 = be->pointer_type(p1);
+  Btype *pp2 = be->pointer_type(p2);
+  EXPECT_EQ(pp1, pp2);
+  Bexpression *val4 = mkInt64Const(be.get(), int64_t(4));
+  EXPECT_EQ(be->array_type(p1, val4), be->array_type(p2, val4));
+  std::vector<Backend::Btyped_identifier> fields1 = {
+      Backend::Btyped_identifier("f", p1, loc)};
+  std::vector<Backend::Btyped_identifier> fields2 = {
+      Backend::Btyped_identifier("f", p2, loc)};
+  EXPECT_EQ(be->struct_type(fields1), be->struct_type(fields2));
 }
 
 TEST(BackendCoreTests, ComplexTypes) {
@@ -221,6 +285,137 @@ TEST(BackendCoreTests, PlaceholderTypes) {
   EXPECT_EQ(php4->type(), cpt->type());
 }
 
+// Returns the value of the "key=N" entry in a statistics string.
+unsigned statValue(const std::string &stats, const std::string &key)
+{
+  size_t pos = stats.find(" " + key + "=");
+  EXPECT_TRUE(pos != std::string::npos);
+  if (pos == std::string::npos)
+    return 0;
+  return std::stoul(stats.substr(pos + key.size() + 2));
+}
+
+TEST(BackendCoreTests, PlaceholderTypeStress) {
+  LLVMContext C;
+
+  std::unique_ptr<Llvm_backend> be(new Llvm_backend(C, nullptr, nullptr));
+  Location loc;
+
+  // Build a long chain of placeholder pointer types, each redirected
+  // to the next placeholder in the chain:
+  //
+  //   P_0 -> P_1 -> ... -> P_{n-1}
+  //
+  // None of these can be resolved until the last one is given a
+  // concrete target; that single call then has to concretize the
+  // entire chain (which would recurse n levels deep if resolution
+  // were done on the C++ stack).
+  const unsigned numTypes = 8192;
+  std::vector<Btype *> pointers;
+  for (unsigned idx = 0; idx < numTypes; ++idx)
+    pointers.push_back(be->placeholder_pointer_type("P", loc, false));
+  for (unsigned idx = 0; idx + 1 < numTypes; ++idx) {
+    be->set_placeholder_pointer_type(pointers[idx], pointers[idx + 1]);
+    EXPECT_TRUE(pointers[idx]->isPlaceholder());
+  }
+
+  std::string before = be->statistics();
+  Btype *bi64t = be->integer_type(false, 64);
+  be->set_placeholder_pointer_type(pointers[numTypes - 1],
+                                   be->pointer_type(bi64t));
+  std::string after = be->statistics();
+
+  for (unsigned idx = 0; idx < numTypes; ++idx)
+    EXPECT_FALSE(pointers[idx]->isPlaceholder());
+
+  // Everything was resolved in one wave, visiting each referrer once,
+  // with the worklist never holding more than a single type.
+  EXPECT_EQ(statValue(after, "resolveWaves"),
+            statValue(before, "resolveWaves") + 1);
+  EXPECT_EQ(statValue(after, "resolvedTypes"),
+            statValue(before, "resolvedTypes") + numTypes - 1);
+  EXPECT_EQ(statValue(after, "resolveVisits"),
+            statValue(before, "resolveVisits") + numTypes - 1);
+  EXPECT_EQ(statValue(after, "maxResolveWorklist"), 1u);
+}
+
+TEST(BackendCoreTests, PlaceholderStructGraphStress) {
+  LLVMContext C;
+
+  std::unique_ptr<Llvm_backend> be(new Llvm_backend(C, nullptr, nullptr));
+  Location loc;
+
+  // Build a graph of mutually referencing named types, along the
+  // lines of
+  //
+  //   type S_i struct { f0 *S_a; f1 *S_{i-1}; f2 *S_i; f3 *S_b }
+  //
+  // where each *S_j is a placeholder pointer P_j that is eventually
+  // redirected to a pointer to placeholder struct S_j. Every struct
+  // has a back-edge to its predecessor and one to itself. The struct
+  // bodies and the pointer targets are filled in in scrambled order,
+  // so some structs see all of their fields resolved up front and
+  // others are only concretized once their last pointer is resolved.
+  const unsigned numStructs = 2048;
+  const unsigned numFields = 4;
+  std::vector<Btype *> structs;
+  std::vector<Btype *> pointers;
+  for (unsigned idx = 0; idx < numStructs; ++idx) {
+    structs.push_back(be->placeholder_struct_type("S", loc));
+    pointers.push_back(be->placeholder_pointer_type("P", loc, false));
+  }
+
+  std::string before = be->statistics();
+
+  // Visit the 2*numStructs operations (set body of S_i / resolve P_i)
+  // in the order given by an odd stride modulo a power of two.
+  const unsigned numOps = 2 * numStructs;
+  for (unsigned k = 0; k < numOps; ++k) {
+    unsigned op = (k * 1237 + 511) % numOps;
+    if (op < numStructs) {
+      unsigned idx = op;
+      unsigned targets[numFields] = { (idx * 7 + 1) % numStructs,
+                                      (idx + numStructs - 1) % numStructs,
+                                      idx,
+                                      (idx * 13 + 5) % numStructs };
+      std::vector<Backend::Btyped_identifier> fields;
+      for (unsigned fidx = 0; fidx < numFields; ++fidx) {
+        std::string fname = "f" + std::to_string(fidx);
+        fields.push_back(Backend::Btyped_identifier(fname,
+                                                    pointers[targets[fidx]],
+                                                    loc));
+      }
+      be->set_placeholder_struct_type(structs[idx], fields);
+    } else {
+      unsigned idx = op - numStructs;
+      be->set_placeholder_pointer_type(pointers[idx],
+                                       be->pointer_type(structs[idx]));
+      EXPECT_FALSE(pointers[idx]->isPlaceholder());
+    }
+  }
+
+  std::string after = be->statistics();
+
+  for (unsigned idx = 0; idx < numStructs; ++idx) {
+    EXPECT_FALSE(structs[idx]->isPlaceholder());
+    llvm::StructType *llst =
+        llvm::cast<llvm::StructType>(structs[idx]->type());
+    EXPECT_FALSE(llst->isOpaque());
+    EXPECT_EQ(llst->getNumElements(), numFields);
+  }
+
+  // Each field is recorded as a reference at most once, and each
+  // reference is visited at most once, so the resolver's work is
+  // bounded by the number of edges in the graph.
+  const unsigned numEdges = numStructs * numFields;
+  unsigned visits = statValue(after, "resolveVisits") -
+      statValue(before, "resolveVisits");
+  EXPECT_GT(visits, 0u);
+  EXPECT_LE(visits, numEdges);
+  EXPECT_LE(statValue(after, "resolvedTypes") -
+            statValue(before, "resolvedTypes"), numStructs);
+}
+
 TEST(BackendCoreTests, ArrayTypes) {
   LLVMContext C;
 
@@ -294,4 +489,133 @@ TEST(BackendCoreTests, TypeUtils) {
   Btype *u32 = be->integer_type(true, 32);
   EXPECT_EQ(be->type_field_alignment(u32), 4);
 }
+
+TEST(BackendCoreTests, TypeQueryCaching) {
+  LLVMContext C;
+
+  std::unique_ptr<Llvm_backend> be(new Llvm_backend(C, nullptr, nullptr));
+  Location loc;
+  Btype *bi32t = be->integer_type(false, 32);
+  Btype *bi64t = be->integer_type(false, 64);
+
+  // Repeated queries should produce the same answers
+  Btype *st = mkTwoFieldStruct(be.get(), bi32t, bi64t);
+  for (unsigned i = 0; i < 3; ++i) {
+    EXPECT_EQ(be->type_size(st), int64_t(16));
+    EXPECT_EQ(be->type_alignment(st), 8);
+    EXPECT_EQ(be->type_field_alignment(st), 8);
+    EXPECT_EQ(be->type_field_offset(st, 1), int64_t(8));
+    EXPECT_EQ(be->typToString(st), "struct{int32,int64}");
+  }
+
+  // Naming a type changes its string representation
+  be->named_type("T", st, loc);
+  EXPECT_EQ(be->typToString(st), "T");
+
+  // Placeholder struct, queried before and after it is filled in
+  Btype *phst = be->placeholder_struct_type("ph", loc);
+  Btype *php = be->pointer_type(phst);
+  EXPECT_EQ(be->type_size(php), int64_t(8));
+  EXPECT_EQ(be->typToString(php), "*struct{}");
+  std::vector<Backend::Btyped_identifier> fields = {
+      Backend::Btyped_identifier("f1", bi64t, loc),
+      Backend::Btyped_identifier("f2", bi64t, loc)};
+  be->set_placeholder_struct_type(phst, fields);
+  EXPECT_EQ(be->type_size(phst), int64_t(16));
+  EXPECT_EQ(be->typToString(php), "*struct{int64,int64}");
+}
+
+TEST(BackendCoreTests, ExportData) {
+  LLVMContext C;
+
+  std::unique_ptr<Llvm_backend> be(new Llvm_backend(C, nullptr, nullptr));
+  be->write_export_data("v2;\n", 4);
+  be->write_export_data("package \"foo\"\n", 14);
+  be->finalizeExportData();
+
+  // Export data should be emitted as a single blob in ".go_export",
+  // retained via llvm.compiler.used.
+  llvm::GlobalVariable *gv =
+      be->module().getGlobalVariable("go_export", true);
+  ASSERT_TRUE(gv != nullptr);
+  EXPECT_EQ(gv->getSection(), ".go_export");
+  llvm::ConstantDataArray *cda =
+      llvm::dyn_cast<llvm::ConstantDataArray>(gv->getInitializer());
+  ASSERT_TRUE(cda != nullptr);
+  EXPECT_EQ(cda->getAsString(), "v2;\npackage \"foo\"\n");
+  EXPECT_TRUE(be->module().getGlobalVariable("llvm.compiler.used") != nullptr);
+
+  // ELF: the section is declared with the "exclude" flag.
+  EXPECT_NE(be->module().getModuleInlineAsm().find("\"e\",@progbits"),
+            std::string::npos);
+}
+
+TEST(BackendCoreTests, ExportDataNonELF) {
+  LLVMContext C;
+
+  // Mach-O: gccgo's segment/section names, and no ELF directives.
+  std::unique_ptr<Llvm_backend> be(new Llvm_backend(C, nullptr, nullptr));
+  be->module().setTargetTriple("x86_64-apple-macosx10.12.0");
+  be->write_export_data("v2;\n", 4);
+  be->finalizeExportData();
+  llvm::GlobalVariable *gv =
+      be->module().getGlobalVariable("go_export", true);
+  ASSERT_TRUE(gv != nullptr);
+  EXPECT_EQ(gv->getSection(), "__GNU_GO,__go_export");
+  EXPECT_TRUE(be->module().getModuleInlineAsm().empty());
+
+  // COFF: plain ".go_export" section.
+  LLVMContext C2;
+  std::unique_ptr<Llvm_backend> be2(new Llvm_backend(C2, nullptr, nullptr));
+  be2->module().setTargetTriple("x86_64-pc-windows-msvc");
+  be2->write_export_data("v2;\n", 4);
+  be2->finalizeExportData();
+  gv = be2->module().getGlobalVariable("go_export", true);
+  ASSERT_TRUE(gv != nullptr);
+  EXPECT_EQ(gv->getSection(), ".go_export");
+  EXPECT_TRUE(be2->module().getModuleInlineAsm().empty());
+}
+
+// Micro-benchmark for the anonymous type and global value caches;
+// disabled by default. Run with --gtest_also_run_disabled_tests.
+
+TEST(BackendCoreTests, DISABLED_CacheLookupThroughput) {
+  LLVMContext C;
+
+  std::unique_ptr<Llvm_backend> be(new Llvm_backend(C, nullptr, nullptr));
+  Location loc;
+
+  const unsigned numTypes = 1u << 14;
+  const unsigned iters = 20;
+  Btype *bi64t = be->integer_type(false, 64);
+  std::vector<Bexpression *> lens;
+  std::vector<Btype *> types;
+  for (unsigned idx = 0; idx < numTypes; ++idx) {
+    lens.push_back(mkInt64Const(be.get(), idx + 1));
+    types.push_back(be->array_type(bi64t, lens.back()));
+  }
+
+  unsigned hits = runBenchmark("array type", "lookups", iters, [&]() {
+    unsigned hits = 0;
+    for (unsigned idx = 0; idx < numTypes; ++idx)
+      hits += (be->array_type(bi64t, lens[idx]) == types[idx]);
+    return hits;
+  });
+  EXPECT_EQ(hits, iters * numTypes);
+  hits = runBenchmark("pointer type", "lookups", iters, [&]() {
+    unsigned hits = 0;
+    for (unsigned idx = 0; idx < numTypes; ++idx)
+      hits += (be->pointer_type(types[idx]) == be->pointer_type(types[idx]));
+    return hits;
+  });
+  EXPECT_EQ(hits, iters * numTypes);
+  hits = runBenchmark("int constant", "lookups", iters, [&]() {
+    unsigned hits = 0;
+    for (unsigned idx = 0; idx < numTypes; ++idx)
+      hits += be->moduleScopeValue(lens[idx]->value(), bi64t);
+    return hits;
+  });
+  EXPECT_EQ(hits, iters * numTypes);
+}
+
 }
@@ -11,6 +11,7 @@
 #include "go-llvm-backend.h"
 #include "llvm/IR/Constants.h"
 #include "llvm/IR/Function.h"
+#include "llvm/IR/GlobalVariable.h"
 #include "gtest/gtest.h"
 
 //using namespace llvm;
@@ -916,6 +917,15 @@ TEST(BackendExprTests, TestStringDuplication) {
   EXPECT_NE(bst->value(), bst2->value());
   EXPECT_EQ(bst->value(), bst3->value());
 
+  // String literals should be eligible for a mergeable string section.
+  llvm::GlobalVariable *gv =
+      llvm::dyn_cast<llvm::GlobalVariable>(bst->value()->stripPointerCasts());
+  ASSERT_TRUE(gv != nullptr);
+  EXPECT_TRUE(gv->isConstant());
+  EXPECT_TRUE(gv->hasGlobalUnnamedAddr());
+  EXPECT_TRUE(gv->hasPrivateLinkage());
+  EXPECT_EQ(gv->getAlignment(), 1u);
+
   bool broken = h.finish(StripDebugInfo);
   EXPECT_FALSE(broken && "Module failed to verify.");
 
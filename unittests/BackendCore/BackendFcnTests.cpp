@@ -9,7 +9,14 @@
 
 #include "TestUtils.h"
 #include "go-llvm-backend.h"
+#include "go-llvm-chunker.h"
 #include "llvm/IR/Function.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/LegacyPassManager.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/Timer.h"
+#include "llvm/Transforms/IPO/PassManagerBuilder.h"
+#include "llvm/Transforms/Utils/Cloning.h"
 #include "gtest/gtest.h"
 
 using namespace llvm;
@@ -257,4 +264,274 @@ TEST(BackendFcnTests, MakeMultipleDeclarations) {
   EXPECT_FALSE(broken && "Module failed to verify.");
 }
 
+TEST(BackendFcnTests, FunctionCompletionHook) {
+  FcnTestHarness h("foo");
+  Llvm_backend *be = h.be();
+
+  // Install a completion hook; it should be invoked exactly once,
+  // for the function whose body is being set.
+  std::vector<llvm::Function *> completed;
+  be->setFunctionCompletionHook([&](llvm::Function *f) {
+      completed.push_back(f);
+    });
+
+  Bexpression *ret = mkInt64Const(be, 9);
+  h.mkReturn(ret);
+
+  bool broken = h.finish(PreserveDebugInfo);
+  EXPECT_FALSE(broken && "Module failed to verify.");
+
+  ASSERT_EQ(completed.size(), 1u);
+  EXPECT_EQ(completed[0], h.func()->function());
+}
+
+// Populate the body of the harness function; used to compare the
+// results with and without a completion hook installed.
+
+static void mkStreamTestBody(FcnTestHarness &h)
+{
+  Llvm_backend *be = h.be();
+  Bfunction *func = h.func();
+  Location loc = h.loc();
+
+  // x := 10
+  // if x == 9 { x = 1 } else { x = 2 }
+  // s := "streamed"
+  // return x
+  Btype *bi64t = be->integer_type(false, 64);
+  Bvariable *x = h.mkLocal("x", bi64t, mkInt64Const(be, 10));
+  Bexpression *vex = be->var_expression(x, VE_rvalue, loc);
+  Bexpression *cmp = be->binary_expression(OPERATOR_EQEQ, vex,
+                                           mkInt64Const(be, 9), loc);
+  Bexpression *ve1 = be->var_expression(x, VE_lvalue, loc);
+  Bstatement *as1 =
+      be->assignment_statement(func, ve1, mkInt64Const(be, 1), loc);
+  Bexpression *ve2 = be->var_expression(x, VE_lvalue, loc);
+  Bstatement *as2 =
+      be->assignment_statement(func, ve2, mkInt64Const(be, 2), loc);
+  h.mkIf(cmp, as1, as2);
+  Bexpression *str = be->string_constant_expression("streamed");
+  h.mkLocal("s", str->btype(), str);
+  h.mkReturn(be->var_expression(x, VE_rvalue, loc));
+}
+
+TEST(BackendFcnTests, FunctionCompletionHookMatchesNormal) {
+  // Reference: no hook installed. Debug meta-data is disabled in both
+  // cases, as it is for -fstreaming-codegen.
+  FcnTestHarness h1("foo");
+  h1.be()->disableDebugMetaDataGeneration();
+  mkStreamTestBody(h1);
+  bool broken = h1.finish(PreserveDebugInfo);
+  EXPECT_FALSE(broken && "Module failed to verify.");
+  std::string expected = repr(h1.func()->function());
+
+  // With a hook installed (as for -fstreaming-codegen), statements are
+  // released before the hook runs; the IR handed to the hook should
+  // be identical to that produced normally.
+  FcnTestHarness h2("foo");
+  h2.be()->disableDebugMetaDataGeneration();
+  std::string streamed;
+  h2.be()->setFunctionCompletionHook([&](llvm::Function *f) {
+      streamed = repr(f);
+    });
+  mkStreamTestBody(h2);
+  broken = h2.finish(PreserveDebugInfo);
+  EXPECT_FALSE(broken && "Module failed to verify.");
+
+  EXPECT_FALSE(streamed.empty());
+  EXPECT_EQ(expected, streamed);
+}
+
+TEST(BackendFcnTests, StreamedChunksSurviveOptimization) {
+  FcnTestHarness h("foo");
+  Llvm_backend *be = h.be();
+  be->disableDebugMetaDataGeneration();
+  mkStreamTestBody(h);
+  bool broken = h.finish(PreserveDebugInfo);
+  EXPECT_FALSE(broken && "Module failed to verify.");
+
+  // Make a copy of "foo" named "bar", so that the string literal is
+  // shared between two functions.
+  llvm::Module &module = be->module();
+  llvm::Function *foo = h.func()->function();
+  llvm::Function *bar =
+      llvm::Function::Create(foo->getFunctionType(),
+                             llvm::GlobalValue::ExternalLinkage,
+                             "bar", &module);
+  llvm::ValueToValueMapTy vmap;
+  auto barArg = bar->arg_begin();
+  for (llvm::Argument &arg : foo->args())
+    vmap[&arg] = &*barArg++;
+  llvm::SmallVector<llvm::ReturnInst *, 4> returns;
+  llvm::CloneFunctionInto(bar, foo, vmap, false, returns);
+
+  // Stream the two functions out in separate chunks, as for
+  // -fstreaming-codegen with a batch size of 1.
+  FunctionChunker chunker(&module, "go.split.test.");
+  std::unique_ptr<llvm::Module> c1 = chunker.extract({foo});
+  foo->deleteBody();
+  std::unique_ptr<llvm::Module> c2 = chunker.extract({bar});
+  bar->deleteBody();
+  chunker.promoteLocals();
+  ASSERT_EQ(chunker.numPromoted(), 1u);
+
+  llvm::GlobalVariable *lit = nullptr;
+  for (llvm::GlobalVariable &gv : module.globals())
+    if (gv.getName().startswith("go.split.test."))
+      lit = &gv;
+  ASSERT_TRUE(lit != nullptr);
+  std::string name = lit->getName();
+
+  // Optimize what remains of the main module at -O2. Nothing in the
+  // module refers to the literal any more, but the chunks do.
+  llvm::legacy::PassManager pm;
+  llvm::PassManagerBuilder pmb;
+  pmb.OptLevel = 2;
+  pmb.populateModulePassManager(pm);
+  pm.run(module);
+
+  llvm::GlobalValue *def = module.getNamedValue(name);
+  ASSERT_TRUE(def != nullptr);
+  EXPECT_FALSE(def->isDeclaration());
+  EXPECT_EQ(def->getLinkage(), llvm::GlobalValue::ExternalLinkage);
+  EXPECT_EQ(def->getVisibility(), llvm::GlobalValue::HiddenVisibility);
+
+  // Both chunks refer to the literal by the same (promoted) name.
+  for (llvm::Module *c : {c1.get(), c2.get()}) {
+    llvm::GlobalValue *ref = c->getNamedValue(name);
+    ASSERT_TRUE(ref != nullptr);
+    EXPECT_TRUE(ref->isDeclaration());
+    EXPECT_EQ(ref->getLinkage(), llvm::GlobalValue::ExternalLinkage);
+    EXPECT_EQ(ref->getVisibility(), llvm::GlobalValue::HiddenVisibility);
+  }
+}
+
+TEST(BackendFcnTests, BackendTimers) {
+  FcnTestHarness h("foo");
+  Llvm_backend *be = h.be();
+
+  // Timers are off by default.
+  EXPECT_TRUE(be->timer(Llvm_backend::FcnSetBodyTimer) == nullptr);
+
+  be->enableTimers();
+  Bexpression *ret = mkInt64Const(be, 9);
+  h.mkReturn(ret);
+
+  bool broken = h.finish(PreserveDebugInfo);
+  EXPECT_FALSE(broken && "Module failed to verify.");
+
+  EXPECT_TRUE(be->timer(Llvm_backend::FcnSetBodyTimer)->hasTriggered());
+  EXPECT_TRUE(be->timer(Llvm_backend::GenBlocksTimer)->hasTriggered());
+
+  // Report, then clear the timers (as llvm-goparse does); the group
+  // should appear in the report exactly once, and nothing should be
+  // left to report (or to print again at teardown).
+  std::string report;
+  llvm::raw_string_ostream os(report);
+  llvm::TimerGroup::printAll(os);
+  llvm::TimerGroup::clearAll();
+  os.flush();
+  size_t pos = report.find("Go backend IR generation");
+  ASSERT_NE(pos, std::string::npos);
+  EXPECT_EQ(report.find("Go backend IR generation", pos + 1),
+            std::string::npos);
+  EXPECT_FALSE(be->timer(Llvm_backend::FcnSetBodyTimer)->hasTriggered());
+
+  std::string again;
+  llvm::raw_string_ostream os2(again);
+  llvm::TimerGroup::printAll(os2);
+  os2.flush();
+  EXPECT_EQ(again.find("Go backend IR generation"), std::string::npos);
+}
+
+TEST(BackendFcnTests, FunctionStmtArenaReleased) {
+  FcnTestHarness h("foo");
+  Llvm_backend *be = h.be();
+
+  Bexpression *ret = mkInt64Const(be, 9);
+  h.mkReturn(ret);
+
+  // Statements for "foo" live in a per-function arena...
+  std::string before = be->statistics();
+  EXPECT_TRUE(before.find("fcnarenas=1 ") != std::string::npos);
+  EXPECT_TRUE(before.find(" stmts=0 ") == std::string::npos);
+
+  bool broken = h.finish(PreserveDebugInfo);
+  EXPECT_FALSE(broken && "Module failed to verify.");
+
+  // ... which is released once the function body has been set.
+  std::string after = be->statistics();
+  EXPECT_TRUE(after.find(" stmts=0 swcases=0 fcnarenas=0 ") !=
+              std::string::npos);
+}
+
+// Returns the number of live expressions reported by statistics().
+
+static unsigned liveExprs(Llvm_backend *be)
+{
+  const std::string key("nodes: exprs=");
+  std::string stats = be->statistics();
+  size_t pos = stats.find(key);
+  assert(pos != std::string::npos);
+  return std::stoul(stats.substr(pos + key.size()));
+}
+
+TEST(BackendFcnTests, FunctionExprArenaReleased) {
+  FcnTestHarness h("foo");
+  Llvm_backend *be = h.be();
+  Location loc = h.loc();
+
+  // Module-scope constants are created up front (and cached).
+  Bexpression *c9 = mkInt64Const(be, 9);
+  Bexpression *c10 = mkInt64Const(be, 10);
+  unsigned base = liveExprs(be);
+
+  // x := 10; x = x + 9; return x
+  Btype *bi64t = be->integer_type(false, 64);
+  Bvariable *x = h.mkLocal("x", bi64t, c10);
+  Bexpression *vex = be->var_expression(x, VE_rvalue, loc);
+  Bexpression *add = be->binary_expression(OPERATOR_PLUS, vex, c9, loc);
+  h.mkAssign(be->var_expression(x, VE_lvalue, loc), add);
+  h.mkReturn(be->var_expression(x, VE_rvalue, loc));
+  unsigned during = liveExprs(be);
+  EXPECT_GT(during, base);
+
+  bool broken = h.finish(PreserveDebugInfo);
+  EXPECT_FALSE(broken && "Module failed to verify.");
+
+  // The function's expressions are released along with its statements;
+  // the cached constants survive.
+  EXPECT_LT(liveExprs(be), during);
+  EXPECT_EQ(mkInt64Const(be, 9), c9);
+  EXPECT_EQ(mkInt64Const(be, 10), c10);
+}
+
+
+TEST(BackendFcnTests, DiscardValueNames) {
+  FcnTestHarness h("foo");
+  Llvm_backend *be = h.be();
+  Location loc;
+
+  be->setDiscardValueNames(true);
+  EXPECT_EQ(be->namegen("add"), "");
+
+  // return x + 1
+  Btype *bi64t = be->integer_type(false, 64);
+  Bvariable *xv = h.mkLocal("x", bi64t);
+  Bexpression *vex = be->var_expression(xv, VE_rvalue, loc);
+  Bexpression *add = be->binary_expression(OPERATOR_PLUS, vex,
+                                           mkInt64Const(be, 1), loc);
+  h.mkReturn(add);
+
+  bool broken = h.finish(StripDebugInfo);
+  EXPECT_FALSE(broken && "Module failed to verify.");
+
+  for (auto &bb : *h.func()->function()) {
+    for (auto &inst : bb) {
+      if (isa<LoadInst>(inst) || isa<BinaryOperator>(inst))
+        EXPECT_FALSE(inst.hasName());
+    }
+  }
+}
+
 }
@@ -10,11 +10,14 @@
 #include "go-llvm-bnode.h"
 #include "llvm/IR/Constants.h"
 #include "llvm/IR/Function.h"
+#include "llvm/IR/Instructions.h"
 #include "operator.h"
 #include "gtest/gtest.h"
 #include "TestUtils.h"
 #include "DiffUtils.h"
 
+#include <cstring>
+
 using namespace goBackendUnitTests;
 
 namespace {
@@ -138,6 +141,159 @@ TEST(BackendNodeTests, VerifyVisitorBehavior) {
   EXPECT_FALSE(broken && "Module failed to verify.");
 }
 
+TEST(BackendNodeTests, VerifyExplicitStackWalkers) {
+
+  FcnTestHarness h("foo");
+  Llvm_backend *be = h.be();
+  Location loc;
+
+  // Same tree as above: (22 + x) - *y
+  Btype *bi32t = be->integer_type(false, 32);
+  Btype *bpi32t = be->pointer_type(bi32t);
+  Bexpression *c22 = mkInt32Const(be, 22);
+  Bvariable *xv = h.mkLocal("x", bi32t);
+  Bvariable *yv = h.mkLocal("y", bpi32t);
+  Bexpression *ve = be->var_expression(xv, VE_rvalue, loc);
+  Bexpression *add = be->binary_expression(OPERATOR_PLUS, c22, ve, loc);
+  Bexpression *ve2 = be->var_expression(yv, VE_rvalue, loc);
+  Bexpression *der = be->indirect_expression(bi32t, ve2, false, loc);
+  Bexpression *sub = be->binary_expression(OPERATOR_MINUS, add, der, loc);
+  std::vector<Bnode *> nodes = { c22, ve, add, ve2, der, sub };
+
+  // The explicit-stack walkers should invoke exactly the same hooks
+  // in the same order as the recursive versions, including when the
+  // walk is stopped partway through. Note that ids are 1-based, with
+  // 0 used for nodes created implicitly (e.g. the load of "y").
+  for (unsigned stopAt = 0; stopAt <= nodes.size(); ++stopAt) {
+    SimpleVisitor rvis(stopAt), evis(stopAt);
+    rvis.setIds(nodes);
+    evis.setIds(nodes);
+    Bnode *rres = update_walk_nodes(sub, rvis, RecursiveWalk);
+    Bnode *eres = update_walk_nodes(sub, evis, ExplicitStackWalk);
+    EXPECT_EQ(rres, eres);
+    EXPECT_EQ(rvis.str(), evis.str());
+  }
+
+  SimpleVisitor rvis, evis;
+  rvis.setIds(nodes);
+  evis.setIds(nodes);
+  simple_walk_nodes(sub, rvis, RecursiveWalk);
+  simple_walk_nodes(sub, evis, ExplicitStackWalk);
+  EXPECT_EQ(rvis.str(), evis.str());
+
+  h.mkExprStmt(sub);
+
+  bool broken = h.finish(PreserveDebugInfo);
+  EXPECT_FALSE(broken && "Module failed to verify.");
+}
+
+// Visitor that just counts nodes, for the walker benchmark below.
+
+class CountingVisitor {
+ public:
+  CountingVisitor() : count_(0) { }
+
+  std::pair<VisitDisp, Bnode *> visitNodePre(Bnode *node) {
+    count_ += 1;
+    return std::make_pair(ContinueWalk, node);
+  }
+  std::pair<VisitDisp, Bnode *> visitNodePost(Bnode *node) {
+    return std::make_pair(ContinueWalk, node);
+  }
+  std::pair<VisitDisp, Bnode *> visitChildPre(Bnode *parent, Bnode *child) {
+    return std::make_pair(ContinueWalk, child);
+  }
+  std::pair<VisitDisp, Bnode *> visitChildPost(Bnode *parent, Bnode *child) {
+    return std::make_pair(ContinueWalk, child);
+  }
+
+  unsigned count() const { return count_; }
+
+ private:
+  unsigned count_;
+};
+
+// The original UpdatingNodeWalker algorithm (recursive, copies the
+// child vector at each node), used as a baseline for the benchmark.
+
+template<class Visitor>
+std::pair<VisitDisp, Bnode *> copying_walk(Bnode *node, Visitor &vis) {
+  auto pairPre = vis.visitNodePre(node);
+  node = pairPre.second;
+  std::vector<Bnode *> children = node->children();
+  for (unsigned idx = 0; idx < children.size(); ++idx) {
+    Bnode *child = children[idx];
+    auto pairCPre = vis.visitChildPre(node, child);
+    child = pairCPre.second;
+    auto pairChild = copying_walk(child, vis);
+    vis.visitChildPost(node, pairChild.second);
+  }
+  return vis.visitNodePost(node);
+}
+
+// Walker throughput over a synthetic tree of ~1M nodes (a balanced
+// tree of binary "+" expressions over distinct constants). Disabled
+// by default since it is slow; run with
+//
+//   GoBackendCoreTests --gtest_also_run_disabled_tests \
+//      --gtest_filter='*WalkerThroughput*'
+//
+TEST(BackendNodeTests, DISABLED_WalkerThroughput) {
+
+  FcnTestHarness h("foo");
+  Llvm_backend *be = h.be();
+  Location loc;
+
+  const unsigned numLeaves = 1u << 19;
+  std::vector<Bexpression *> level;
+  for (unsigned idx = 0; idx < numLeaves; ++idx)
+    level.push_back(mkInt64Const(be, idx));
+  while (level.size() > 1) {
+    std::vector<Bexpression *> next;
+    for (unsigned idx = 0; idx < level.size(); idx += 2)
+      next.push_back(be->binary_expression(OPERATOR_PLUS, level[idx],
+                                           level[idx+1], loc));
+    level.swap(next);
+  }
+  Bnode *root = level[0];
+
+  // All walkers should visit the same number of nodes (at least
+  // 2*numLeaves-1, more if any implicit nodes were created).
+  CountingVisitor counter;
+  simple_walk_nodes(root, counter);
+  const unsigned numNodes = counter.count();
+  EXPECT_GE(numNodes, 2 * numLeaves - 1);
+
+  const unsigned iters = 10;
+  EXPECT_EQ(runBenchmark("copying (baseline)", "nodes", iters, [&]() {
+      CountingVisitor vis;
+      copying_walk(root, vis);
+      return vis.count();
+    }), iters * numNodes);
+  EXPECT_EQ(runBenchmark("updating, recursive", "nodes", iters, [&]() {
+      CountingVisitor vis;
+      update_walk_nodes(root, vis, RecursiveWalk);
+      return vis.count();
+    }), iters * numNodes);
+  EXPECT_EQ(runBenchmark("updating, explicit stack", "nodes", iters, [&]() {
+      CountingVisitor vis;
+      update_walk_nodes(root, vis, ExplicitStackWalk);
+      return vis.count();
+    }), iters * numNodes);
+  EXPECT_EQ(runBenchmark("simple, recursive", "nodes", iters, [&]() {
+      CountingVisitor vis;
+      simple_walk_nodes(root, vis, RecursiveWalk);
+      return vis.count();
+    }), iters * numNodes);
+  EXPECT_EQ(runBenchmark("simple, explicit stack", "nodes", iters, [&]() {
+      CountingVisitor vis;
+      simple_walk_nodes(root, vis, ExplicitStackWalk);
+      return vis.count();
+    }), iters * numNodes);
+
+  h.finish(PreserveDebugInfo);
+}
+
 TEST(BackendNodeTests, CloneSubtree) {
 
   FcnTestHarness h("foo");
@@ -225,4 +381,133 @@ TEST(BackendNodeTests, FixSharing) {
   EXPECT_FALSE(broken && "Module failed to verify.");
 }
 
+
+TEST(BackendNodeTests, InternedTags) {
+
+  FcnTestHarness h("foo");
+  Llvm_backend *be = h.be();
+  Location loc = h.loc();
+
+  // Tags for expressions referring to the same variable should share
+  // storage.
+  Btype *bi32t = be->integer_type(false, 32);
+  Bvariable *xv = h.mkLocal("x", bi32t);
+  Bexpression *vex1 = be->var_expression(xv, VE_rvalue, loc);
+  Bexpression *vex2 = be->var_expression(xv, VE_rvalue, loc);
+  EXPECT_EQ(vex1->tag(), "x");
+  EXPECT_EQ(vex1->tag().data(), vex2->tag().data());
+
+  Bexpression *add = be->binary_expression(OPERATOR_PLUS, vex1, vex2, loc);
+  EXPECT_TRUE(add->tag().empty());
+  h.mkExprStmt(add);
+
+  bool broken = h.finish(PreserveDebugInfo);
+  EXPECT_FALSE(broken && "Module failed to verify.");
+}
+
+TEST(BackendNodeTests, SimplifyNodes) {
+
+  FcnTestHarness h("foo");
+  Llvm_backend *be = h.be();
+  Location loc = h.loc();
+  be->setSimplifyNodes(true);
+
+  Btype *bi8t = be->integer_type(false, 8);
+  Btype *bi32t = be->integer_type(false, 32);
+  Btype *bi64t = be->integer_type(false, 64);
+  Btype *bpi8t = be->pointer_type(bi8t);
+  Btype *bpi32t = be->pointer_type(bi32t);
+  Bvariable *xv = h.mkLocal("x", bi64t);
+  Bvariable *yv = h.mkLocal("y", bpi8t);
+  Bvariable *zv = h.mkLocal("z", bi64t);
+  Bvariable *wv = h.mkLocal("w", bi32t);
+
+  // y = (*int8)((*int32)(&x))
+  Bexpression *vex1 = be->var_expression(xv, VE_rvalue, loc);
+  Bexpression *adx1 = be->address_expression(vex1, loc);
+  Bexpression *conv1 = be->convert_expression(bpi32t, adx1, loc);
+  Bexpression *conv2 = be->convert_expression(bpi8t, conv1, loc);
+  h.mkAssign(be->var_expression(yv, VE_lvalue, loc), conv2);
+
+  // z = *&x
+  Bexpression *vex2 = be->var_expression(xv, VE_rvalue, loc);
+  Bexpression *adx2 = be->address_expression(vex2, loc);
+  Bexpression *dex = be->indirect_expression(bi64t, adx2, false, loc);
+  h.mkAssign(be->var_expression(zv, VE_lvalue, loc), dex);
+
+  // w = int32(int64(5))
+  Bexpression *conv3 = be->convert_expression(bi32t, mkInt64Const(be, 5), loc);
+  h.mkAssign(be->var_expression(wv, VE_lvalue, loc), conv3);
+
+  bool broken = h.finish(StripDebugInfo);
+  EXPECT_FALSE(broken && "Module failed to verify.");
+
+  std::string stats = be->statistics();
+  EXPECT_TRUE(stats.find("simplify: casts=1") != std::string::npos);
+
+  // Only one of the two pointer casts should have survived, and it
+  // should be applied directly to the address of 'x'.
+  unsigned bitcasts = 0;
+  for (auto &bb : *h.func()->function()) {
+    for (auto &inst : bb) {
+      llvm::BitCastInst *bc = llvm::dyn_cast<llvm::BitCastInst>(&inst);
+      if (!bc)
+        continue;
+      bitcasts += 1;
+      EXPECT_EQ(bc->getOperand(0), xv->value());
+      EXPECT_EQ(bc->getType(), bpi8t->type());
+    }
+  }
+  EXPECT_EQ(bitcasts, 1u);
+}
+
+// Reports the arena storage consumed per expression node for a large
+// expression tree. Disabled by default; run with
+// --gtest_also_run_disabled_tests to see the numbers.
+
+TEST(BackendNodeTests, DISABLED_NodeMemoryFootprint) {
+
+  FcnTestHarness h("foo");
+  Llvm_backend *be = h.be();
+  Location loc;
+
+  auto arenaBytes = [&]() {
+    std::string stats = be->nodeBuilder().statistics();
+    size_t pos = stats.find("arenabytes=");
+    EXPECT_NE(pos, std::string::npos);
+    return std::stoull(stats.substr(pos + strlen("arenabytes=")));
+  };
+
+  Btype *bi64t = be->integer_type(false, 64);
+  Bvariable *xv = h.mkLocal("x", bi64t);
+  unsigned long long before = arenaBytes();
+
+  const unsigned numLeaves = 1u << 18;
+  std::vector<Bexpression *> level;
+  for (unsigned idx = 0; idx < numLeaves; ++idx) {
+    if (idx & 1)
+      level.push_back(be->var_expression(xv, VE_rvalue, loc));
+    else
+      level.push_back(mkInt64Const(be, idx));
+  }
+  unsigned numNodes = numLeaves;
+  while (level.size() > 1) {
+    std::vector<Bexpression *> next;
+    for (unsigned idx = 0; idx < level.size(); idx += 2)
+      next.push_back(be->binary_expression(OPERATOR_PLUS, level[idx],
+                                           level[idx+1], loc));
+    numNodes += next.size();
+    level.swap(next);
+  }
+  unsigned long long after = arenaBytes();
+
+  std::cerr << numNodes << " nodes, sizeof(Bexpression)="
+            << sizeof(Bexpression) << ", "
+            << (double) (after - before) / numNodes << " arena bytes/node\n";
+  std::cerr << be->nodeBuilder().statistics() << "\n";
+
+  h.mkExprStmt(level[0]);
+  h.finish(PreserveDebugInfo);
+}
+
 }
@@ -687,4 +687,69 @@ else.1:                                           ; preds = %finally.0
   EXPECT_TRUE(isOK && "Function does not have expected contents");
 }
 
+
+TEST(BackendStmtTests, TestLongStmtList) {
+  FcnTestHarness h("foo");
+  Llvm_backend *be = h.be();
+  Bfunction *func = h.func();
+
+  Location loc;
+  Btype *bi64t = be->integer_type(false, 64);
+  Bvariable *loc1 = h.mkLocal("loc1", bi64t);
+
+  // Machine-generated code can contain very long straight-line
+  // statement sequences; make sure these are handled without issue.
+  const unsigned nstmts = 100000;
+  for (unsigned idx = 0; idx < nstmts; ++idx) {
+    Bexpression *ve = be->var_expression(loc1, VE_lvalue, loc);
+    Bexpression *cv = mkInt64Const(be, idx);
+    h.addStmt(be->assignment_statement(func, ve, cv, loc));
+  }
+
+  h.mkReturn(be->var_expression(loc1, VE_rvalue, loc));
+
+  bool broken = h.finish(StripDebugInfo);
+  EXPECT_FALSE(broken && "Module failed to verify.");
+
+  // Only the entry block should be present.
+  EXPECT_EQ(func->function()->size(), 1u);
+}
+
+TEST(BackendStmtTests, TestDeeplyNestedIfStmts) {
+  FcnTestHarness h("foo");
+  Llvm_backend *be = h.be();
+  Bfunction *func = h.func();
+
+  Location loc;
+  Btype *bi64t = be->integer_type(false, 64);
+  Bvariable *loc1 = h.mkLocal("loc1", bi64t);
+
+  // Build a long else-if chain, of the sort produced for large
+  // generated switch-like constructs:
+  //
+  //   if loc1 == 0 { loc1 = 0 } else if loc1 == 1 { loc1 = 1 } else ...
+  //
+  const unsigned depth = 10000;
+  Bstatement *chain = nullptr;
+  for (unsigned idx = depth; idx != 0; --idx) {
+    Bexpression *vex = be->var_expression(loc1, VE_rvalue, loc);
+    Bexpression *cmp = be->binary_expression(OPERATOR_EQEQ, vex,
+                                             mkInt64Const(be, idx), loc);
+    Bexpression *ve = be->var_expression(loc1, VE_lvalue, loc);
+    Bstatement *as =
+        be->assignment_statement(func, ve, mkInt64Const(be, idx), loc);
+    chain = h.mkIf(cmp, as, chain, FcnTestHarness::NoAppend);
+  }
+  h.addStmt(chain);
+
+  h.mkReturn(be->var_expression(loc1, VE_rvalue, loc));
+
+  bool broken = h.finish(StripDebugInfo);
+  EXPECT_FALSE(broken && "Module failed to verify.");
+
+  // Entry block, plus "then" and "fallthrough" blocks for each 'if',
+  // plus "else" blocks for all but the innermost.
+  EXPECT_EQ(func->function()->size(), 3u * depth);
+}
+
 }
@@ -107,6 +107,18 @@ TEST(BackendTreeIntegrity, CheckTreeIntegrity3) {
   Bblock *block = mkBlockFromStmt(be.get(), func, es);
   addStmtToBlock(be.get(), block, es);
 
+  // The node builder has recorded the sharing; it is described only
+  // once found to be unrepairable.
+  BnodeBuilder &nb = be->nodeBuilder();
+  EXPECT_TRUE(nb.stmtSharingPending());
+  std::string msg;
+  std::vector<Bnode *> roots;
+  EXPECT_FALSE(nb.resolveSharing(msg, roots));
+  EXPECT_TRUE(containstokens(msg, "stmt has multiple parents"));
+  EXPECT_FALSE(nb.sharingPending());
+  ASSERT_EQ(roots.size(), 1u);
+  EXPECT_EQ(roots[0], block);
+
   TreeIntegCtl control(NoDumpPointers, CheckVarExprs, DontRepairSharing);
   std::pair<bool, std::string> result =
       be->checkTreeIntegrity(block, control);
@@ -122,4 +134,34 @@ TEST(BackendTreeIntegrity, CheckTreeIntegrity3) {
   be->function_set_body(func, block2);
 }
 
+TEST(BackendTreeIntegrity, IncrementalSharingRepair) {
+  FcnTestHarness h("foo");
+  Llvm_backend *be = h.be();
+  Bfunction *func = h.func();
+  Location loc;
+
+  // Create "*p", then hand it to two different statements. Sharing
+  // is detected as the second statement is created, and repaired by
+  // cloning the deref.
+  Btype *bi64t = be->integer_type(false, 64);
+  Btype *bpi64t = be->pointer_type(bi64t);
+  Bvariable *pv = h.mkLocal("p", bpi64t);
+  Bexpression *vex = be->var_expression(pv, VE_rvalue, loc);
+  Bexpression *dex = be->indirect_expression(bi64t, vex, false, loc);
+  Bstatement *es1 = be->expression_statement(func, dex);
+  h.addStmt(es1);
+  Bstatement *es2 = be->expression_statement(func, dex);
+  h.addStmt(es2);
+  EXPECT_NE(es1->getExprStmtExpr(), es2->getExprStmtExpr());
+
+  TreeIntegCtl control(NoDumpPointers, IgnoreVarExprs, DontRepairSharing);
+  std::pair<bool, std::string> result =
+      be->checkTreeIntegrity(h.block(), control);
+  EXPECT_TRUE(result.first);
+  EXPECT_EQ(result.second, "");
+
+  bool broken = h.finish(PreserveDebugInfo);
+  EXPECT_FALSE(broken && "Module failed to verify.");
+}
+
 }
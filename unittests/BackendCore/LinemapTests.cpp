@@ -77,6 +77,7 @@ TEST(LinemapTests, BasicLinemap) {
   std::string stats = lm->statistics();
   EXPECT_EQ(stats, "accesses=9 files=5 segments=4 "
             "locmem=22 bytes/location=2.4");
+  EXPECT_GE(lm->memoryBytes(), 22u);
 }
 
 }
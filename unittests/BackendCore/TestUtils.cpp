@@ -10,6 +10,9 @@
 #include "TestUtils.h"
 #include "llvm/IR/DebugInfo.h"
 
+#include <chrono>
+#include <iostream>
+
 namespace goBackendUnitTests {
 
 std::string trimsp(const std::string &s) {
@@ -427,6 +430,20 @@ Bstatement *addExprToBlock(Backend *be, Bfunction *func,
   return es;
 }
 
+unsigned runBenchmark(const char *tag, const char *units, unsigned iters,
+                      const std::function<unsigned()> &fn)
+{
+  auto t0 = std::chrono::steady_clock::now();
+  unsigned items = 0;
+  for (unsigned it = 0; it < iters; ++it)
+    items += fn();
+  auto t1 = std::chrono::steady_clock::now();
+  double secs = std::chrono::duration<double>(t1 - t0).count();
+  std::cerr << tag << ": " << (items / secs / 1e6) << " M" << units
+            << "/sec\n";
+  return items;
+}
+
 class NodeReprVisitor {
  public:
   NodeReprVisitor() : os_(str_) { }
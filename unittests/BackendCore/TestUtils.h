@@ -27,6 +27,7 @@
 
 #include "DiffUtils.h"
 
+#include <functional>
 #include <stdarg.h>
 
 #define RAW_RESULT(x) #x
@@ -142,6 +143,13 @@ Bstatement *addStmtToBlock(Backend *be, Bblock *block, Bstatement *st);
 Bstatement *addExprToBlock(Backend *be, Bfunction *f,
                            Bblock *bl, Bexpression *e);
 
+// Helper for micro-benchmarks (DISABLED_ tests): invokes 'fn' 'iters'
+// times, where each invocation returns the number of items (lookups,
+// nodes, etc) it processed, and prints the rate at which items were
+// processed to stderr. Returns the total number of items processed.
+unsigned runBenchmark(const char *tag, const char *units, unsigned iters,
+                      const std::function<unsigned()> &fn);
+
 // What to do with debug meta-data when verifying the module
 enum DebugDisposition {
   StripDebugInfo,